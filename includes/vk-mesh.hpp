@@ -2,6 +2,8 @@
 
 #include "vk_types.hpp"
 #include <vector>
+#include <memory>
+#include <string>
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
 
@@ -21,12 +23,111 @@ struct Vertex
 	glm::vec2 uv;
 
 	static VertexInputDescription getVertexDescription();
+
+	bool operator==(const Vertex& other) const
+	{
+		return position == other.position && normal == other.normal && color == other.color && uv == other.uv;
+	}
+};
+
+// 16 byte vertex: positions as unorm16 inside the mesh bounds, octahedral snorm16 normals, half float uvs
+struct PackedVertex
+{
+	uint16_t position[4];
+	int16_t normal[2];
+	uint16_t uv[2];
+
+	static PackedVertex pack(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& boundsExtent);
+	Vertex unpack(const glm::vec3& boundsMin, const glm::vec3& boundsExtent) const;
+};
+
+template<typename Format>
+VertexInputDescription getVertexDescription();
+
+template<>
+VertexInputDescription getVertexDescription<Vertex>();
+
+template<>
+VertexInputDescription getVertexDescription<PackedVertex>();
+
+// index range of one OBJ object/material pair, bounds are in mesh space
+struct Submesh
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t materialIndex; // into Mesh::_materialNames
+
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+
+	glm::vec3 sphereCenter;
+	float sphereRadius;
 };
 
+class MappedFile;
+
 struct Mesh
 {
 	std::vector<Vertex> _vertices;
+	std::vector<uint32_t> _indices;
+
+	// set instead of the vectors above when the mesh is read from a memory-mapped mesh cache
+	std::shared_ptr<MappedFile> _mappedFile;
+	const Vertex* _mappedVertices = nullptr;
+	const uint32_t* _mappedIndices = nullptr;
+	size_t _mappedVertexCount = 0;
+	size_t _mappedIndexCount = 0;
+
+	glm::vec3 _boundsMin = glm::vec3(0.0f);
+	glm::vec3 _boundsMax = glm::vec3(0.0f);
+
+	// always at least one range covering the whole index buffer once computeBounds ran
+	std::vector<Submesh> _submeshes;
+	std::vector<std::string> _materialNames;
+
+	// filled by packVertices, uploaded instead of the full vertices when present
+	std::vector<PackedVertex> _packedVertices;
+
 	AllocatedBuffer _vertexBuffer;
+	AllocatedBuffer _indexBuffer;
+
+	// mesh field of the draw sort key, assigned by the engine
+	uint32_t _sortId = 0;
+
+	// location in the engine's mega vertex and index buffers
+	int32_t _megaVertexOffset = 0;
+	uint32_t _megaFirstIndex = 0;
 
-	bool loadFromObj(const char* filename);
+	// parses on threadCount workers, 0 uses every hardware thread
+	bool loadFromObj(const char* filename, uint32_t threadCount = 0);
+	// single threaded tinyobj loader, kept as the reference for the parallel parser
+	bool loadFromObjReference(const char* filename);
+	// loads through the binary mesh cache next to the file, writing it optimized when missing or stale
+	bool loadFromObjCached(const char* filename);
+
+	const Vertex* getVertexData() const;
+	size_t getVertexCount() const;
+	const uint32_t* getIndexData() const;
+	size_t getIndexCount() const;
+
+	// computes the mesh bounds and the AABB and bounding sphere of every submesh
+	void computeBounds();
+	// the extent never has a zero component so it can be used to dequantize positions
+	glm::vec3 getBoundsExtent() const;
+
+	void packVertices();
+	bool isPacked() const;
+	size_t getVertexStride() const;
+
+	// 16-bit indices are used when every vertex can be addressed by them
+	VkIndexType getIndexType() const;
+	size_t getIndexSize() const;
 };
+
+// loads filename indexed and checks the vertex and index counts against a plain tinyobj read of it,
+// one index per corner and one vertex per distinct corner, and that the indices give the corners back
+bool testMeshIndexing(const char* filename);
+
+// round trips generated vertices through PackedVertex and checks the error against the format: a unorm16 step
+// of the bounds extent for positions, 7e-5 radians for octahedral normals and half precision for uvs
+bool testVertexPacking();
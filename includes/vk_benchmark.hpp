@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glm/vec3.hpp>
+
+namespace vkBench
+{
+	struct CameraKeyframe
+	{
+		float time = 0.0f; // seconds from the start of the path
+		glm::vec3 position = glm::vec3(0.0f); // eye position in world space
+		float yaw = 0.0f; // degrees around +y
+		float pitch = 0.0f; // degrees around +x
+	};
+
+	// text file with one "time x y z yaw pitch" keyframe per line, '#' starts a comment, times increase
+	class CameraPath
+	{
+	public:
+		bool load(const char* filename);
+
+		// linear between the surrounding keyframes, clamped to the first and the last one
+		CameraKeyframe sample(float time) const;
+
+		float getDuration() const { return _keyframes.empty() ? 0.0f : _keyframes.back().time; }
+		bool empty() const { return _keyframes.empty(); }
+
+	private:
+		std::vector<CameraKeyframe> _keyframes;
+	};
+
+	struct FrameSample
+	{
+		double frameTime = 0.0; // ms from the end of the previous frame to the end of this one
+		double cpuTime = 0.0; // ms of draw() without the fence wait
+		double gpuTime = -1.0; // ms between the first and the last timestamp, negative without timestamp support
+		uint32_t draws = 0;
+		uint64_t triangles = 0;
+		double memory = 0.0; // MB of device memory used by the process
+		// name and ms of every GPU profiler scope, names are string literals
+		std::vector<std::pair<const char*, double>> gpuScopes;
+	};
+
+	struct Percentiles
+	{
+		double average = 0.0;
+		double p50 = 0.0;
+		double p95 = 0.0;
+		double p99 = 0.0;
+		double max = 0.0;
+	};
+
+	// nearest rank, negative values count as missing
+	Percentiles computePercentiles(std::vector<double> values);
+
+	struct BenchmarkSettings
+	{
+		const char* cameraPath = nullptr;
+		uint32_t frameCount = 600;
+		const char* jsonPath = nullptr;
+		const char* csvPath = nullptr;
+		// p95 regression thresholds in ms, 0 disables the check
+		double maxFrameTimeP95 = 0.0;
+		double maxGpuTimeP95 = 0.0;
+		// JSON of an earlier run on the same machine, written by the first run when it does not exist yet
+		const char* baselinePath = nullptr;
+		// how far in percent a p95 may rise above the baseline's, 0 disables the check
+		double maxRegression = 0.0;
+	};
+
+	// per frame samples with the percentiles of every column and GPU scope
+	bool writeJson(const char* filename, const char* name, const std::vector<FrameSample>& frames);
+	bool writeCsv(const char* filename, const std::vector<FrameSample>& frames);
+
+	// the p95 of a summary column of a writeJson file, false when the file or the column is missing
+	bool readBaselineP95(const char* filename, const char* column, double& outP95);
+
+	// prints the percentiles and returns false when a p95 is above its threshold or regressed from the baseline
+	bool checkResults(const BenchmarkSettings& settings, const std::vector<FrameSample>& frames);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "vk_types.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+// prints where a Vulkan call failed and exits, nothing in the engine recovers from those
+#define VK_CHECK(res) vk_check(res, __FILE__, __LINE__)
+
+inline void vk_check(VkResult result, const char* file, int line)
+{
+	if (result == VK_SUCCESS)
+	{
+		return;
+	}
+
+	printf("::VK_CHECK:: [%s] %d\n", file, line);
+	exit(1);
+}
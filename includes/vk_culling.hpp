@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+namespace vkCull
+{
+	// xyz is the normal pointing into the frustum, w the plane distance
+	struct Frustum
+	{
+		glm::vec4 planes[6];
+	};
+
+	// world space bounding spheres as separate arrays, padded to a multiple of 8 so every path reads full lanes
+	struct SphereBounds
+	{
+		std::vector<float> centerX;
+		std::vector<float> centerY;
+		std::vector<float> centerZ;
+		std::vector<float> radius;
+		size_t count = 0;
+
+		void resize(size_t sphereCount);
+		void set(size_t index, const glm::vec3& center, float sphereRadius);
+	};
+
+	enum class CullPath
+	{
+		Scalar,
+		SSE,
+		AVX2
+	};
+
+	// left, right, bottom, top, near, far planes of a view projection matrix
+	Frustum extractFrustum(const glm::mat4& viewProj);
+
+	// moves a sphere to world space, the radius grows with the largest axis scale
+	void transformSphere(const glm::mat4& transform, const glm::vec3& center, float radius, glm::vec3& outCenter, float& outRadius);
+
+	// the fastest path the CPU supports, checked once at runtime
+	CullPath getBestCullPath();
+	const char* getCullPathName(CullPath path);
+
+	// writes the indices of the spheres touching the frustum in increasing order, every path gives the same list
+	void cullSpheres(const Frustum& frustum, const SphereBounds& bounds, std::vector<uint32_t>& outVisible, CullPath path);
+	void cullSpheres(const Frustum& frustum, const SphereBounds& bounds, std::vector<uint32_t>& outVisible);
+
+	// same list as cullSpheres, 16k sphere chunks are culled on the shared job system and compacted afterwards
+	void cullSpheresParallel(const Frustum& frustum, const SphereBounds& bounds, std::vector<uint32_t>& outVisible, CullPath path);
+	void cullSpheresParallel(const Frustum& frustum, const SphereBounds& bounds, std::vector<uint32_t>& outVisible);
+
+	// times every supported path at 10k, 100k and 1M spheres on one thread and on the job system,
+	// false when any result differs from the scalar one
+	bool benchmarkCulling();
+
+	// untimed, every supported path on one thread and on the job system against the scalar one for several views
+	// and counts around the padding and chunk sizes, with spheres touching the planes, false on any difference
+	bool testCulling();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "vk_types.hpp"
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// descriptor set layouts by their bindings, pipelines asking for the same bindings share one layout,
+// which keeps their sets compatible with each other
+class DescriptorLayoutCache
+{
+public:
+	void init(VkDevice device);
+	// destroys every layout
+	void cleanup();
+
+	// binding order does not matter, immutable samplers are not supported
+	VkDescriptorSetLayout getLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+
+	size_t getLayoutCount() const;
+
+private:
+	struct LayoutInfo
+	{
+		// sorted by binding
+		std::vector<VkDescriptorSetLayoutBinding> bindings;
+
+		bool operator==(const LayoutInfo& other) const;
+	};
+
+	struct LayoutHash
+	{
+		size_t operator()(const LayoutInfo& info) const;
+	};
+
+	VkDevice _device{ VK_NULL_HANDLE };
+
+	// init tasks ask for layouts concurrently
+	mutable std::mutex _mutex;
+	std::unordered_map<LayoutInfo, VkDescriptorSetLayout, LayoutHash> _layouts;
+};
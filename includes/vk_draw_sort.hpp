@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace vkSort
+{
+	// bits 63-52 pipeline, 51-40 descriptor set, 39-24 mesh, 23-8 depth bucket, 7-0 unused;
+	// ids wider than their field wrap, which only costs extra binds
+	constexpr int PIPELINE_SHIFT = 52;
+	constexpr int DESCRIPTOR_SHIFT = 40;
+	constexpr int MESH_SHIFT = 24;
+	constexpr int DEPTH_SHIFT = 8;
+
+	struct DrawKey
+	{
+		uint64_t key;
+		uint32_t index; // into the renderables
+	};
+
+	struct DrawStats
+	{
+		uint32_t draws = 0;
+		uint32_t objects = 0; // equal to draws without instancing
+		uint32_t pipelineBinds = 0;
+		uint32_t descriptorBinds = 0;
+		uint32_t vertexBufferBinds = 0;
+		uint64_t triangles = 0;
+	};
+
+	uint64_t makeDrawKey(uint32_t pipelineId, uint32_t descriptorId, uint32_t meshId, uint32_t depthBucket);
+
+	// maps a distance in [0, maxDepth] to the 16-bit bucket, nearer first
+	uint32_t getDepthBucket(float depth, float maxDepth);
+
+	// stable LSD radix sort by key, 8 bits per pass, passes where every key has the same digit are skipped
+	void radixSort(std::vector<DrawKey>& keys, std::vector<DrawKey>& scratch);
+}
@@ -2,13 +2,25 @@
 
 #include "vk_types.hpp"
 #include "vk-mesh.hpp"
+#include "vk_culling.hpp"
+#include "vk_draw_sort.hpp"
+#include "vk_upload.hpp"
+#include "vk_benchmark.hpp"
+#include "vk_gpu_profiler.hpp"
+#include "vk_pipelines.hpp"
+#include "vk_shader_reload.hpp"
+#include "vk_reflection.hpp"
+#include "vk_descriptors.hpp"
 #include <vector>
 #include <deque>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <mutex>
 #include <glm/glm.hpp>
 #include <unordered_map>
 
-constexpr unsigned int FRAME_OVERLAP = 2;
+constexpr unsigned int MAX_OBJECTS = 100000;
 
 struct Texture
 {
@@ -27,6 +39,9 @@ struct MeshPushConstants
 {
     glm::vec4 data;
     glm::mat4 renderMatrix;
+    // dequantizes PackedVertex positions, offset + position * scale
+    glm::vec4 positionOffset;
+    glm::vec4 positionScale;
 };
 
 struct Material
@@ -34,11 +49,19 @@ struct Material
     VkDescriptorSet textureSet{ VK_NULL_HANDLE };
     VkPipeline pipeline;
     VkPipelineLayout pipelineLayout;
+    // the registry state pipeline was built from
+    PipelineKey pipelineKey{ 0 };
+
+    // dense ids of pipeline and textureSet for the draw sort key
+    uint32_t pipelineSortId{ 0 };
+    uint32_t descriptorSortId{ 0 };
 };
 
 struct RenderObject
 {
     Mesh* mesh;
+    // index into mesh->_submeshes, only that index range is drawn
+    uint32_t submeshIndex{ 0 };
     Material* material;
     glm::mat4 transformMatrix;
 };
@@ -64,6 +87,38 @@ struct GPUObjectData
     glm::mat4 modelMatrix;
 };
 
+// input of indirect_cull.comp for one command slot, std430
+struct GPUDrawData
+{
+    glm::vec4 sphere; // world space center and radius
+    uint32_t firstIndex; // in the mega index buffer
+    uint32_t indexCount;
+    int32_t vertexOffset; // in the mega vertex buffer
+    uint32_t batch;
+    uint32_t batchStart; // first command slot of the batch
+    uint32_t objectIndex; // object buffer slot, used as firstInstance
+    uint32_t padding[2];
+};
+
+struct GPUCullData
+{
+    glm::vec4 planes[6];
+    uint32_t drawCount;
+    // 1 packs the visible commands of each batch and counts them, 0 writes every slot with 0 or 1 instances
+    uint32_t compact;
+    uint32_t padding[2];
+};
+
+// the command slots of one material, drawn with a single indirect call
+struct IndirectBatch
+{
+    Material* material;
+    uint32_t first;
+    uint32_t count;
+    // of every slot in the batch, before culling
+    uint64_t triangles{ 0 };
+};
+
 struct FrameData
 {
     VkSemaphore _presentSemaphore, _renderSemaphore;
@@ -71,25 +126,55 @@ struct FrameData
 
     VkCommandPool _commandPool;
     VkCommandBuffer _mainCommandBuffer;
+    // ImGui and the GPU driven draws, a secondary recorded on the main thread
+    VkCommandBuffer _overlayCommandBuffer;
+
+    // one pool and secondary per recording slice, a pool is only touched by the job recording its slice
+    std::vector<VkCommandPool> _workerCommandPools;
+    std::vector<VkCommandBuffer> _workerCommandBuffers;
 
     AllocatedBuffer cameraBuffer;
     VkDescriptorSet globalDescriptor;
 
     AllocatedBuffer objectBuffer;
     VkDescriptorSet objectDescriptor;
+
+    // GPU driven path, written by the CPU (draw data, cull data) and by indirect_cull.comp (commands, counts)
+    AllocatedBuffer drawDataBuffer;
+    AllocatedBuffer cullDataBuffer;
+    AllocatedBuffer indirectBuffer;
+    AllocatedBuffer drawCountBuffer;
+    VkDescriptorSet cullDescriptor;
+
+    // persistent mappings of the CPU_TO_GPU buffers above
+    GPUCameraData* cameraData;
+    GPUObjectData* objectData;
+    GPUDrawData* drawData;
+    GPUCullData* cullData;
+
+    // when the oldest input this frame consumed arrived, the latency is taken once its fence signals
+    std::chrono::high_resolution_clock::time_point inputTime;
+    bool hasInput{ false };
+
+    // timestamps of the frame's scopes, read back once its fence signals
+    GpuProfiler gpuProfiler;
 };
 
 struct DeletionQueue
 {
     std::deque<std::function<void()>> deletors;
+    // init tasks run on several threads and push their deletors concurrently
+    std::mutex mutex;
 
     void pushFunction(std::function<void()>&& function)
     {
+        std::lock_guard<std::mutex> lock(mutex);
         deletors.push_back(function);
     }
 
     void flush()
     {
+        std::lock_guard<std::mutex> lock(mutex);
         for (auto it = deletors.rbegin(); it != deletors.rend(); it++)
         {
             (*it)();
@@ -104,6 +189,26 @@ class VulkanEngine
 public:
     VmaAllocator _allocator;
     DeletionQueue _mainDeleteionQueue;
+    // mesh and texture copies, batched and submitted to the transfer queue
+    UploadManager _uploadManager;
+    // hides the window, main exits right after init so only the startup time is measured
+    bool _startupBenchmark{ false };
+    // slices of the sorted draw list recorded in parallel into secondaries, 0 uses every job system thread
+    uint32_t _recordThreadCount{ 0 };
+
+    // read by init, frames in flight trade CPU/GPU overlap against latency, the swapchain count is
+    // the minimum asked of the surface and the present mode falls back to FIFO when unsupported
+    uint32_t _framesInFlight{ 2 };
+    uint32_t _swapchainImageCount{ 3 };
+    VkPresentModeKHR _presentMode{ VK_PRESENT_MODE_FIFO_KHR };
+    // no SDL window and no surface, frames render into offscreen images and are never presented
+    bool _headless{ false };
+    // Chrome trace of the CPU zones written by cleanup and by the profiler window, nullptr skips the one at exit
+    const char* _tracePath{ nullptr };
+    // seeds the pipeline cache at init and is rewritten by cleanup, nullptr keeps the cache in memory only
+    const char* _pipelineCachePath{ "pipeline_cache.bin" };
+    // recompiles shaders/ when a source changes and swaps the rebuilt pipelines in, never in headless mode
+    bool _shaderHotReload{ true };
 
     private:
         VkExtent2D _windowExtent{1280, 720};
@@ -113,39 +218,143 @@ public:
         VkDebugUtilsMessengerEXT _debugMessenger;
         VkPhysicalDevice _physicalDevice;
         VkDevice _device;
-        VkSurfaceKHR _surface;
+        VkSurfaceKHR _surface{ VK_NULL_HANDLE };
 
-        VkSwapchainKHR _swapchain;
+        VkSwapchainKHR _swapchain{ VK_NULL_HANDLE };
         VkFormat _swapchainImageFormat;
+        // what vkb actually created, _swapchainImages holds the image count
+        VkPresentModeKHR _swapchainPresentMode;
+        uint32_t _swapchainMinImageCount;
+
+        // headless mode, one color image per frame in flight stands in for the swapchain images and
+        // a requested frame is copied to _readbackBuffer and unpacked into _readbackPixels as RGBA8
+        std::vector<AllocatedImage> _offscreenImages;
+        AllocatedBuffer _readbackBuffer;
+        bool _readbackRequested{ false };
+        std::vector<uint8_t> _readbackPixels;
         std::vector<VkImage> _swapchainImages; // actual image
         std::vector<VkImageView> _swapchainImageViews; // wrapper for image
 
         VkQueue _graphicsQueue;
         uint32_t _graphicsQueueFamily;
 
+        // a dedicated transfer family when the device has one, the graphics queue otherwise
+        VkQueue _transferQueue;
+        uint32_t _transferQueueFamily;
+        bool _timelineSemaphoreSupported{ false };
+        // size of the persistently mapped staging ring, larger uploads are streamed through it in chunks
+        size_t _stagingRingSize{ 64 * 1024 * 1024 };
+
+        // shared by every graphics and compute pipeline and by ImGui, internally synchronized so
+        // the init tasks building pipelines may use it concurrently
+        VkPipelineCache _pipelineCache{ VK_NULL_HANDLE };
+        size_t _pipelineCacheLoadedSize{ 0 };
+        std::atomic<uint64_t> _pipelineCreateMicroseconds{ 0 };
+        // owns every graphics pipeline, materials refer to them by key
+        PipelineRegistry _pipelineRegistry;
+
+        // shader hot reload, the watcher thread rebuilds the pipelines of the materials using a recompiled
+        // shader and the next draw swaps them in
+        ShaderReloader _shaderReloader;
+        struct ReloadableMaterial
+        {
+            std::vector<std::string> shaderPaths; // SPIR-V of every stage, in the builder's stage order
+            PipelineKey pipelineKey; // the latest one built, only touched by the watcher thread after init
+            vkReflect::ShaderReflection layout; // what the pipeline layout and vertex input provide
+        };
+        std::unordered_map<std::string, ReloadableMaterial> _reloadableMaterials;
+        std::mutex _reloadMutex;
+        std::vector<std::pair<std::string, PipelineKey>> _reloadedPipelines; // guarded by _reloadMutex
+        // replaced pipelines, destroyed by applyReloadedPipelines once no frame in flight can use them
+        struct RetiredPipeline
+        {
+            VkPipeline pipeline;
+            unsigned int frame; // the first frame drawn without it
+            uint32_t framesInFlight; // _frames.size() when it was retired
+        };
+        std::vector<RetiredPipeline> _retiredPipelines;
+        // drawObjects prints once when the visible objects do not fit the object buffer
+        bool _objectLimitWarned{ false };
+
         VkRenderPass _renderpass;
         std::vector<VkFramebuffer> _framebuffers;
 
-        VkPipeline _meshPipeline;
         Mesh _triangleMesh;
 
         VkPipelineLayout _meshPipelineLayout;
 
         Mesh _modelMesh;
+        Mesh _empireMesh;
 
         VkImageView _depthImageView;
         AllocatedImage _depthImage;
         VkFormat _depthFormat;
 
         std::vector<RenderObject> _renderables;
+
+        // world space bounding spheres of _renderables and the indices that passed the frustum test this frame
+        vkCull::SphereBounds _renderableBounds;
+        std::vector<uint32_t> _visibleRenderables;
+        double _cullTime{ 0.0 };
+
+        // visible renderables in sort key order, rebuilt every frame
+        std::vector<vkSort::DrawKey> _drawKeys;
+        std::vector<vkSort::DrawKey> _drawKeyScratch;
+        std::vector<uint32_t> _drawOrder;
+        double _sortTime{ 0.0 };
+        // CPU time spent writing the per-frame uniform and storage buffers
+        double _uploadTime{ 0.0 };
+        // CPU time from the first secondary begin to vkCmdExecuteCommands of the CPU path
+        double _recordTime{ 0.0 };
+        uint32_t _recordSliceCount{ 0 };
+        // CPU time blocked on the render fence of the reused frame
+        double _fenceWaitTime{ 0.0 };
+        // input to the fence of the frame that consumed it signaling, negative when no such frame finished
+        double _inputLatency{ -1.0 };
+        double _averageInputLatency{ 0.0 };
+        std::chrono::high_resolution_clock::time_point _pendingInputTime;
+        bool _hasPendingInput{ false };
+        vkSort::DrawStats _drawStats;
+        // GPU time of the root scope of frame _gpuTimeFrame, the latest one whose timestamps were read,
+        // negative when no frame finished since the last draw or without timestamp support
+        bool _timestampsSupported{ false };
+        double _gpuTime{ -1.0 };
+        unsigned int _gpuTimeFrame{ 0 };
+        std::vector<GpuScopeResult> _gpuScopes;
+
+        // GPU driven path, every mesh lives in one vertex and one index buffer and
+        // indirect_cull.comp writes the draw commands
+        bool _gpuDriven{ false };
+        bool _gpuDrivenSupported{ false };
+        bool _drawIndirectCountSupported{ false };
+        bool _multiDrawIndirectSupported{ false };
+        PFN_vkCmdDrawIndexedIndirectCountKHR _vkCmdDrawIndexedIndirectCount{ nullptr };
+
+        AllocatedBuffer _megaVertexBuffer;
+        AllocatedBuffer _megaIndexBuffer;
+
+        VkDescriptorSetLayout _cullSetLayout;
+        VkPipelineLayout _cullPipelineLayout;
+        VkPipeline _cullPipeline{ VK_NULL_HANDLE };
+
+        std::vector<IndirectBatch> _indirectBatches;
+        std::vector<uint32_t> _indirectObjects; // renderable of every command slot
         std::unordered_map<std::string, Material> _materials;
         std::unordered_map<std::string, Mesh> _meshes;
 
         unsigned int _framenumber = 0;
         int _selectedShader{ 0 };
         glm::vec3 _camPos = { 0.0f, -6.0f, -10.0f };
+        // degrees, applied after the _camPos translation
+        float _camYaw{ 0.0f };
+        float _camPitch{ 0.0f };
+
+        // set by --packed-vertices, loaded meshes are uploaded as PackedVertex and drawn with
+        // triangle_mesh_packed_vert.spv, the GPU driven path is not used with them
+        bool _usePackedVertices{ false };
         
-        FrameData _frames[FRAME_OVERLAP];
+        // _framesInFlight entries, sized by init
+        std::vector<FrameData> _frames;
 
         VkDescriptorSetLayout _globalSetLayout;
         VkDescriptorPool _descriptorPool;
@@ -160,54 +369,104 @@ public:
         UploadContext _uploadContext;
         
         std::unordered_map<std::string, Texture> _loadedTextures;
+        // filled by decodeImages on an init worker, uploaded and freed by loadImages
+        std::unordered_map<std::string, DecodedImage> _decodedImages;
 
         VkDescriptorSetLayout _singleTextureSetLayout;
 
+        // every descriptor set layout, built from what the shaders declare
+        DescriptorLayoutCache _layoutCache;
+        // the mesh vertex and fragment shaders, sets 0 to 2 and the push constants of _meshPipelineLayout
+        vkReflect::ShaderReflection _meshReflection;
+
     public:
+        // a headless instance finds a device init would accept, lets tests skip on machines without one
+        static bool isDeviceAvailable();
+
         void init();
         void cleanup();
         void draw();
         void run();
 
-        AllocatedBuffer createBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
+        // persistentlyMapped keeps the allocation mapped for its lifetime, the pointer is stored in _mapped
+        AllocatedBuffer createBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, bool persistentlyMapped = false);
+        // makes host writes visible to the device, a no-op on host coherent memory
+        void flushBuffer(const AllocatedBuffer& buffer, VkDeviceSize offset, VkDeviceSize size);
         void immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function);
 
+        // fills the scene with 100k objects and prints the CPU record time per frame on 1 to maxThreadCount threads
+        void benchmarkRecording(uint32_t maxThreadCount);
+        // feeds one input per frame and prints fence wait and input to present latency of the current settings
+        void benchmarkLatency(uint32_t frameCount);
+        // rebuilds the registered pipelines into an empty cache and then into one seeded from it, prints both times
+        void benchmarkPipelineCache();
+
+        // headless only, draws frameCount frames and writes the last one to readbackPath when it is not null
+        void runHeadless(uint32_t frameCount, const char* readbackPath);
+        // headless only, renders the scene with the CPU and the GPU driven path and diffs the images
+        bool compareDrawPaths(const char* readbackPath);
+        // replays a camera path at a fixed timestep, writes the per frame results and fails when a p95 is above its
+        // threshold or regressed from the baseline
+        bool runBenchmark(const vkBench::BenchmarkSettings& settings);
+
     private:
         void initVulkan();
         void initImgui();
         void initSwapchain();
+        void initOffscreenTargets();
+        // flame graph of the last frame's CPU zones on every thread
+        void drawProfilerUi();
+        // pumps SDL events and starts an ImGui frame, nothing in headless mode
+        void beginUiFrame();
+        // draws frameCount frames and reads the last one back into _readbackPixels
+        void renderAndReadback(uint32_t frameCount);
         void initCommands();
         void initDefaultRenderpass();
         void initFramebuffers();
         void initSyncStructures();
         void initPipelines();
-        bool loadShaderModule(const char* path, VkShaderModule& outShaderModule);
+        // outReflection is filled from the same code when it is not null
+        bool loadShaderModule(const char* path, VkShaderModule& outShaderModule, vkReflect::ShaderReflection* outReflection = nullptr);
+        // for modules from loadShaderModule, the pipeline registry forgets their code hash
+        void destroyShaderModule(VkShaderModule module);
+        // merged reflection of the stages of one pipeline, without creating modules
+        bool reflectShaders(const std::vector<const char*>& paths, vkReflect::ShaderReflection& outReflection);
+        const char* getMeshVertShaderPath() const;
+        void initShaderReload();
+        // watcher thread, rebuilds the pipelines of the materials using one of spirvPaths
+        void rebuildPipelines(const std::vector<std::string>& spirvPaths);
+        // start of draw, swaps rebuilt pipelines into their materials and destroys the replaced ones no frame in flight uses
+        void applyReloadedPipelines();
+        // CPU side of loadMeshes, safe to run concurrently for different meshes
+        void parseMesh(const char* path, Mesh& outMesh);
         void loadMeshes();
-        void uploadMesh(Mesh& mesh);
-        Material* createMaterial(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name);
+        UploadTicket uploadMesh(Mesh& mesh);
+        Material* createMaterial(PipelineKey pipeline, VkPipelineLayout layout, const std::string& name);
         Material* getMaterial(const std::string& name);
         Mesh* getMesh(const std::string& name);
-        void drawObjects(VkCommandBuffer cmd, RenderObject* first, int count);
+        GPUCameraData getCameraData() const;
+        // MB of device memory used by the process across every heap
+        double getDeviceMemoryUsage() const;
+        // call again after renderables are added or moved
+        void updateRenderableBounds();
+        void cullRenderables(const glm::mat4& viewProj);
+        void assignSortIds();
+        void sortRenderables(const glm::vec3& eye);
+        void uploadFrameUniforms();
+        // fills the object buffer and executes the secondaries recording [0, drawCount) of order
+        void drawObjects(VkCommandBuffer cmd, VkFramebuffer framebuffer, RenderObject* first, const uint32_t* order, size_t drawCount);
+        // records draws [begin, end) of order, safe to call concurrently on different command buffers
+        void recordObjects(VkCommandBuffer cmd, RenderObject* first, const uint32_t* order, size_t begin, size_t end, vkSort::DrawStats& outStats);
+        void beginSecondary(VkCommandBuffer cmd, VkFramebuffer framebuffer);
+        void initIndirect();
+        void uploadMegaBuffer();
+        void buildIndirectBatches();
+        void cullIndirect(VkCommandBuffer cmd);
+        void drawIndirect(VkCommandBuffer cmd);
         void initScene();
         FrameData& getCurrentFrame();
         void init_descriptors();
         size_t padUniformBufferSize(size_t originalSize);
+        void decodeImages();
         void loadImages();
 };
-
-class PipelineBuilder
-{
-public:
-    std::vector<VkPipelineShaderStageCreateInfo> _shaderStages;
-    VkPipelineVertexInputStateCreateInfo _vertexInputInfo;
-    VkPipelineInputAssemblyStateCreateInfo _inputAssembly;
-    VkViewport _viewport;
-    VkRect2D _scissor;
-    VkPipelineRasterizationStateCreateInfo _rasterizer;
-    VkPipelineColorBlendAttachmentState _colorBlendAttachment;
-    VkPipelineMultisampleStateCreateInfo _multisampling;
-    VkPipelineLayout _pipelineLayout;
-    VkPipelineDepthStencilStateCreateInfo _depthStencil;
-
-    VkPipeline buildPipeline(VkDevice device, VkRenderPass pass);
-};
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "vk_types.hpp"
+
+#include <cstdint>
+#include <vector>
+
+struct GpuScopeResult
+{
+	const char* name = nullptr;
+	uint32_t depth = 0; // 0 for scopes begun outside every other scope
+	double time = 0.0; // ms
+};
+
+// timestamp queries of one frame in flight, FrameData owns one so its pool is only rewritten after
+// the fence of the frame that used it last signaled, which lets collect read without waiting
+//
+// scopes nest and may begin and end in different command buffers as long as those execute in
+// recording order, names are kept as pointers so they have to be string literals
+class GpuProfiler
+{
+public:
+	// timestampValidBits of the queue family the frames are submitted to, without timestampComputeAndGraphics
+	// or valid bits the profiler is unsupported and every call is a no-op
+	void init(VkDevice device, const VkPhysicalDeviceProperties& properties, uint32_t timestampValidBits, uint32_t maxScopes = 32);
+	void cleanup();
+
+	bool isSupported() const { return _queryPool != VK_NULL_HANDLE; }
+
+	// reads the scopes of the last frame recorded with this profiler, returns false when there is nothing new
+	bool collect();
+
+	// resets the pool, has to be recorded outside of a render pass before the first scope
+	void beginFrame(VkCommandBuffer cmd, unsigned int frameNumber);
+	// scopes past maxScopes are dropped along with their children
+	void beginScope(VkCommandBuffer cmd, const char* name, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+	void endScope(VkCommandBuffer cmd, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+	// in begin order, so every scope follows its parent
+	const std::vector<GpuScopeResult>& getResults() const { return _results; }
+	unsigned int getResultFrame() const { return _resultFrame; }
+
+private:
+	struct Scope
+	{
+		const char* name;
+		uint32_t depth;
+		bool ended;
+	};
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VkQueryPool _queryPool{ VK_NULL_HANDLE };
+	uint32_t _maxScopes{ 0 };
+	double _period{ 0.0 }; // ns per tick
+	uint64_t _validMask{ 0 };
+
+	// recorded since beginFrame, each scope owns the queries 2 * index and 2 * index + 1
+	std::vector<Scope> _scopes;
+	std::vector<uint32_t> _openScopes; // UINT32_MAX for dropped scopes
+	bool _recorded{ false };
+	unsigned int _frameNumber{ 0 };
+
+	std::vector<GpuScopeResult> _results;
+	unsigned int _resultFrame{ 0 };
+};
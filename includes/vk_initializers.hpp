@@ -7,6 +7,8 @@ namespace vkInit
     VkCommandPoolCreateInfo commandPoolCreateInfo(uint32_t queueFamilyIndex, VkCommandPoolCreateFlags flags=0);
     VkCommandBufferAllocateInfo commandBufferAllocateInfo(VkCommandPool commandPool, uint32_t count = 1, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);   
     VkCommandBufferBeginInfo commandBufferBeginInfo(VkCommandBufferUsageFlags flags = 0);
+    // secondary command buffers continuing subpass of renderPass on framebuffer
+    VkCommandBufferInheritanceInfo commandBufferInheritanceInfo(VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer);
     VkSubmitInfo submitInfo(VkCommandBuffer* cmd);
 
     // -- Pipeline ------------------------
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vkJobs
+{
+	struct Job;
+
+	// counts the jobs submitted against it that have not finished, waiting on it is the fence
+	// between one stage of work and the next
+	class JobCounter
+	{
+	public:
+		bool isDone() const { return _pending.load(std::memory_order_acquire) == 0; }
+
+	private:
+		friend class JobSystem;
+		std::atomic<uint32_t> _pending{ 0 };
+	};
+
+	// Chase-Lev deque (Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models"),
+	// the owner pushes and pops at the bottom, any thread steals from the top, the capacity is fixed
+	class WorkStealingDeque
+	{
+	public:
+		static constexpr int64_t CAPACITY = 4096;
+
+		// owner only, false when the deque is full
+		bool push(Job* job);
+		// owner only, newest job first
+		Job* pop();
+		// any thread, oldest job first, nullptr when empty or when another thief won the race
+		Job* steal();
+
+		size_t size() const;
+
+	private:
+		std::atomic<int64_t> _top{ 0 };
+		std::atomic<int64_t> _bottom{ 0 };
+		std::atomic<Job*> _buffer[CAPACITY];
+	};
+
+	struct JobStats
+	{
+		uint64_t executed = 0;
+		uint64_t stolen = 0;
+		uint64_t stealAttempts = 0;
+		uint64_t inlined = 0; // run by the submitter because its deque was full
+	};
+
+	// one worker thread per extra hardware thread, the thread calling init is worker 0 and
+	// only runs jobs while it waits, other threads submit through a shared injection queue
+	class JobSystem
+	{
+	public:
+		JobSystem() = default;
+		~JobSystem();
+
+		JobSystem(const JobSystem&) = delete;
+		JobSystem& operator=(const JobSystem&) = delete;
+
+		// threadCount includes the calling thread, 0 uses every hardware thread
+		void init(uint32_t threadCount = 0);
+		// no job may be running or queued
+		void shutdown();
+
+		uint32_t getThreadCount() const { return static_cast<uint32_t>(_workers.size()); }
+
+		void submit(std::function<void()>&& function, JobCounter* counter = nullptr);
+
+		// runs queued jobs on the calling thread until the counter reaches zero
+		void wait(JobCounter& counter);
+
+		// calls body over [0, count) split into ranges of at least minGrain items, the grain grows
+		// with count so every thread gets a few ranges to balance with, returns once all ranges ran
+		void parallelFor(size_t count, size_t minGrain, const std::function<void(size_t begin, size_t end)>& body);
+
+		JobStats getStats() const;
+		void resetStats();
+
+	private:
+		struct Worker
+		{
+			WorkStealingDeque deque;
+			std::thread thread;
+
+			std::atomic<uint64_t> executed{ 0 };
+			std::atomic<uint64_t> stolen{ 0 };
+			std::atomic<uint64_t> stealAttempts{ 0 };
+			std::atomic<uint64_t> inlined{ 0 };
+			uint32_t random = 0;
+		};
+
+		// index of the calling thread in _workers, -1 for threads that do not belong to this system
+		int32_t getWorkerIndex() const;
+		Job* findJob(int32_t workerIndex);
+		void execute(Job* job, int32_t workerIndex);
+		void workerLoop(uint32_t index);
+
+		std::vector<std::unique_ptr<Worker>> _workers;
+		std::atomic<bool> _running{ false };
+
+		std::mutex _injectionMutex;
+		std::deque<Job*> _injection;
+		std::atomic<size_t> _injectionSize{ 0 };
+
+		std::mutex _sleepMutex;
+		std::condition_variable _wake;
+		std::atomic<uint32_t> _sleeping{ 0 };
+
+		// restored by shutdown, so a temporary system on the main thread does not hide the global one
+		std::thread::id _initThread;
+		JobSystem* _previousSystem = nullptr;
+		int32_t _previousWorkerIndex = -1;
+	};
+
+	// shared by the engine and the asset loaders, started with every hardware thread on first use
+	JobSystem& getGlobal();
+	// restarts the shared system with threadCount threads, call from the main thread while no job runs
+	void initGlobal(uint32_t threadCount);
+
+	inline void parallelFor(size_t count, size_t minGrain, const std::function<void(size_t begin, size_t end)>& body)
+	{
+		getGlobal().parallelFor(count, minGrain, body);
+	}
+
+	// times parallelFor over a compute bound and a job spawn bound workload on 1 to maxThreadCount threads
+	void benchmarkJobs(uint32_t maxThreadCount);
+	// hammers the deques, nested parallelFor and external submitters, meant to run under ThreadSanitizer
+	bool stressTestJobs(uint32_t iterations);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+struct Mesh;
+
+constexpr uint32_t MESH_CACHE_MAGIC = 0x434D4B56; // "VKMC"
+constexpr uint32_t MESH_CACHE_VERSION = 3;
+
+struct MeshCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+
+	uint64_t sourceSize;
+	int64_t sourceModifiedTime;
+	uint64_t sourceHash;
+
+	uint32_t vertexStride;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t submeshCount;
+
+	float boundsMin[3];
+	float boundsMax[3];
+
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint64_t submeshOffset;
+	uint64_t materialNameOffset; // null terminated names, one per material index
+	uint64_t materialNameSize;
+};
+
+// read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const char* path);
+	void close();
+
+	const uint8_t* data() const { return _data; }
+	size_t size() const { return _size; }
+
+private:
+	const uint8_t* _data = nullptr;
+	size_t _size = 0;
+
+#ifdef _WIN32
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#else
+	int _file = -1;
+#endif
+};
+
+namespace vkCache
+{
+	std::string getMeshCachePath(const char* sourcePath);
+
+	// maps a cache written by saveMesh, fails if it is missing, malformed, indexes past its vertices
+	// or is older than the source file
+	bool loadMesh(const char* cachePath, const char* sourcePath, Mesh& outMesh);
+	bool saveMesh(const char* cachePath, const char* sourcePath, const Mesh& mesh);
+
+	// times the OBJ parse path against the mapped cache path for the same file
+	void benchmarkMeshLoad(const char* sourcePath, int iterations);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+struct Vertex;
+struct Mesh;
+
+namespace vkMeshOpt
+{
+	struct VertexCacheStats
+	{
+		size_t transformedVertices = 0;
+		float acmr = 0.0f; // transformed vertices per triangle, 0.5 is the best case for a regular grid
+		float atvr = 0.0f; // transformed vertices per unique vertex, 1.0 is optimal
+	};
+
+	// simulates a FIFO post-transform cache of cacheSize entries over the index stream
+	VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 16);
+
+	// reorders triangles in place for post-transform cache locality (Forsyth's linear-speed algorithm)
+	void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+	// reorders cache friendly triangle clusters front to back from the outside of the mesh,
+	// the change is dropped if it raises the ACMR by more than the given threshold factor
+	void optimizeOverdraw(uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount, float threshold = 1.05f);
+
+	// reorders vertices by first use in the index stream and remaps the indices, unused vertices are dropped
+	void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+	// runs every pass above on the CPU copy of the mesh and prints the cache statistics before and after
+	void optimizeMesh(Mesh& mesh, bool optimizeOverdrawOrder, const char* name);
+
+	// runs the passes over a grid with shuffled triangles and checks the ACMR reached against a fixed bound,
+	// that every triangle survives with its winding and that the fetch pass keeps each corner's vertex
+	bool testOptimizer();
+}
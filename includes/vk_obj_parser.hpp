@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace vkObj
+{
+	// 0-based attribute indices of one triangle corner, -1 when the face omits the attribute
+	struct ObjCorner
+	{
+		int32_t position;
+		int32_t texcoord;
+		int32_t normal;
+	};
+
+	// contiguous triangles sharing the object/group name and the usemtl material
+	struct ObjGroup
+	{
+		std::string name;
+		std::string material;
+		size_t firstCorner;
+		size_t cornerCount;
+	};
+
+	struct ObjData
+	{
+		std::vector<float> positions; // xyz
+		std::vector<float> normals;   // xyz
+		std::vector<float> texcoords; // uv
+		std::vector<ObjCorner> corners; // three per triangle, in file order
+		std::vector<ObjGroup> groups; // covers every corner, empty groups are dropped
+	};
+
+	// parses v/vn/vt/f/o/g/usemtl records of about 4 * threadCount line aligned chunks on the shared job system,
+	// polygons are fan triangulated, threadCount 0 follows the job system
+	bool parseObj(const char* filename, uint32_t threadCount, ObjData& outData);
+
+	// writes a grid mesh of at least targetBytes, mixing absolute and relative face indices
+	bool generateSyntheticObj(const char* filename, size_t targetBytes);
+
+	// times the tinyobj loader against the parallel loader and checks both produce the same mesh
+	void benchmarkObjLoad(const char* filename, uint32_t maxThreadCount);
+}
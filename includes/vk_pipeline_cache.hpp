@@ -0,0 +1,16 @@
+#pragma once
+
+#include "vk_types.hpp"
+
+#include <cstddef>
+
+namespace vkCache
+{
+	// creates a pipeline cache seeded from path when the file was written by the same driver and device,
+	// the header's vendorID, deviceID and pipelineCacheUUID are checked, outLoadedSize is 0 for an empty cache
+	// and a null path always starts empty
+	VkPipelineCache loadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties, const char* path, size_t& outLoadedSize);
+
+	// written next to path and renamed over it, so a crash never leaves a truncated cache
+	bool savePipelineCache(VkDevice device, VkPipelineCache cache, const char* path);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "vk_types.hpp"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class PipelineBuilder
+{
+public:
+	std::vector<VkPipelineShaderStageCreateInfo> _shaderStages;
+	VkPipelineVertexInputStateCreateInfo _vertexInputInfo;
+	VkPipelineInputAssemblyStateCreateInfo _inputAssembly;
+	VkViewport _viewport;
+	VkRect2D _scissor;
+	VkPipelineRasterizationStateCreateInfo _rasterizer;
+	VkPipelineColorBlendAttachmentState _colorBlendAttachment;
+	VkPipelineMultisampleStateCreateInfo _multisampling;
+	VkPipelineLayout _pipelineLayout;
+	VkPipelineDepthStencilStateCreateInfo _depthStencil;
+
+	VkPipeline buildPipeline(VkDevice device, VkRenderPass pass, VkPipelineCache cache);
+};
+
+// FNV-1a of the full builder state, equal keys mean equal pipelines, a state whose hash another state
+// registered first is rehashed with a salt until it finds a free key
+using PipelineKey = uint64_t;
+
+struct PipelineRegistryStats
+{
+	uint32_t pipelines = 0;
+	uint32_t requests = 0;
+	uint32_t deduplicated = 0; // requests answered by an already registered state
+	uint32_t failed = 0;
+	double buildTime = 0.0; // ms spent in buildPending
+};
+
+// owns every graphics pipeline, identical builder states are built once and pending builds are
+// spread over the job system, vkCreateGraphicsPipelines is free threaded and the pipeline cache
+// is internally synchronized
+//
+// shader modules and specialization info only have to live until buildPending returns, the builder's pointed to state
+// (vertex input descriptions, entry point names) is copied by request
+//
+// modules registered with their code are keyed by a hash of it instead of their handle, so a handle the driver
+// recycles after the module was destroyed never matches the pipeline of the old code
+class PipelineRegistry
+{
+public:
+	void init(VkDevice device, VkPipelineCache cache);
+	// destroys every pipeline
+	void cleanup();
+
+	void registerShaderModule(VkShaderModule module, const uint32_t* code, size_t wordCount);
+	// before the module is destroyed, registered pipelines keep their keys
+	void unregisterShaderModule(VkShaderModule module);
+
+	PipelineKey makeKey(const PipelineBuilder& builder, VkRenderPass pass) const;
+
+	// registers the state and queues its build unless it is known already, 0 when no probed key was free
+	PipelineKey request(const PipelineBuilder& builder, VkRenderPass pass);
+	// the state of base with the modules of its shader stages replaced, in stage order, 0 for unknown keys
+	PipelineKey requestVariant(PipelineKey base, const std::vector<VkShaderModule>& modules);
+	// builds every queued pipeline, one job per pipeline unless useJobs is false, returns the number that failed
+	uint32_t buildPending(bool useJobs = true);
+	// requests every builder and builds them, the keys are in builder order
+	std::vector<PipelineKey> buildBatch(const std::vector<PipelineBuilder>& builders, VkRenderPass pass);
+
+	// VK_NULL_HANDLE for unknown keys, failed builds and builds still pending
+	VkPipeline get(PipelineKey key) const;
+	// forgets a built key and hands its pipeline to the caller, who destroys it once no frame uses it
+	VkPipeline remove(PipelineKey key);
+
+	PipelineRegistryStats getStats() const;
+
+	// builds every registered state again into cache on this thread and destroys the results, returns the ms the
+	// builds took, for comparing caches
+	double timeRebuild(VkPipelineCache cache, uint32_t& outBuilt);
+
+private:
+	struct Entry
+	{
+		std::string state; // the hashed bytes, compared on a key hit so a collision is never mistaken for a match
+		PipelineBuilder builder;
+		VkRenderPass pass{ VK_NULL_HANDLE };
+		VkPipeline pipeline{ VK_NULL_HANDLE };
+		bool pending{ true };
+
+		// owned copies of what builder points to
+		std::vector<VkVertexInputBindingDescription> bindings;
+		std::vector<VkVertexInputAttributeDescription> attributes;
+		std::vector<std::string> entryPoints;
+	};
+
+	// all with _mutex held
+	std::string serializeState(const PipelineBuilder& builder, VkRenderPass pass) const;
+	// the key registered for state, or the free one it would get, 0 when every probe hit another state
+	PipelineKey findKey(const std::string& state) const;
+	PipelineKey insert(const PipelineBuilder& builder, VkRenderPass pass);
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VkPipelineCache _cache{ VK_NULL_HANDLE };
+
+	mutable std::mutex _mutex;
+	std::unordered_map<PipelineKey, Entry> _entries;
+	std::vector<PipelineKey> _pending;
+	std::unordered_map<VkShaderModule, uint64_t> _moduleHashes;
+	PipelineRegistryStats _stats;
+};
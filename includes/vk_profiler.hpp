@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define VK_PROFILER_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define VK_PROFILER_RDTSC 1
+#endif
+
+// CPU zone profiler, every thread records the zones it ends into its own ring buffer without locks,
+// readers copy the rings while they are written and drop whatever was overwritten during the copy
+//
+// VK_PROFILE_ZONE("name") times the rest of the enclosing block, names are kept as pointers so they
+// have to be string literals, VK_PROFILE_FRAME() marks the start of a main thread frame
+namespace vkProf
+{
+	// rdtsc ticks on x86, steady_clock nanoseconds elsewhere
+	using Ticks = uint64_t;
+
+	inline Ticks now()
+	{
+#ifdef VK_PROFILER_RDTSC
+		return __rdtsc();
+#else
+		return static_cast<Ticks>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+	}
+
+	// calibrated against steady_clock over the whole run, so it gets more precise the longer the profiler runs
+	double getNanosecondsPerTick();
+	// the first tick the profiler saw, trace timestamps are relative to it
+	Ticks getOrigin();
+
+	struct ZoneEvent
+	{
+		const char* name;
+		Ticks start;
+		Ticks end;
+		uint32_t depth; // 0 for zones begun outside every other zone of the thread
+		uint32_t thread; // index into getThreads()
+	};
+
+	struct ThreadInfo
+	{
+		uint32_t id;
+		std::string name;
+	};
+
+	void setEnabled(bool enabled);
+	void setThreadName(const char* name);
+
+	// zones of every thread that ended in [begin, end), in end order per thread
+	std::vector<ZoneEvent> collect(Ticks begin = 0, Ticks end = UINT64_MAX);
+	std::vector<ThreadInfo> getThreads();
+
+	// one thread only, the last completed frame spans the last two marks
+	void markFrame();
+	bool getLastFrame(Ticks& outBegin, Ticks& outEnd);
+
+	// Chrome about:tracing / Perfetto JSON of every zone still in the rings
+	bool writeChromeTrace(const char* filename);
+
+	// prints the cost of an enabled and a disabled zone
+	void benchmarkProfiler();
+	// writer threads record zones while a reader collects them, every collected zone must be intact and each
+	// iteration starts new writers, which have to take the rings of the exited ones over, meant for ThreadSanitizer
+	bool stressTestProfiler(uint32_t iterations);
+
+	namespace detail
+	{
+		extern std::atomic<bool> enabled;
+		inline thread_local uint32_t depth = 0;
+
+		void recordZone(const char* name, Ticks start, Ticks end, uint32_t depth);
+	}
+
+	inline bool isEnabled() { return detail::enabled.load(std::memory_order_relaxed); }
+
+	class ScopedZone
+	{
+	public:
+		explicit ScopedZone(const char* name) : _name(isEnabled() ? name : nullptr)
+		{
+			if (_name != nullptr)
+			{
+				_depth = detail::depth++;
+				_start = now();
+			}
+		}
+
+		~ScopedZone()
+		{
+			if (_name != nullptr)
+			{
+				detail::recordZone(_name, _start, now(), _depth);
+				detail::depth--;
+			}
+		}
+
+		ScopedZone(const ScopedZone&) = delete;
+		ScopedZone& operator=(const ScopedZone&) = delete;
+
+	private:
+		const char* _name;
+		Ticks _start{ 0 };
+		uint32_t _depth{ 0 };
+	};
+}
+
+#define VK_PROFILE_CONCAT_INNER(a, b) a##b
+#define VK_PROFILE_CONCAT(a, b) VK_PROFILE_CONCAT_INNER(a, b)
+
+#ifdef VK_PROFILER_DISABLED
+#define VK_PROFILE_ZONE(name)
+#define VK_PROFILE_FUNCTION()
+#define VK_PROFILE_FRAME()
+#else
+#define VK_PROFILE_ZONE(name) vkProf::ScopedZone VK_PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define VK_PROFILE_FUNCTION() VK_PROFILE_ZONE(__func__)
+#define VK_PROFILE_FRAME() vkProf::markFrame()
+#endif
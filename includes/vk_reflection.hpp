@@ -0,0 +1,65 @@
+#pragma once
+
+#include "vk_types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// reads the resource interface of a SPIR-V module, every resource the shader declares is reported even
+// when no instruction uses it, shaders compiled without optimization keep those so layouts shared by
+// several pipelines still get them from the stage that declares them
+namespace vkReflect
+{
+	struct DescriptorBinding
+	{
+		uint32_t set;
+		uint32_t binding;
+		VkDescriptorType type;
+		uint32_t count; // array length, 1 for single descriptors
+		VkShaderStageFlags stages;
+		std::string name;
+	};
+
+	struct VertexInput
+	{
+		uint32_t location;
+		VkFormat format; // of the shader type, the attribute may use a packed format converting to it
+		std::string name;
+	};
+
+	struct ShaderReflection
+	{
+		VkShaderStageFlags stages{ 0 };
+		// sorted by set, then binding
+		std::vector<DescriptorBinding> bindings;
+		// size 0 without a push constant block
+		VkPushConstantRange pushConstants{ 0, 0, 0 };
+		// vertex stage only, sorted by location, built ins are skipped
+		std::vector<VertexInput> inputs;
+	};
+
+	// the first entry point of the module, false for malformed code
+	bool reflectShader(const uint32_t* code, size_t wordCount, ShaderReflection& outReflection);
+
+	// adds the stage to the reflection of a whole pipeline, bindings declared by several stages get the stages
+	// of all of them and the push constant range covers every stage's block, false when the stages disagree
+	// on the type or count of a binding
+	bool mergeReflection(ShaderReflection& pipeline, const ShaderReflection& stage);
+
+	// reflection can not tell dynamic buffers apart, the caller marks the ones it binds with dynamic offsets
+	void makeDynamic(ShaderReflection& reflection, uint32_t set, uint32_t binding);
+
+	// 0 without bindings
+	uint32_t getSetCount(const ShaderReflection& reflection);
+	std::vector<VkDescriptorSetLayoutBinding> getSetBindings(const ShaderReflection& reflection, uint32_t set);
+
+	// true when every binding, the push constants and the vertex inputs of shader fit into layout, prints
+	// every mismatch, dynamic and plain buffers are interchangeable
+	bool isCompatible(const ShaderReflection& shader, const ShaderReflection& layout);
+
+	// reflects the committed shaders under shaders/ and compares them with the interfaces the engine creates
+	// its layouts for, then checks that malformed modules are rejected, true when everything matched
+	bool testReflection();
+}
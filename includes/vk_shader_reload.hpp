@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// watches a shader directory, inotify on Linux and modification times elsewhere, and recompiles the
+// GLSL sources that change with glslc on its own thread, never on the job system, so a frame waiting
+// on its jobs can not end up running a compile
+//
+// outputs are written next to their path and renamed over it, a failed compile keeps the last good SPIR-V
+class ShaderReloader
+{
+public:
+	// source is compiled to spirv with the extra glslc arguments, a source may feed several outputs
+	void addShader(const std::string& source, const std::string& spirv, const std::string& arguments = "");
+	// every <name>.<stage> of directory compiled to <name>_<stage>.spv, the rule the build uses
+	void addDirectory(const std::string& directory);
+
+	// onCompiled gets the outputs rebuilt by one burst of changes, it runs on the watcher thread
+	bool start(const std::string& directory, std::function<void(const std::vector<std::string>& spirvPaths)>&& onCompiled);
+	void stop();
+
+	bool isRunning() const { return _thread.joinable(); }
+
+private:
+	struct Shader
+	{
+		std::string source;
+		std::string spirv;
+		std::string arguments;
+		std::filesystem::file_time_type writeTime; // polling fallback only
+	};
+
+	// adds the file names changed within timeout, false when there were none
+	bool waitForChanges(std::vector<std::string>& changed, std::chrono::milliseconds timeout);
+	bool compile(const Shader& shader);
+	void watchLoop();
+
+	std::vector<Shader> _shaders;
+	std::string _directory;
+	std::function<void(const std::vector<std::string>&)> _onCompiled;
+
+	std::thread _thread;
+	std::atomic<bool> _stopping{ false };
+	int _inotify{ -1 };
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+namespace vkTask
+{
+	using TaskId = uint32_t;
+
+	// a small dependency graph executed on a pool of threads, every task runs once all of its
+	// dependencies finished and records when it started and ended for printTimeline
+	class TaskGraph
+	{
+	public:
+		// dependencies must be ids returned by earlier addTask calls, so the graph has no cycles
+		TaskId addTask(const char* name, std::function<void()>&& function, std::initializer_list<TaskId> dependencies = {});
+		// for work that has to stay on the thread calling execute, window system calls for example
+		TaskId addMainThreadTask(const char* name, std::function<void()>&& function, std::initializer_list<TaskId> dependencies = {});
+
+		// the calling thread takes part, threadCount 0 uses every hardware thread
+		void execute(uint32_t threadCount = 0);
+
+		// start and end of every task relative to execute, with the summed task time against the wall time
+		void printTimeline(const char* title) const;
+		double getWallTime() const { return _wallTime; }
+
+	private:
+		struct Task
+		{
+			std::string name;
+			std::function<void()> function;
+			std::vector<TaskId> dependents;
+			uint32_t dependencyCount = 0;
+			bool mainThread = false;
+
+			double start = 0.0; // ms
+			double end = 0.0;
+			uint32_t thread = 0; // 0 is the thread that called execute
+		};
+
+		std::vector<Task> _tasks;
+		double _wallTime = 0.0;
+	};
+}
@@ -3,7 +3,17 @@
 #include "vk_types.hpp"
 #include "vk_engine.hpp"
 
+#include <optional>
+
 namespace vkUtil
 {
-	bool loadImageFromFile(VulkanEngine* engine, const char* file, AllocatedImage& outImage);
+	// CPU only, safe to call from any thread
+	bool decodeImageFromFile(const char* file, DecodedImage& outImage);
+	// records the copy into the engine's current upload batch and frees the pixels, the image is usable once the ticket completes
+	UploadTicket uploadDecodedImage(VulkanEngine* engine, DecodedImage& image, AllocatedImage& outImage);
+
+	std::optional<UploadTicket> loadImageFromFile(VulkanEngine* engine, const char* file, AllocatedImage& outImage);
+
+	// binary PPM of tightly packed RGBA8 pixels, alpha is dropped
+	bool writeImagePPM(const char* file, const uint8_t* pixels, uint32_t width, uint32_t height);
 }
\ No newline at end of file
@@ -7,10 +7,19 @@ struct AllocatedBuffer
 {
 	VkBuffer _buffer;
 	VmaAllocation _allocation;
+	void* _mapped = nullptr; // set for persistently mapped buffers
 };
 
 struct AllocatedImage
 {
 	VkImage _image;
 	VmaAllocation _allocation;
-};
\ No newline at end of file
+};
+
+// RGBA8 pixels decoded on the CPU that are not uploaded yet
+struct DecodedImage
+{
+	unsigned char* pixels = nullptr;
+	int width = 0;
+	int height = 0;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "vk_types.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <vector>
+
+// identifies the batch an upload was recorded into, it is complete once the
+// transfer timeline reaches value
+struct UploadTicket
+{
+	uint64_t value = 0;
+};
+
+struct UploadStats
+{
+	size_t ringCapacity = 0;
+	size_t ringUsed = 0; // bytes held by batches that have not retired, including alignment and wrap padding
+	size_t ringPeakUsed = 0;
+	uint64_t stalls = 0; // allocations that had to wait for a batch to retire
+	uint64_t chunks = 0;
+	uint64_t bytesUploaded = 0;
+};
+
+// persistently mapped staging buffer used as a ring, every region is tagged with the
+// timeline value of the batch that reads it and is reclaimed once that value retires
+class StagingRing
+{
+public:
+	void init(VmaAllocator allocator, size_t capacity, VkDeviceSize alignment);
+	void cleanup();
+
+	// returns false when there is no contiguous free range of size bytes until older regions retire
+	bool allocate(size_t size, uint64_t value, VkDeviceSize& outOffset);
+	void release(uint64_t completedValue);
+
+	VkBuffer getBuffer() const { return _buffer._buffer; }
+	VmaAllocation getAllocation() const { return _buffer._allocation; }
+	uint8_t* getMapped() const { return static_cast<uint8_t*>(_buffer._mapped); }
+
+	size_t getCapacity() const { return _capacity; }
+	size_t getUsed() const { return _used; }
+
+private:
+	struct Region
+	{
+		size_t begin; // the head before the allocation, so padding is reclaimed with the region
+		size_t consumed;
+		uint64_t value;
+	};
+
+	VmaAllocator _allocator{ VK_NULL_HANDLE };
+	AllocatedBuffer _buffer;
+	size_t _capacity{ 0 };
+	VkDeviceSize _alignment{ 16 };
+
+	std::deque<Region> _regions;
+	size_t _head{ 0 };
+	size_t _used{ 0 };
+};
+
+// records buffer and image copies into one command buffer per batch and submits the
+// batch to the transfer queue, the graphics queue waits on the timeline semaphore
+// instead of the CPU waiting on a fence for every copy
+//
+// source data goes through a StagingRing, uploads larger than a quarter of the ring are
+// split into chunks so the CPU fills one chunk while the GPU copies the previous ones
+//
+// with a dedicated transfer family every destination is released by the transfer
+// queue and acquired again by the next graphics command buffer, see acquireSubmitted
+class UploadManager
+{
+public:
+	void init(VkDevice device, VmaAllocator allocator, VkQueue transferQueue, uint32_t transferQueueFamily,
+		uint32_t graphicsQueueFamily, bool timelineSemaphoreSupported, size_t stagingRingSize, VkDeviceSize copyAlignment);
+	void cleanup();
+
+	// fill writes bytes [offset, offset + size) of the source data into the staging memory, it is called
+	// once per chunk, the copy lands at dstOffset and is made visible to dstStage / dstAccess on the graphics queue
+	UploadTicket uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, size_t size, const std::function<void(void* staging, size_t offset, size_t size)>& fill,
+		VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+	UploadTicket uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, size_t size,
+		VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+
+	// copies tightly packed pixels into the first mip and layer, the image ends in finalLayout
+	UploadTicket uploadImage(VkImage dst, VkExtent3D extent, const void* pixels, size_t size, VkImageLayout finalLayout,
+		VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+
+	// submits everything recorded since the last flush as one batch, returns the ticket of that batch
+	UploadTicket flush();
+
+	bool isComplete(UploadTicket ticket);
+	void wait(UploadTicket ticket);
+
+	// records the acquire half of the ownership transfers of every submitted batch that has not
+	// been acquired yet, the submit of cmd has to wait on getSemaphore() at the returned value,
+	// 0 means there is nothing to wait for
+	uint64_t acquireSubmitted(VkCommandBuffer cmd);
+
+	VkSemaphore getSemaphore() const { return _timeline; }
+	bool hasDedicatedQueue() const { return _transferQueueFamily != _graphicsQueueFamily; }
+
+	size_t getSubmittedBatchCount() const { return _submittedBatches; }
+	UploadStats getStats() const;
+
+private:
+	struct Batch
+	{
+		VkCommandBuffer cmd{ VK_NULL_HANDLE };
+		uint64_t value{ 0 };
+		size_t stagingBytes{ 0 };
+
+		// acquire halves of the releases recorded into cmd
+		std::vector<VkBufferMemoryBarrier> bufferAcquires;
+		std::vector<VkImageMemoryBarrier> imageAcquires;
+		VkPipelineStageFlags acquireStages{ 0 };
+	};
+
+	VkCommandBuffer beginRecording();
+	// waits for older batches when the ring is full, submitting the recording batch first if it holds ring space
+	VkDeviceSize allocateStaging(size_t size);
+	uint64_t getCompletedValue();
+	// reclaims the ring regions and recycles the command buffers of finished batches
+	void collect();
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VmaAllocator _allocator{ VK_NULL_HANDLE };
+
+	VkQueue _transferQueue{ VK_NULL_HANDLE };
+	uint32_t _transferQueueFamily{ 0 };
+	uint32_t _graphicsQueueFamily{ 0 };
+
+	VkCommandPool _commandPool{ VK_NULL_HANDLE };
+	std::vector<VkCommandBuffer> _freeCommandBuffers;
+
+	StagingRing _ring;
+	size_t _maxChunkSize{ 0 };
+	size_t _ringPeakUsed{ 0 };
+	uint64_t _stalls{ 0 };
+	uint64_t _chunks{ 0 };
+	uint64_t _bytesUploaded{ 0 };
+
+	// without timeline semaphores every flush waits on _fence, as immediateSubmit did
+	bool _timelineSupported{ false };
+	VkSemaphore _timeline{ VK_NULL_HANDLE };
+	VkFence _fence{ VK_NULL_HANDLE };
+	PFN_vkGetSemaphoreCounterValueKHR _vkGetSemaphoreCounterValue{ nullptr };
+	PFN_vkWaitSemaphoresKHR _vkWaitSemaphores{ nullptr };
+
+	Batch _recording;
+	std::deque<Batch> _inFlight;
+	uint64_t _nextValue{ 1 };
+	uint64_t _completedValue{ 0 };
+	size_t _submittedBatches{ 0 };
+
+	// acquire barriers of submitted batches, recorded by the next graphics command buffer
+	std::vector<VkBufferMemoryBarrier> _pendingBufferAcquires;
+	std::vector<VkImageMemoryBarrier> _pendingImageAcquires;
+	VkPipelineStageFlags _pendingAcquireStages{ 0 };
+	uint64_t _pendingAcquireValue{ 0 };
+};
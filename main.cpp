@@ -1,13 +1,283 @@
+#include <algorithm>
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <filesystem>
 #include "includes/vk_engine.hpp"
+#include "includes/vk_mesh_cache.hpp"
+#include "includes/vk_mesh_optimizer.hpp"
+#include "includes/vk_obj_parser.hpp"
+#include "includes/vk_culling.hpp"
+#include "includes/vk_jobs.hpp"
+#include "includes/vk_benchmark.hpp"
+#include "includes/vk_profiler.hpp"
+#include "includes/vk_reflection.hpp"
 
-int main()
+// what CTest's SKIP_RETURN_CODE is set to for tests needing a Vulkan device or files outside the repository
+static const int SKIP_EXIT_CODE = 77;
+
+int main(int argc, char* argv[])
 {
+    if (argc >= 3 && strcmp(argv[1], "--bench-mesh-cache") == 0)
+    {
+        int iterations = argc >= 4 ? atoi(argv[3]) : 5;
+        vkCache::benchmarkMeshLoad(argv[2], iterations > 0 ? iterations : 1);
+        return 0;
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--bench-obj") == 0)
+    {
+        uint32_t maxThreadCount = argc >= 4 ? (uint32_t)atoi(argv[3]) : 0;
+        vkObj::benchmarkObjLoad(argv[2], maxThreadCount);
+        return 0;
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "--gen-obj") == 0)
+    {
+        size_t megabytes = (size_t)atoll(argv[3]);
+        return vkObj::generateSyntheticObj(argv[2], megabytes * 1024 * 1024) ? 0 : 1;
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--test-mesh-indexing") == 0)
+    {
+        // missing files are skipped, the models and assets are not all part of the repository
+        bool passed = true;
+        int tested = 0;
+        for (int i = 2; i < argc; i++)
+        {
+            if (!std::filesystem::exists(argv[i]))
+            {
+                std::cout << argv[i] << " : not found, skipped\n";
+                continue;
+            }
+
+            passed &= testMeshIndexing(argv[i]);
+            tested++;
+        }
+
+        if (tested == 0)
+        {
+            return SKIP_EXIT_CODE;
+        }
+
+        return passed ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--test-vertex-packing") == 0)
+    {
+        return testVertexPacking() ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--test-mesh-optimizer") == 0)
+    {
+        return vkMeshOpt::testOptimizer() ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--test-reflection") == 0)
+    {
+        return vkReflect::testReflection() ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--test-culling") == 0)
+    {
+        return vkCull::testCulling() ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench-culling") == 0)
+    {
+        return vkCull::benchmarkCulling() ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench-jobs") == 0)
+    {
+        uint32_t maxThreadCount = argc >= 3 ? (uint32_t)atoi(argv[2]) : 0;
+        vkJobs::benchmarkJobs(maxThreadCount);
+        return 0;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--stress-jobs") == 0)
+    {
+        int iterations = argc >= 3 ? atoi(argv[2]) : 10;
+        return vkJobs::stressTestJobs(iterations > 0 ? iterations : 1) ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench-profiler") == 0)
+    {
+        vkProf::benchmarkProfiler();
+        return 0;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--stress-profiler") == 0)
+    {
+        int iterations = argc >= 3 ? atoi(argv[2]) : 10;
+        return vkProf::stressTestProfiler(iterations > 0 ? iterations : 1) ? 0 : 1;
+    }
+
     VulkanEngine engine;
 
+    // runs the init task graph with a hidden window and exits, the timeline is printed by init
+    engine._startupBenchmark = argc >= 2 && strcmp(argv[1], "--bench-startup") == 0;
+
+    const char* readbackPath = nullptr;
+    uint32_t headlessFrameCount = 300;
+    bool framesSet = false;
+
+    // replays a camera path, the regression thresholds make the exit code fail on slow frames
+    vkBench::BenchmarkSettings benchmarkSettings;
+    bool benchmark = argc >= 3 && strcmp(argv[1], "--benchmark") == 0;
+    if (benchmark)
+    {
+        benchmarkSettings.cameraPath = argv[2];
+    }
+
+    // engine settings, accepted after any mode
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+        {
+            engine._headless = true;
+        }
+        else if (strcmp(argv[i], "--no-hot-reload") == 0)
+        {
+            engine._shaderHotReload = false;
+        }
+        else if (strcmp(argv[i], "--packed-vertices") == 0)
+        {
+            engine._usePackedVertices = true;
+        }
+        else if (i + 1 >= argc)
+        {
+            break;
+        }
+        else if (strcmp(argv[i], "--pipeline-cache") == 0)
+        {
+            engine._pipelineCachePath = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--trace") == 0)
+        {
+            engine._tracePath = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--readback") == 0)
+        {
+            readbackPath = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--frames") == 0)
+        {
+            headlessFrameCount = (uint32_t)std::max(1, atoi(argv[i + 1]));
+            framesSet = true;
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            benchmarkSettings.jsonPath = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--csv") == 0)
+        {
+            benchmarkSettings.csvPath = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--max-frame-p95") == 0)
+        {
+            benchmarkSettings.maxFrameTimeP95 = atof(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--max-gpu-p95") == 0)
+        {
+            benchmarkSettings.maxGpuTimeP95 = atof(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--baseline") == 0)
+        {
+            benchmarkSettings.baselinePath = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--max-regression") == 0)
+        {
+            benchmarkSettings.maxRegression = atof(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--record-threads") == 0)
+        {
+            engine._recordThreadCount = (uint32_t)atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--frames-in-flight") == 0)
+        {
+            engine._framesInFlight = (uint32_t)atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--swapchain-images") == 0)
+        {
+            engine._swapchainImageCount = (uint32_t)atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "--present-mode") == 0)
+        {
+            if (strcmp(argv[i + 1], "mailbox") == 0)
+            {
+                engine._presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+            }
+            else if (strcmp(argv[i + 1], "immediate") == 0)
+            {
+                engine._presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            }
+            else
+            {
+                engine._presentMode = VK_PRESENT_MODE_FIFO_KHR;
+            }
+        }
+    }
+
+    bool benchmarkRecording = argc >= 2 && strcmp(argv[1], "--bench-record") == 0;
+    bool benchmarkLatency = argc >= 2 && strcmp(argv[1], "--bench-latency") == 0;
+    // builds the pipelines with an empty and a warm cache in one run, whatever pipeline_cache.bin holds
+    bool benchmarkPipelineCache = argc >= 2 && strcmp(argv[1], "--bench-pipeline-cache") == 0;
+    // renders the scene with both draw paths offscreen and fails when the images differ
+    bool comparePaths = argc >= 2 && strcmp(argv[1], "--compare-paths") == 0;
+
+    if (comparePaths || benchmarkPipelineCache)
+    {
+        engine._headless = true;
+    }
+
+    // headless runs are what tests use, a machine without a device skips them instead of failing
+    if (engine._headless && !VulkanEngine::isDeviceAvailable())
+    {
+        std::cout << "No Vulkan device found, skipping\n";
+        return SKIP_EXIT_CODE;
+    }
+
     engine.init();
-    engine.run();
+
+    int exitCode = 0;
+
+    if (comparePaths)
+    {
+        exitCode = engine.compareDrawPaths(readbackPath) ? 0 : 1;
+    }
+    else if (benchmark)
+    {
+        if (framesSet)
+        {
+            benchmarkSettings.frameCount = headlessFrameCount;
+        }
+
+        exitCode = engine.runBenchmark(benchmarkSettings) ? 0 : 1;
+    }
+    else if (benchmarkRecording)
+    {
+        engine.benchmarkRecording(argc >= 3 ? (uint32_t)atoi(argv[2]) : 0);
+    }
+    else if (benchmarkLatency)
+    {
+        int frameCount = argc >= 3 ? atoi(argv[2]) : 0;
+        engine.benchmarkLatency(frameCount > 0 ? (uint32_t)frameCount : 300);
+    }
+    else if (benchmarkPipelineCache)
+    {
+        engine.benchmarkPipelineCache();
+    }
+    else if (engine._headless)
+    {
+        engine.runHeadless(headlessFrameCount, readbackPath);
+    }
+    else if (!engine._startupBenchmark)
+    {
+        engine.run();
+    }
+
     engine.cleanup();
 
-    return 0;
-}
\ No newline at end of file
+    return exitCode;
+}
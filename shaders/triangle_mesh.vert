@@ -1,9 +1,15 @@
 #version 460
 
+#ifdef PACKED_VERTEX
+layout(location = 0) in vec4 packedPosition;
+layout(location = 1) in vec2 packedNormal;
+layout(location = 3) in vec2 vTexCoords;
+#else
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec3 color;
 layout(location = 3) in vec2 vTexCoords;
+#endif
 
 layout(location = 0) out vec3 outColor;
 layout(location = 1) out vec2 texCoords;
@@ -29,11 +35,30 @@ layout(push_constant) uniform constants
 {
 	vec4 data;
 	mat4 render_matrix;
+	vec4 positionOffset;
+	vec4 positionScale;
 } PushConstants;
 
+#ifdef PACKED_VERTEX
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e.xy, 1.0f - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return normalize(n);
+}
+#endif
+
 void main()
 {
-	mat4 modelMatrix = objectBuffer.objects[gl_BaseInstance].model;
+#ifdef PACKED_VERTEX
+	vec3 position = PushConstants.positionOffset.xyz + packedPosition.xyz * PushConstants.positionScale.xyz;
+	vec3 color = decodeOctahedral(packedNormal);
+#endif
+
+	// gl_InstanceIndex already starts at the firstInstance of the draw
+	mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
 	mat4 transformMatrix = (cameraData.viewproj * modelMatrix);
 	gl_Position = transformMatrix * vec4(position, 1.0f);
 	outColor = color;
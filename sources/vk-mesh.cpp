@@ -1,10 +1,27 @@
 #include "vk-mesh.hpp"
+#include "vk_mesh_cache.hpp"
+#include "vk_obj_parser.hpp"
+#include "vk_mesh_optimizer.hpp"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 #include <iostream>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/packing.hpp>
+#include <cmath>
 
 VertexInputDescription Vertex::getVertexDescription()
+{
+	return ::getVertexDescription<Vertex>();
+}
+
+template<>
+VertexInputDescription getVertexDescription<Vertex>()
 {
 	VertexInputDescription description = {};
 
@@ -47,7 +64,264 @@ VertexInputDescription Vertex::getVertexDescription()
 	return description;
 }
 
-bool Mesh::loadFromObj(const char* filename)
+template<>
+VertexInputDescription getVertexDescription<PackedVertex>()
+{
+	VertexInputDescription description = {};
+
+	VkVertexInputBindingDescription mainBinding = {};
+	mainBinding.binding = 0;
+	mainBinding.stride = sizeof(PackedVertex);
+	mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	description.bindings.push_back(mainBinding);
+
+	VkVertexInputAttributeDescription positionAttribute = {};
+	positionAttribute.binding = 0;
+	positionAttribute.location = 0;
+	positionAttribute.format = VK_FORMAT_R16G16B16A16_UNORM;
+	positionAttribute.offset = offsetof(PackedVertex, position);
+
+	VkVertexInputAttributeDescription normalAttribute = {};
+	normalAttribute.binding = 0;
+	normalAttribute.location = 1;
+	normalAttribute.format = VK_FORMAT_R16G16_SNORM;
+	normalAttribute.offset = offsetof(PackedVertex, normal);
+
+	// the color attribute is dropped, the shader derives it from the normal
+	VkVertexInputAttributeDescription uvAttribute = {};
+	uvAttribute.binding = 0;
+	uvAttribute.location = 3;
+	uvAttribute.format = VK_FORMAT_R16G16_SFLOAT;
+	uvAttribute.offset = offsetof(PackedVertex, uv);
+
+	description.attributes.push_back(positionAttribute);
+	description.attributes.push_back(normalAttribute);
+	description.attributes.push_back(uvAttribute);
+
+	return description;
+}
+
+namespace
+{
+	uint16_t quantizeUnorm16(float value)
+	{
+		return static_cast<uint16_t>(glm::clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	}
+
+	int16_t quantizeSnorm16(float value)
+	{
+		return static_cast<int16_t>(std::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f));
+	}
+
+	float signNotZero(float value)
+	{
+		return value >= 0.0f ? 1.0f : -1.0f;
+	}
+}
+
+PackedVertex PackedVertex::pack(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& boundsExtent)
+{
+	PackedVertex packed;
+
+	glm::vec3 normalized = (vertex.position - boundsMin) / boundsExtent;
+	packed.position[0] = quantizeUnorm16(normalized.x);
+	packed.position[1] = quantizeUnorm16(normalized.y);
+	packed.position[2] = quantizeUnorm16(normalized.z);
+	packed.position[3] = 0;
+
+	// project onto the octahedron and fold the lower half over the upper one
+	glm::vec3 n = vertex.normal;
+	float l1Norm = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+	glm::vec2 octahedral(0.0f, 0.0f);
+
+	if (l1Norm > 0.0f)
+	{
+		octahedral = glm::vec2(n.x / l1Norm, n.y / l1Norm);
+		if (n.z < 0.0f)
+		{
+			octahedral = glm::vec2(
+				(1.0f - std::fabs(octahedral.y)) * signNotZero(octahedral.x),
+				(1.0f - std::fabs(octahedral.x)) * signNotZero(octahedral.y));
+		}
+	}
+
+	packed.normal[0] = quantizeSnorm16(octahedral.x);
+	packed.normal[1] = quantizeSnorm16(octahedral.y);
+
+	packed.uv[0] = static_cast<uint16_t>(glm::packHalf1x16(vertex.uv.x));
+	packed.uv[1] = static_cast<uint16_t>(glm::packHalf1x16(vertex.uv.y));
+
+	return packed;
+}
+
+Vertex PackedVertex::unpack(const glm::vec3& boundsMin, const glm::vec3& boundsExtent) const
+{
+	Vertex vertex;
+
+	glm::vec3 normalized(position[0] / 65535.0f, position[1] / 65535.0f, position[2] / 65535.0f);
+	vertex.position = boundsMin + normalized * boundsExtent;
+
+	glm::vec2 octahedral(std::max(normal[0] / 32767.0f, -1.0f), std::max(normal[1] / 32767.0f, -1.0f));
+	glm::vec3 n(octahedral.x, octahedral.y, 1.0f - std::fabs(octahedral.x) - std::fabs(octahedral.y));
+	float t = std::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+
+	float length = glm::length(n);
+	vertex.normal = length > 0.0f ? n / length : glm::vec3(0.0f);
+	vertex.color = vertex.normal;
+
+	vertex.uv = glm::vec2(glm::unpackHalf1x16(uv[0]), glm::unpackHalf1x16(uv[1]));
+
+	return vertex;
+}
+
+namespace
+{
+	struct VertexHash
+	{
+		size_t operator()(const Vertex& vertex) const
+		{
+			const float* values = &vertex.position.x;
+			const size_t valueCount = sizeof(Vertex) / sizeof(float);
+
+			size_t hash = 14695981039346656037ull;
+			for (size_t i = 0; i < valueCount; i++)
+			{
+				uint32_t bits;
+				memcpy(&bits, &values[i], sizeof(uint32_t));
+
+				// -0 compares equal to 0, so both have to hash the same
+				if (bits == 0x80000000u)
+				{
+					bits = 0;
+				}
+
+				hash ^= bits;
+				hash *= 1099511628211ull;
+			}
+
+			return hash;
+		}
+	};
+
+	using VertexMap = std::unordered_map<Vertex, uint32_t, VertexHash>;
+
+	void addUniqueVertex(Mesh& mesh, VertexMap& uniqueVertices, const Vertex& vertex)
+	{
+		auto inserted = uniqueVertices.try_emplace(vertex, static_cast<uint32_t>(mesh._vertices.size()));
+		if (inserted.second)
+		{
+			mesh._vertices.push_back(vertex);
+		}
+
+		mesh._indices.push_back(inserted.first->second);
+	}
+
+	uint32_t findMaterial(Mesh& mesh, const std::string& name)
+	{
+		for (size_t i = 0; i < mesh._materialNames.size(); i++)
+		{
+			if (mesh._materialNames[i] == name)
+			{
+				return static_cast<uint32_t>(i);
+			}
+		}
+
+		mesh._materialNames.push_back(name);
+		return static_cast<uint32_t>(mesh._materialNames.size() - 1);
+	}
+
+	// a submesh covers the indices added between beginSubmesh and endSubmesh, empty ones are dropped
+	void beginSubmesh(Mesh& mesh, const std::string& material)
+	{
+		Submesh submesh = {};
+		submesh.firstIndex = static_cast<uint32_t>(mesh._indices.size());
+		submesh.materialIndex = findMaterial(mesh, material);
+		mesh._submeshes.push_back(submesh);
+	}
+
+	void endSubmesh(Mesh& mesh)
+	{
+		Submesh& submesh = mesh._submeshes.back();
+		submesh.indexCount = static_cast<uint32_t>(mesh._indices.size()) - submesh.firstIndex;
+
+		if (submesh.indexCount == 0)
+		{
+			mesh._submeshes.pop_back();
+		}
+	}
+
+	void printIndexingStats(const char* filename, const Mesh& mesh)
+	{
+		const size_t unindexedSize = mesh._indices.size() * sizeof(Vertex);
+		const size_t indexedSize = mesh._vertices.size() * sizeof(Vertex) + mesh._indices.size() * mesh.getIndexSize();
+
+		std::cout << filename << " : " << mesh._vertices.size() << " unique vertices, " << mesh._indices.size() << " indices, "
+			<< mesh._submeshes.size() << " submeshes, " << unindexedSize << " -> " << indexedSize << " bytes\n";
+	}
+}
+
+bool Mesh::loadFromObj(const char* filename, uint32_t threadCount)
+{
+	vkObj::ObjData obj;
+
+	if (!vkObj::parseObj(filename, threadCount, obj))
+	{
+		return false;
+	}
+
+	glm::vec3 defaultColor = { 0.5f, 0.5f, 0.5f };
+
+	VertexMap uniqueVertices;
+	_indices.reserve(obj.corners.size());
+
+	for (const vkObj::ObjGroup& group : obj.groups)
+	{
+		beginSubmesh(*this, group.material);
+
+		for (size_t c = group.firstCorner; c < group.firstCorner + group.cornerCount; c++)
+		{
+			const vkObj::ObjCorner& corner = obj.corners[c];
+			bool hasNormal = corner.normal >= 0;
+
+			Vertex newVertex;
+			newVertex.position.x = obj.positions[3 * corner.position + 0];
+			newVertex.position.y = obj.positions[3 * corner.position + 1];
+			newVertex.position.z = obj.positions[3 * corner.position + 2];
+
+			newVertex.normal = glm::vec3(0.0f);
+			if (hasNormal)
+			{
+				newVertex.normal.x = obj.normals[3 * corner.normal + 0];
+				newVertex.normal.y = obj.normals[3 * corner.normal + 1];
+				newVertex.normal.z = obj.normals[3 * corner.normal + 2];
+			}
+
+			newVertex.color = hasNormal ? newVertex.normal : defaultColor;
+
+			newVertex.uv = { 0.0f, 0.0f };
+			if (corner.texcoord >= 0)
+			{
+				newVertex.uv.x = obj.texcoords[2 * corner.texcoord + 0];
+				newVertex.uv.y = 1 - obj.texcoords[2 * corner.texcoord + 1];
+			}
+
+			addUniqueVertex(*this, uniqueVertices, newVertex);
+		}
+
+		endSubmesh(*this);
+	}
+
+	printIndexingStats(filename, *this);
+
+	computeBounds();
+
+	return true;
+}
+
+bool Mesh::loadFromObjReference(const char* filename)
 {
 	tinyobj::attrib_t attrib;
 
@@ -73,19 +347,35 @@ bool Mesh::loadFromObj(const char* filename)
 	size_t shapeSize = shapes.size();
 	glm::vec3 defaultColor = { 0.5f, 0.5f, 0.5f };
 
+	VertexMap uniqueVertices;
+
 	for (size_t s = 0; s < shapeSize; s++)
 	{
 		size_t index_offset = 0;
 		size_t vertexSize = shapes[s].mesh.num_face_vertices.size();
+		int lastMaterial = -2;
+
 		for (size_t f = 0; f < vertexSize; f++)
 		{
 			int fv = 3;
 
+			int material = shapes[s].mesh.material_ids[f];
+			if (material != lastMaterial)
+			{
+				if (lastMaterial != -2)
+				{
+					endSubmesh(*this);
+				}
+
+				beginSubmesh(*this, material >= 0 ? materials[material].name : "");
+				lastMaterial = material;
+			}
+
 			for (size_t v = 0; v < fv; v++)
 			{
 				tinyobj::index_t index = shapes[s].mesh.indices[index_offset + v];
 
-				bool hasNormal = (attrib.normals.size() > 0);
+				bool hasNormal = (attrib.normals.size() > 0 && index.normal_index >= 0);
 
 				tinyobj::real_t vx = attrib.vertices[3 * index.vertex_index + 0];
 				tinyobj::real_t vy = attrib.vertices[3 * index.vertex_index + 1];
@@ -113,18 +403,391 @@ bool Mesh::loadFromObj(const char* filename)
 
 				newVertex.color = hasNormal ? newVertex.normal : defaultColor;
 
-				tinyobj::real_t ux = attrib.texcoords[2 * index.texcoord_index + 0];
-				tinyobj::real_t uy = attrib.texcoords[2 * index.texcoord_index + 1];
+				tinyobj::real_t ux = 0;
+				tinyobj::real_t uy = 1;
+
+				if (index.texcoord_index >= 0)
+				{
+					ux = attrib.texcoords[2 * index.texcoord_index + 0];
+					uy = attrib.texcoords[2 * index.texcoord_index + 1];
+				}
 
 				newVertex.uv.x = ux;
 				newVertex.uv.y = 1 - uy;
 
-				_vertices.push_back(newVertex);
+				addUniqueVertex(*this, uniqueVertices, newVertex);
 			}
 
 			index_offset += fv;
 		}
+
+		if (lastMaterial != -2)
+		{
+			endSubmesh(*this);
+		}
 	}
 
+	printIndexingStats(filename, *this);
+
+	computeBounds();
+
 	return true;
 }
+
+bool Mesh::loadFromObjCached(const char* filename)
+{
+	std::string cachePath = vkCache::getMeshCachePath(filename);
+
+	if (vkCache::loadMesh(cachePath.c_str(), filename, *this))
+	{
+		// optimizeMesh reports the statistics when the cache is built, a hit reports those of the mapped indices
+		vkMeshOpt::VertexCacheStats stats = vkMeshOpt::analyzeVertexCache(getIndexData(), getIndexCount(), getVertexCount());
+		std::cout << filename << " : ACMR " << stats.acmr << ", ATVR " << stats.atvr << ", " << _submeshes.size() << " submeshes (cached)\n";
+		return true;
+	}
+
+	if (!loadFromObj(filename))
+	{
+		return false;
+	}
+
+	vkMeshOpt::optimizeMesh(*this, true, filename);
+
+	if (!vkCache::saveMesh(cachePath.c_str(), filename, *this))
+	{
+		std::cout << "::WARNING:: Cannot write mesh cache " << cachePath << "\n";
+	}
+
+	return true;
+}
+
+const Vertex* Mesh::getVertexData() const
+{
+	return _mappedFile ? _mappedVertices : _vertices.data();
+}
+
+size_t Mesh::getVertexCount() const
+{
+	return _mappedFile ? _mappedVertexCount : _vertices.size();
+}
+
+const uint32_t* Mesh::getIndexData() const
+{
+	return _mappedFile ? _mappedIndices : _indices.data();
+}
+
+size_t Mesh::getIndexCount() const
+{
+	return _mappedFile ? _mappedIndexCount : _indices.size();
+}
+
+void Mesh::computeBounds()
+{
+	const Vertex* vertices = getVertexData();
+	const size_t vertexCount = getVertexCount();
+
+	if (vertexCount == 0)
+	{
+		_boundsMin = glm::vec3(0.0f);
+		_boundsMax = glm::vec3(0.0f);
+		return;
+	}
+
+	_boundsMin = vertices[0].position;
+	_boundsMax = vertices[0].position;
+
+	for (size_t i = 1; i < vertexCount; i++)
+	{
+		_boundsMin = glm::min(_boundsMin, vertices[i].position);
+		_boundsMax = glm::max(_boundsMax, vertices[i].position);
+	}
+
+	if (_submeshes.empty())
+	{
+		Submesh whole = {};
+		whole.indexCount = static_cast<uint32_t>(getIndexCount());
+		whole.materialIndex = findMaterial(*this, "");
+		_submeshes.push_back(whole);
+	}
+
+	const uint32_t* indices = getIndexData();
+
+	// the sphere is centered on the AABB and encloses every vertex the range references
+	for (Submesh& submesh : _submeshes)
+	{
+		submesh.boundsMin = glm::vec3(0.0f);
+		submesh.boundsMax = glm::vec3(0.0f);
+		submesh.sphereCenter = glm::vec3(0.0f);
+		submesh.sphereRadius = 0.0f;
+
+		if (submesh.indexCount == 0)
+		{
+			continue;
+		}
+
+		const uint32_t* first = indices + submesh.firstIndex;
+		const uint32_t* last = first + submesh.indexCount;
+
+		submesh.boundsMin = vertices[*first].position;
+		submesh.boundsMax = vertices[*first].position;
+
+		for (const uint32_t* index = first + 1; index < last; index++)
+		{
+			submesh.boundsMin = glm::min(submesh.boundsMin, vertices[*index].position);
+			submesh.boundsMax = glm::max(submesh.boundsMax, vertices[*index].position);
+		}
+
+		submesh.sphereCenter = (submesh.boundsMin + submesh.boundsMax) * 0.5f;
+
+		float radiusSquared = 0.0f;
+		for (const uint32_t* index = first; index < last; index++)
+		{
+			glm::vec3 offset = vertices[*index].position - submesh.sphereCenter;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+
+		submesh.sphereRadius = std::sqrt(radiusSquared);
+	}
+}
+
+VkIndexType Mesh::getIndexType() const
+{
+	return getVertexCount() <= UINT16_MAX ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+size_t Mesh::getIndexSize() const
+{
+	return getIndexType() == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+glm::vec3 Mesh::getBoundsExtent() const
+{
+	glm::vec3 extent = _boundsMax - _boundsMin;
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (extent[i] <= 0.0f)
+		{
+			extent[i] = 1.0f;
+		}
+	}
+
+	return extent;
+}
+
+void Mesh::packVertices()
+{
+	const Vertex* vertices = getVertexData();
+	const size_t vertexCount = getVertexCount();
+	const glm::vec3 extent = getBoundsExtent();
+
+	_packedVertices.resize(vertexCount);
+
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		_packedVertices[i] = PackedVertex::pack(vertices[i], _boundsMin, extent);
+	}
+}
+
+bool Mesh::isPacked() const
+{
+	return !_packedVertices.empty();
+}
+
+size_t Mesh::getVertexStride() const
+{
+	return isPacked() ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+namespace
+{
+	bool lessVertex(const Vertex& a, const Vertex& b)
+	{
+		const float* valuesA = &a.position.x;
+		const float* valuesB = &b.position.x;
+		return std::lexicographical_compare(valuesA, valuesA + sizeof(Vertex) / sizeof(float), valuesB, valuesB + sizeof(Vertex) / sizeof(float));
+	}
+}
+
+bool testMeshIndexing(const char* filename)
+{
+	// the corners as tinyobj reads them, unindexed, with the attribute rules of loadFromObj
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string warning;
+	std::string error;
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warning, &error, filename, nullptr) || !error.empty())
+	{
+		std::cout << filename << " : cannot be read " << error << "\n";
+		return false;
+	}
+
+	std::vector<Vertex> corners;
+	for (const tinyobj::shape_t& shape : shapes)
+	{
+		for (const tinyobj::index_t& index : shape.mesh.indices)
+		{
+			const bool hasNormal = !attrib.normals.empty() && index.normal_index >= 0;
+
+			Vertex corner;
+			corner.position = glm::vec3(attrib.vertices[3 * index.vertex_index + 0], attrib.vertices[3 * index.vertex_index + 1], attrib.vertices[3 * index.vertex_index + 2]);
+			corner.normal = hasNormal ? glm::vec3(attrib.normals[3 * index.normal_index + 0], attrib.normals[3 * index.normal_index + 1], attrib.normals[3 * index.normal_index + 2]) : glm::vec3(0.0f);
+			corner.color = hasNormal ? corner.normal : glm::vec3(0.5f, 0.5f, 0.5f);
+			corner.uv = index.texcoord_index >= 0 ? glm::vec2(attrib.texcoords[2 * index.texcoord_index + 0], 1 - attrib.texcoords[2 * index.texcoord_index + 1]) : glm::vec2(0.0f, 0.0f);
+			corners.push_back(corner);
+		}
+	}
+
+	// expected counts, one index per corner and one vertex per distinct corner, without any hashing
+	std::vector<Vertex> distinct = corners;
+	std::sort(distinct.begin(), distinct.end(), lessVertex);
+	distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+
+	Mesh mesh;
+	if (!mesh.loadFromObj(filename))
+	{
+		return false;
+	}
+
+	bool passed = true;
+
+	if (mesh.getIndexCount() != corners.size() || mesh.getVertexCount() != distinct.size())
+	{
+		std::cout << filename << " : " << mesh.getVertexCount() << " vertices and " << mesh.getIndexCount() << " indices, expected "
+			<< distinct.size() << " and " << corners.size() << "\n";
+		passed = false;
+	}
+
+	// expanding the indices gives back the corners, submeshes may order them differently than the file
+	std::vector<Vertex> expanded;
+	expanded.reserve(mesh.getIndexCount());
+	for (size_t i = 0; i < mesh.getIndexCount() && passed; i++)
+	{
+		const uint32_t index = mesh.getIndexData()[i];
+		if (index >= mesh.getVertexCount())
+		{
+			std::cout << filename << " : index " << i << " is " << index << ", out of range\n";
+			passed = false;
+			break;
+		}
+
+		expanded.push_back(mesh.getVertexData()[index]);
+	}
+
+	if (passed)
+	{
+		std::sort(corners.begin(), corners.end(), lessVertex);
+		std::sort(expanded.begin(), expanded.end(), lessVertex);
+		if (corners != expanded)
+		{
+			std::cout << filename << " : the indexed triangles differ from the OBJ\n";
+			passed = false;
+		}
+	}
+
+	const size_t unindexedSize = corners.size() * sizeof(Vertex);
+	const size_t indexedSize = mesh.getVertexCount() * sizeof(Vertex) + mesh.getIndexCount() * mesh.getIndexSize();
+	if (passed && indexedSize >= unindexedSize)
+	{
+		std::cout << filename << " : indexing saves nothing, " << unindexedSize << " -> " << indexedSize << " bytes\n";
+		passed = false;
+	}
+
+	std::cout << filename << " : " << mesh.getVertexCount() << " vertices, " << mesh.getIndexCount() << " indices, "
+		<< unindexedSize << " -> " << indexedSize << " bytes : " << (passed ? "passed" : "FAILED") << "\n";
+
+	return passed;
+}
+
+bool testVertexPacking()
+{
+	// positions span an uneven box away from the origin, normals cover the sphere including the axes and
+	// the fold edges of the octahedron, uvs go outside 0..1 as tiled textures do
+	const glm::vec3 boundsMin(-37.5f, 2.0f, 1000.0f);
+	const glm::vec3 boundsExtent(120.0f, 0.25f, 4096.0f);
+
+	// unorm16 rounding is off by half a step, the bound allows a whole one for the float math around it
+	const glm::vec3 maxPositionError = boundsExtent / 65535.0f;
+	// half a snorm16 step on both axes, stretched by up to about three where the octahedron maps to the
+	// sphere, the round trip measured at most 6.5e-5 radians over a few million directions
+	const float maxNormalError = 7e-5f;
+	// half floats keep 11 significant bits, the relative rounding error is at most 2^-11
+	const float maxUvRelativeError = 1.0f / 2048.0f;
+	// uvs that small are denormal halfs, the absolute step is 2^-24
+	const float minUvError = 1.0f / 16777216.0f;
+
+	std::vector<Vertex> vertices;
+
+	const glm::vec3 axes[] = {
+		{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+		{ 0.70710678f, 0.70710678f, 0 }, { -0.70710678f, 0, -0.70710678f }, { 0, 0.70710678f, -0.70710678f } };
+	for (const glm::vec3& axis : axes)
+	{
+		Vertex vertex{};
+		vertex.position = boundsMin;
+		vertex.normal = axis;
+		vertices.push_back(vertex);
+	}
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::normal_distribution<float> gaussian(0.0f, 1.0f);
+
+	for (int i = 0; i < 100000; i++)
+	{
+		Vertex vertex{};
+		vertex.position = boundsMin + glm::vec3(unit(random), unit(random), unit(random)) * boundsExtent;
+		vertex.normal = glm::normalize(glm::vec3(gaussian(random), gaussian(random), gaussian(random)));
+		vertex.uv = glm::vec2(unit(random) * 8.0f - 4.0f, unit(random) * std::pow(2.0f, -float(i % 30)));
+		vertices.push_back(vertex);
+	}
+
+	// the corners of the bounds quantize to the ends of the range
+	Vertex corner{};
+	corner.position = boundsMin + boundsExtent;
+	corner.normal = glm::vec3(0.0f, 0.0f, 1.0f);
+	vertices.push_back(corner);
+
+	glm::vec3 worstPosition(0.0f);
+	float worstNormal = 0.0f;
+	float worstUv = 0.0f;
+	size_t failures = 0;
+
+	for (const Vertex& vertex : vertices)
+	{
+		const Vertex unpacked = PackedVertex::pack(vertex, boundsMin, boundsExtent).unpack(boundsMin, boundsExtent);
+
+		const glm::vec3 positionError = glm::abs(unpacked.position - vertex.position);
+		worstPosition = glm::max(worstPosition, positionError);
+
+		// the chord between unit vectors is the angle for errors this small, acos of the dot loses it to rounding
+		const float normalError = glm::length(unpacked.normal - vertex.normal);
+		worstNormal = std::max(worstNormal, normalError);
+
+		bool uvPassed = true;
+		for (int k = 0; k < 2; k++)
+		{
+			const float error = std::fabs(unpacked.uv[k] - vertex.uv[k]);
+			const float allowed = std::max(std::fabs(vertex.uv[k]) * maxUvRelativeError, minUvError);
+			worstUv = std::max(worstUv, error / allowed);
+			uvPassed &= error <= allowed;
+		}
+
+		if (positionError.x > maxPositionError.x || positionError.y > maxPositionError.y || positionError.z > maxPositionError.z
+			|| normalError > maxNormalError || !uvPassed)
+		{
+			failures++;
+		}
+	}
+
+	const bool passed = failures == 0;
+
+	std::cout << vertices.size() << " vertices : position error " << worstPosition.x << ", " << worstPosition.y << ", " << worstPosition.z
+		<< " (max " << maxPositionError.x << ", " << maxPositionError.y << ", " << maxPositionError.z << "), normal error "
+		<< worstNormal << " rad (max " << maxNormalError << "), uv error " << worstUv << " of the bound, "
+		<< failures << " out of bounds : " << (passed ? "passed" : "FAILED") << "\n";
+
+	return passed;
+}
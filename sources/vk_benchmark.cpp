@@ -0,0 +1,439 @@
+#include "vk_benchmark.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <cstring>
+
+/*
+Define camera path functions
+*/
+
+bool vkBench::CameraPath::load(const char* filename)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+	{
+		printf("Failed to open camera path %s\n", filename);
+		return false;
+	}
+
+	_keyframes.clear();
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line))
+	{
+		lineNumber++;
+
+		line = line.substr(0, line.find('#'));
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+		{
+			continue;
+		}
+
+		CameraKeyframe keyframe;
+		std::istringstream stream(line);
+		if (!(stream >> keyframe.time >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z >> keyframe.yaw >> keyframe.pitch))
+		{
+			printf("%s:%d : expected time x y z yaw pitch\n", filename, lineNumber);
+			return false;
+		}
+
+		if (!_keyframes.empty() && keyframe.time <= _keyframes.back().time)
+		{
+			printf("%s:%d : keyframe times have to increase\n", filename, lineNumber);
+			return false;
+		}
+
+		_keyframes.push_back(keyframe);
+	}
+
+	if (_keyframes.empty())
+	{
+		printf("%s has no keyframes\n", filename);
+		return false;
+	}
+
+	return true;
+}
+
+vkBench::CameraKeyframe vkBench::CameraPath::sample(float time) const
+{
+	if (_keyframes.empty())
+	{
+		return {};
+	}
+
+	if (time <= _keyframes.front().time)
+	{
+		return _keyframes.front();
+	}
+
+	if (time >= _keyframes.back().time)
+	{
+		return _keyframes.back();
+	}
+
+	auto next = std::upper_bound(_keyframes.begin(), _keyframes.end(), time, [](float t, const CameraKeyframe& keyframe) {
+		return t < keyframe.time;
+		});
+	auto previous = next - 1;
+
+	const float t = (time - previous->time) / (next->time - previous->time);
+
+	CameraKeyframe keyframe;
+	keyframe.time = time;
+	keyframe.position = previous->position + (next->position - previous->position) * t;
+	keyframe.yaw = previous->yaw + (next->yaw - previous->yaw) * t;
+	keyframe.pitch = previous->pitch + (next->pitch - previous->pitch) * t;
+
+	return keyframe;
+}
+
+/*
+Define result functions
+*/
+
+vkBench::Percentiles vkBench::computePercentiles(std::vector<double> values)
+{
+	values.erase(std::remove_if(values.begin(), values.end(), [](double value) { return value < 0.0; }), values.end());
+
+	Percentiles percentiles;
+	if (values.empty())
+	{
+		percentiles.average = percentiles.p50 = percentiles.p95 = percentiles.p99 = percentiles.max = -1.0;
+		return percentiles;
+	}
+
+	std::sort(values.begin(), values.end());
+
+	double sum = 0.0;
+	for (double value : values)
+	{
+		sum += value;
+	}
+
+	auto rank = [&](double p) {
+		size_t index = static_cast<size_t>(std::ceil(p * values.size()));
+		return values[std::min(values.size() - 1, index > 0 ? index - 1 : 0)];
+	};
+
+	percentiles.average = sum / values.size();
+	percentiles.p50 = rank(0.50);
+	percentiles.p95 = rank(0.95);
+	percentiles.p99 = rank(0.99);
+	percentiles.max = values.back();
+
+	return percentiles;
+}
+
+namespace
+{
+	struct Column
+	{
+		const char* name;
+		std::function<double(const vkBench::FrameSample&)> value;
+	};
+
+	const std::vector<Column>& getColumns()
+	{
+		static const std::vector<Column> columns = {
+			{ "frameTimeMs", [](const vkBench::FrameSample& frame) { return frame.frameTime; } },
+			{ "cpuTimeMs", [](const vkBench::FrameSample& frame) { return frame.cpuTime; } },
+			{ "gpuTimeMs", [](const vkBench::FrameSample& frame) { return frame.gpuTime; } },
+			{ "draws", [](const vkBench::FrameSample& frame) { return double(frame.draws); } },
+			{ "triangles", [](const vkBench::FrameSample& frame) { return double(frame.triangles); } },
+			{ "memoryMB", [](const vkBench::FrameSample& frame) { return frame.memory; } },
+		};
+
+		return columns;
+	}
+
+	vkBench::Percentiles getColumnPercentiles(const Column& column, const std::vector<vkBench::FrameSample>& frames)
+	{
+		std::vector<double> values(frames.size());
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			values[i] = column.value(frames[i]);
+		}
+
+		return vkBench::computePercentiles(values);
+	}
+
+	// every scope name in order of first appearance
+	std::vector<const char*> getScopeNames(const std::vector<vkBench::FrameSample>& frames)
+	{
+		std::vector<const char*> names;
+		for (const vkBench::FrameSample& frame : frames)
+		{
+			for (const auto& scope : frame.gpuScopes)
+			{
+				auto it = std::find_if(names.begin(), names.end(), [&](const char* name) { return strcmp(name, scope.first) == 0; });
+				if (it == names.end())
+				{
+					names.push_back(scope.first);
+				}
+			}
+		}
+
+		return names;
+	}
+
+	// summed over repeated scopes of the same name, negative when the frame has none
+	double getScopeTime(const vkBench::FrameSample& frame, const char* name)
+	{
+		double time = -1.0;
+		for (const auto& scope : frame.gpuScopes)
+		{
+			if (strcmp(scope.first, name) == 0)
+			{
+				time = std::max(time, 0.0) + scope.second;
+			}
+		}
+
+		return time;
+	}
+
+	vkBench::Percentiles getScopePercentiles(const char* name, const std::vector<vkBench::FrameSample>& frames)
+	{
+		std::vector<double> values(frames.size());
+		for (size_t i = 0; i < frames.size(); i++)
+		{
+			values[i] = getScopeTime(frames[i], name);
+		}
+
+		return vkBench::computePercentiles(values);
+	}
+
+	std::string escapeJson(const char* text)
+	{
+		std::string escaped;
+		for (const char* c = text; *c != '\0'; c++)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				escaped += '\\';
+			}
+
+			escaped += *c;
+		}
+
+		return escaped;
+	}
+}
+
+bool vkBench::writeJson(const char* filename, const char* name, const std::vector<FrameSample>& frames)
+{
+	FILE* output = fopen(filename, "w");
+	if (output == nullptr)
+	{
+		printf("Failed to open %s for writing\n", filename);
+		return false;
+	}
+
+	fprintf(output, "{\n  \"name\": \"%s\",\n  \"frames\": %zu,\n  \"summary\": {\n", escapeJson(name).c_str(), frames.size());
+
+	const std::vector<Column>& columns = getColumns();
+	for (size_t c = 0; c < columns.size(); c++)
+	{
+		Percentiles percentiles = getColumnPercentiles(columns[c], frames);
+		fprintf(output, "    \"%s\": { \"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+			columns[c].name, percentiles.average, percentiles.p50, percentiles.p95, percentiles.p99, percentiles.max,
+			c + 1 < columns.size() ? "," : "");
+	}
+
+	fprintf(output, "  },\n  \"gpuScopes\": {\n");
+
+	const std::vector<const char*> scopeNames = getScopeNames(frames);
+	for (size_t s = 0; s < scopeNames.size(); s++)
+	{
+		Percentiles percentiles = getScopePercentiles(scopeNames[s], frames);
+		fprintf(output, "    \"%s\": { \"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+			escapeJson(scopeNames[s]).c_str(), percentiles.average, percentiles.p50, percentiles.p95, percentiles.p99, percentiles.max,
+			s + 1 < scopeNames.size() ? "," : "");
+	}
+
+	fprintf(output, "  },\n  \"samples\": [\n");
+
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		const FrameSample& frame = frames[i];
+		fprintf(output, "    { \"frame\": %zu, \"frameTimeMs\": %.4f, \"cpuTimeMs\": %.4f, \"gpuTimeMs\": %.4f, \"draws\": %u, \"triangles\": %llu, \"memoryMB\": %.2f, \"gpuScopes\": {",
+			i, frame.frameTime, frame.cpuTime, frame.gpuTime, frame.draws, (unsigned long long)frame.triangles, frame.memory);
+
+		for (size_t s = 0; s < frame.gpuScopes.size(); s++)
+		{
+			fprintf(output, "%s \"%s\": %.4f", s > 0 ? "," : "", escapeJson(frame.gpuScopes[s].first).c_str(), frame.gpuScopes[s].second);
+		}
+
+		fprintf(output, " } }%s\n", i + 1 < frames.size() ? "," : "");
+	}
+
+	fprintf(output, "  ]\n}\n");
+	fclose(output);
+
+	return true;
+}
+
+bool vkBench::writeCsv(const char* filename, const std::vector<FrameSample>& frames)
+{
+	FILE* output = fopen(filename, "w");
+	if (output == nullptr)
+	{
+		printf("Failed to open %s for writing\n", filename);
+		return false;
+	}
+
+	const std::vector<const char*> scopeNames = getScopeNames(frames);
+
+	fprintf(output, "frame,frame_ms,cpu_ms,gpu_ms,draws,triangles,memory_mb");
+	for (const char* name : scopeNames)
+	{
+		fprintf(output, ",gpu_%s_ms", name);
+	}
+	fprintf(output, "\n");
+
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		const FrameSample& frame = frames[i];
+		fprintf(output, "%zu,%.4f,%.4f,%.4f,%u,%llu,%.2f",
+			i, frame.frameTime, frame.cpuTime, frame.gpuTime, frame.draws, (unsigned long long)frame.triangles, frame.memory);
+
+		for (const char* name : scopeNames)
+		{
+			fprintf(output, ",%.4f", getScopeTime(frame, name));
+		}
+		fprintf(output, "\n");
+	}
+
+	fclose(output);
+
+	return true;
+}
+
+bool vkBench::readBaselineP95(const char* filename, const char* column, double& outP95)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::stringstream stream;
+	stream << file.rdbuf();
+	const std::string json = stream.str();
+
+	// the summary comes first, the per frame samples repeat the column names without an object
+	const std::string key = std::string("\"") + column + "\": {";
+	const size_t summary = json.find(key);
+	if (summary == std::string::npos)
+	{
+		return false;
+	}
+
+	const size_t p95 = json.find("\"p95\":", summary);
+	if (p95 == std::string::npos || p95 > json.find('}', summary))
+	{
+		return false;
+	}
+
+	outP95 = atof(json.c_str() + p95 + strlen("\"p95\":"));
+	return true;
+}
+
+bool vkBench::checkResults(const BenchmarkSettings& settings, const std::vector<FrameSample>& frames)
+{
+	printf("%zu frames\n", frames.size());
+	printf("  %-12s %10s %10s %10s %10s %10s\n", "", "avg", "p50", "p95", "p99", "max");
+
+	for (const Column& column : getColumns())
+	{
+		Percentiles percentiles = getColumnPercentiles(column, frames);
+		printf("  %-12s %10.3f %10.3f %10.3f %10.3f %10.3f\n", column.name,
+			percentiles.average, percentiles.p50, percentiles.p95, percentiles.p99, percentiles.max);
+	}
+
+	for (const char* name : getScopeNames(frames))
+	{
+		Percentiles percentiles = getScopePercentiles(name, frames);
+		printf("  gpu %-8s %10.3f %10.3f %10.3f %10.3f %10.3f\n", name,
+			percentiles.average, percentiles.p50, percentiles.p95, percentiles.p99, percentiles.max);
+	}
+
+	bool passed = true;
+
+	auto check = [&](const char* name, double p95, double threshold) {
+		if (threshold <= 0.0)
+		{
+			return;
+		}
+
+		if (p95 < 0.0)
+		{
+			printf("%s p95 is not available, its threshold is skipped\n", name);
+			return;
+		}
+
+		const bool below = p95 <= threshold;
+		printf("%s p95 %.3f ms, threshold %.3f ms : %s\n", name, p95, threshold, below ? "ok" : "REGRESSION");
+		passed &= below;
+	};
+
+	std::vector<double> frameTimes;
+	std::vector<double> gpuTimes;
+	for (const FrameSample& frame : frames)
+	{
+		frameTimes.push_back(frame.frameTime);
+		gpuTimes.push_back(frame.gpuTime);
+	}
+
+	const double frameTimeP95 = computePercentiles(frameTimes).p95;
+	const double gpuTimeP95 = computePercentiles(gpuTimes).p95;
+
+	check("frame time", frameTimeP95, settings.maxFrameTimeP95);
+	check("GPU time", gpuTimeP95, settings.maxGpuTimeP95);
+
+	if (settings.baselinePath == nullptr || settings.maxRegression <= 0.0)
+	{
+		return passed;
+	}
+
+	// absolute times only mean something on one machine, a missing baseline is recorded by this run
+	std::ifstream baseline(settings.baselinePath);
+	if (!baseline.is_open())
+	{
+		printf("No baseline at %s, this run becomes the baseline\n", settings.baselinePath);
+		return writeJson(settings.baselinePath, settings.cameraPath != nullptr ? settings.cameraPath : "", frames) && passed;
+	}
+
+	auto compare = [&](const char* name, const char* column, double p95) {
+		double baselineP95;
+		if (!readBaselineP95(settings.baselinePath, column, baselineP95))
+		{
+			printf("%s has no %s p95\n", settings.baselinePath, column);
+			passed = false;
+			return;
+		}
+
+		if (p95 < 0.0 || baselineP95 <= 0.0)
+		{
+			printf("%s p95 is not available in this run or the baseline, its comparison is skipped\n", name);
+			return;
+		}
+
+		const double limit = baselineP95 * (1.0 + settings.maxRegression / 100.0);
+		const bool below = p95 <= limit;
+		printf("%s p95 %.3f ms, baseline %.3f ms, limit +%.0f%% : %s\n", name, p95, baselineP95, settings.maxRegression, below ? "ok" : "REGRESSION");
+		passed &= below;
+	};
+
+	compare("frame time", "frameTimeMs", frameTimeP95);
+	compare("GPU time", "gpuTimeMs", gpuTimeP95);
+
+	return passed;
+}
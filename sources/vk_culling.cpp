@@ -0,0 +1,520 @@
+#include "vk_culling.hpp"
+#include "vk_jobs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <glm/geometric.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VK_CULL_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(VK_CULL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define VK_CULL_TARGET_SSE __attribute__((target("sse2")))
+#define VK_CULL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define VK_CULL_TARGET_SSE
+#define VK_CULL_TARGET_AVX2
+#endif
+
+/*
+Define bounds functions
+*/
+
+void vkCull::SphereBounds::resize(size_t sphereCount)
+{
+	const size_t paddedCount = (sphereCount + 7) & ~size_t(7);
+
+	// padding lanes get a negative infinite radius so they never pass a plane test
+	centerX.assign(paddedCount, 0.0f);
+	centerY.assign(paddedCount, 0.0f);
+	centerZ.assign(paddedCount, 0.0f);
+	radius.assign(paddedCount, -INFINITY);
+	count = sphereCount;
+}
+
+void vkCull::SphereBounds::set(size_t index, const glm::vec3& center, float sphereRadius)
+{
+	centerX[index] = center.x;
+	centerY[index] = center.y;
+	centerZ[index] = center.z;
+	radius[index] = sphereRadius;
+}
+
+vkCull::Frustum vkCull::extractFrustum(const glm::mat4& viewProj)
+{
+	// Gribb-Hartmann, rows of the matrix combined; the near plane uses -w <= z which also
+	// holds for a 0..1 depth range, only making it a little more conservative
+	glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+	glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+	glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+	glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0;
+	frustum.planes[1] = row3 - row0;
+	frustum.planes[2] = row3 + row1;
+	frustum.planes[3] = row3 - row1;
+	frustum.planes[4] = row3 + row2;
+	frustum.planes[5] = row3 - row2;
+
+	for (glm::vec4& plane : frustum.planes)
+	{
+		float length = glm::length(glm::vec3(plane));
+		if (length > 0.0f)
+		{
+			plane /= length;
+		}
+	}
+
+	return frustum;
+}
+
+void vkCull::transformSphere(const glm::mat4& transform, const glm::vec3& center, float radius, glm::vec3& outCenter, float& outRadius)
+{
+	outCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+
+	float scale = std::max({
+		glm::length(glm::vec3(transform[0])),
+		glm::length(glm::vec3(transform[1])),
+		glm::length(glm::vec3(transform[2]))
+		});
+
+	outRadius = radius * scale;
+}
+
+/*
+Define culling paths
+*/
+
+namespace
+{
+	// each path evaluates ((x * nx + y * ny) + z * nz) + d in the same order, so they agree bit for bit
+	// as long as the compiler does not contract the scalar path into FMAs
+	// every path culls [begin, end), begin is a multiple of 8 and end at most the padded count
+	size_t cullScalar(const vkCull::Frustum& frustum, const vkCull::SphereBounds& bounds, size_t begin, size_t end, uint32_t* outVisible)
+	{
+		size_t visibleCount = 0;
+
+		for (size_t i = begin; i < std::min(end, bounds.count); i++)
+		{
+			const float x = bounds.centerX[i];
+			const float y = bounds.centerY[i];
+			const float z = bounds.centerZ[i];
+			const float negativeRadius = 0.0f - bounds.radius[i];
+
+			bool visible = true;
+			for (const glm::vec4& plane : frustum.planes)
+			{
+				float distance = x * plane.x + y * plane.y + z * plane.z + plane.w;
+				visible &= distance >= negativeRadius;
+			}
+
+			outVisible[visibleCount] = static_cast<uint32_t>(i);
+			visibleCount += visible ? 1 : 0;
+		}
+
+		return visibleCount;
+	}
+
+#ifdef VK_CULL_X86
+	VK_CULL_TARGET_SSE
+	size_t cullSSE(const vkCull::Frustum& frustum, const vkCull::SphereBounds& bounds, size_t begin, size_t end, uint32_t* outVisible)
+	{
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (int p = 0; p < 6; p++)
+		{
+			planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+		}
+
+		const __m128 zero = _mm_setzero_ps();
+		size_t visibleCount = 0;
+
+		for (size_t i = begin; i < end; i += 4)
+		{
+			const __m128 x = _mm_loadu_ps(bounds.centerX.data() + i);
+			const __m128 y = _mm_loadu_ps(bounds.centerY.data() + i);
+			const __m128 z = _mm_loadu_ps(bounds.centerZ.data() + i);
+			const __m128 negativeRadius = _mm_sub_ps(zero, _mm_loadu_ps(bounds.radius.data() + i));
+
+			__m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(x, planeX[p]), _mm_mul_ps(y, planeY[p])), _mm_mul_ps(z, planeZ[p])), planeW[p]);
+				visible = _mm_and_ps(visible, _mm_cmpge_ps(distance, negativeRadius));
+			}
+
+			// padding lanes always fail, so the compaction can run over all four
+			int mask = _mm_movemask_ps(visible);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				outVisible[visibleCount] = static_cast<uint32_t>(i + lane);
+				visibleCount += (mask >> lane) & 1;
+			}
+		}
+
+		return visibleCount;
+	}
+
+	VK_CULL_TARGET_AVX2
+	size_t cullAVX2(const vkCull::Frustum& frustum, const vkCull::SphereBounds& bounds, size_t begin, size_t end, uint32_t* outVisible)
+	{
+		__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (int p = 0; p < 6; p++)
+		{
+			planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+		}
+
+		const __m256 zero = _mm256_setzero_ps();
+		size_t visibleCount = 0;
+
+		for (size_t i = begin; i < end; i += 8)
+		{
+			const __m256 x = _mm256_loadu_ps(bounds.centerX.data() + i);
+			const __m256 y = _mm256_loadu_ps(bounds.centerY.data() + i);
+			const __m256 z = _mm256_loadu_ps(bounds.centerZ.data() + i);
+			const __m256 negativeRadius = _mm256_sub_ps(zero, _mm256_loadu_ps(bounds.radius.data() + i));
+
+			__m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; p++)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(x, planeX[p]), _mm256_mul_ps(y, planeY[p])), _mm256_mul_ps(z, planeZ[p])), planeW[p]);
+				visible = _mm256_and_ps(visible, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+			}
+
+			int mask = _mm256_movemask_ps(visible);
+			for (int lane = 0; lane < 8; lane++)
+			{
+				outVisible[visibleCount] = static_cast<uint32_t>(i + lane);
+				visibleCount += (mask >> lane) & 1;
+			}
+		}
+
+		return visibleCount;
+	}
+#endif
+
+	bool isPathSupported(vkCull::CullPath path)
+	{
+		switch (path)
+		{
+		case vkCull::CullPath::Scalar:
+			return true;
+#ifdef VK_CULL_X86
+		case vkCull::CullPath::SSE:
+			return true;
+		case vkCull::CullPath::AVX2:
+#if defined(_MSC_VER)
+		{
+			int info[4];
+			__cpuid(info, 1);
+			const bool osSavesAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+
+			__cpuidex(info, 7, 0);
+			return osSavesAvx && (info[1] & (1 << 5)) != 0;
+		}
+#else
+			return __builtin_cpu_supports("avx2");
+#endif
+#endif
+		default:
+			return false;
+		}
+	}
+
+	size_t cullRange(const vkCull::Frustum& frustum, const vkCull::SphereBounds& bounds, size_t begin, size_t end, uint32_t* outVisible, vkCull::CullPath path)
+	{
+		switch (path)
+		{
+#ifdef VK_CULL_X86
+		case vkCull::CullPath::AVX2:
+			return cullAVX2(frustum, bounds, begin, end, outVisible);
+		case vkCull::CullPath::SSE:
+			return cullSSE(frustum, bounds, begin, end, outVisible);
+#endif
+		default:
+			return cullScalar(frustum, bounds, begin, end, outVisible);
+		}
+	}
+}
+
+vkCull::CullPath vkCull::getBestCullPath()
+{
+	static const CullPath bestPath = isPathSupported(CullPath::AVX2) ? CullPath::AVX2
+		: isPathSupported(CullPath::SSE) ? CullPath::SSE : CullPath::Scalar;
+
+	return bestPath;
+}
+
+const char* vkCull::getCullPathName(CullPath path)
+{
+	switch (path)
+	{
+	case CullPath::SSE:
+		return "SSE";
+	case CullPath::AVX2:
+		return "AVX2";
+	default:
+		return "scalar";
+	}
+}
+
+void vkCull::cullSpheres(const Frustum& frustum, const SphereBounds& bounds, std::vector<uint32_t>& outVisible, CullPath path)
+{
+	// every lane is written before the count decides whether it is kept
+	outVisible.resize(bounds.centerX.size());
+
+	size_t visibleCount = cullRange(frustum, bounds, 0, bounds.centerX.size(), outVisible.data(), path);
+
+	outVisible.resize(visibleCount);
+}
+
+void vkCull::cullSpheres(const Frustum& frustum, const SphereBounds& bounds, std::vector<uint32_t>& outVisible)
+{
+	cullSpheres(frustum, bounds, outVisible, getBestCullPath());
+}
+
+void vkCull::cullSpheresParallel(const Frustum& frustum, const SphereBounds& bounds, std::vector<uint32_t>& outVisible, CullPath path)
+{
+	// a multiple of 8 so every chunk starts on a full AVX2 lane group
+	constexpr size_t CHUNK_SIZE = 16384;
+
+	const size_t paddedCount = bounds.centerX.size();
+	const size_t chunkCount = (paddedCount + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+	outVisible.resize(paddedCount);
+
+	if (chunkCount <= 1)
+	{
+		outVisible.resize(cullRange(frustum, bounds, 0, paddedCount, outVisible.data(), path));
+		return;
+	}
+
+	// each chunk writes its visible indices at its own start, so no chunk needs another's count
+	std::vector<size_t> chunkVisible(chunkCount);
+
+	vkJobs::parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+		for (size_t chunk = begin; chunk < end; chunk++)
+		{
+			const size_t first = chunk * CHUNK_SIZE;
+			const size_t last = std::min(first + CHUNK_SIZE, paddedCount);
+			chunkVisible[chunk] = cullRange(frustum, bounds, first, last, outVisible.data() + first, path);
+		}
+	});
+
+	// the chunks only move towards the front, so copying them in order never overwrites a later one
+	size_t visibleCount = chunkVisible[0];
+	for (size_t chunk = 1; chunk < chunkCount; chunk++)
+	{
+		const uint32_t* source = outVisible.data() + chunk * CHUNK_SIZE;
+		std::copy(source, source + chunkVisible[chunk], outVisible.data() + visibleCount);
+		visibleCount += chunkVisible[chunk];
+	}
+
+	outVisible.resize(visibleCount);
+}
+
+void vkCull::cullSpheresParallel(const Frustum& frustum, const SphereBounds& bounds, std::vector<uint32_t>& outVisible)
+{
+	cullSpheresParallel(frustum, bounds, outVisible, getBestCullPath());
+}
+
+bool vkCull::benchmarkCulling()
+{
+	using Clock = std::chrono::high_resolution_clock;
+
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(70.0f), 1700.0f / 900.0f, 0.1f, 200.0f);
+	projection[1][1] *= -1;
+
+	const Frustum frustum = extractFrustum(projection * view);
+
+	bool allMatch = true;
+
+	for (size_t count : { size_t(10000), size_t(100000), size_t(1000000) })
+	{
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position(-250.0f, 250.0f);
+		std::uniform_real_distribution<float> radius(0.1f, 4.0f);
+
+		SphereBounds bounds;
+		bounds.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			bounds.set(i, glm::vec3(position(random), position(random), position(random)), radius(random));
+		}
+
+		const int iterations = count >= 1000000 ? 20 : 200;
+
+		std::vector<uint32_t> reference;
+		cullSpheres(frustum, bounds, reference, CullPath::Scalar);
+
+		for (CullPath path : { CullPath::Scalar, CullPath::SSE, CullPath::AVX2 })
+		{
+			if (!isPathSupported(path))
+			{
+				continue;
+			}
+
+			std::vector<uint32_t> visible;
+			cullSpheres(frustum, bounds, visible, path);
+
+			auto start = Clock::now();
+			for (int i = 0; i < iterations; i++)
+			{
+				cullSpheres(frustum, bounds, visible, path);
+			}
+			double time = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+
+			const bool matches = visible == reference;
+			allMatch &= matches;
+
+			std::cout << count << " spheres, " << getCullPathName(path) << " : " << time << " ms, "
+				<< count / (time * 1000.0) << " M/s, " << visible.size() << " visible, "
+				<< (matches ? "matches scalar" : "DIFFERS FROM SCALAR") << "\n";
+
+			cullSpheresParallel(frustum, bounds, visible, path);
+
+			start = Clock::now();
+			for (int i = 0; i < iterations; i++)
+			{
+				cullSpheresParallel(frustum, bounds, visible, path);
+			}
+			double parallelTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+
+			const bool parallelMatches = visible == reference;
+			allMatch &= parallelMatches;
+
+			std::cout << count << " spheres, " << getCullPathName(path) << " x" << vkJobs::getGlobal().getThreadCount()
+				<< " threads : " << parallelTime << " ms, " << count / (parallelTime * 1000.0) << " M/s, "
+				<< time / parallelTime << "x, " << (parallelMatches ? "matches scalar" : "DIFFERS FROM SCALAR") << "\n";
+		}
+	}
+
+	return allMatch;
+}
+
+bool vkCull::testCulling()
+{
+	// a few views, the last one tilted so no plane is axis aligned
+	const glm::mat4 projection = glm::perspective(glm::radians(70.0f), 1700.0f / 900.0f, 0.1f, 200.0f);
+	const glm::mat4 views[] = {
+		glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f)),
+		glm::lookAt(glm::vec3(30.0f, -6.0f, 12.0f), glm::vec3(-40.0f, 10.0f, -90.0f), glm::vec3(0.0f, 1.0f, 0.0f)),
+		glm::lookAt(glm::vec3(-5.0f, 80.0f, 3.0f), glm::vec3(10.0f, 0.0f, -20.0f), glm::vec3(0.3f, 0.2f, -1.0f)),
+	};
+
+	// the padding tails, a single chunk and several chunks of the parallel path
+	const size_t counts[] = { 0, 1, 7, 8, 9, 1000, 16384 + 3, 100000 };
+
+	bool passed = true;
+
+	for (const glm::mat4& view : views)
+	{
+		const Frustum frustum = extractFrustum(projection * view);
+
+		for (size_t count : counts)
+		{
+			std::mt19937 random(static_cast<uint32_t>(count) + 1);
+			std::uniform_real_distribution<float> position(-250.0f, 250.0f);
+			std::uniform_real_distribution<float> radius(0.0f, 4.0f);
+			std::uniform_int_distribution<int> plane(0, 5);
+
+			SphereBounds bounds;
+			bounds.resize(count);
+			for (size_t i = 0; i < count; i++)
+			{
+				glm::vec3 center(position(random), position(random), position(random));
+				float sphereRadius = radius(random);
+
+				// every fourth sphere is moved onto a plane so it just touches it from outside, where the
+				// rounding of the paths has to agree for the visibility to match
+				if (i % 4 == 0)
+				{
+					const glm::vec4& touched = frustum.planes[plane(random)];
+					const glm::vec3 normal(touched);
+					center -= normal * (glm::dot(center, normal) + touched.w + sphereRadius);
+				}
+
+				bounds.set(i, center, sphereRadius);
+			}
+
+			std::vector<uint32_t> reference;
+			cullSpheres(frustum, bounds, reference, CullPath::Scalar);
+
+			// the scalar path against a double precision evaluation, spheres within rounding of a plane may go either way
+			size_t wrong = 0;
+			for (size_t i = 0; i < count; i++)
+			{
+				bool visible = true;
+				bool certain = true;
+				for (const glm::vec4& p : frustum.planes)
+				{
+					const double distance = double(bounds.centerX[i]) * p.x + double(bounds.centerY[i]) * p.y + double(bounds.centerZ[i]) * p.z + p.w;
+					const double margin = distance + bounds.radius[i];
+					visible &= margin >= 0.0;
+					certain &= std::fabs(margin) > 1e-3;
+				}
+
+				const bool found = std::binary_search(reference.begin(), reference.end(), static_cast<uint32_t>(i));
+				wrong += certain && found != visible ? 1 : 0;
+			}
+
+			if (wrong > 0)
+			{
+				std::cout << count << " spheres, scalar : " << wrong << " spheres culled wrongly\n";
+				passed = false;
+			}
+
+			for (CullPath path : { CullPath::Scalar, CullPath::SSE, CullPath::AVX2 })
+			{
+				if (!isPathSupported(path))
+				{
+					continue;
+				}
+
+				std::vector<uint32_t> visible;
+				cullSpheres(frustum, bounds, visible, path);
+				const bool matches = visible == reference;
+
+				cullSpheresParallel(frustum, bounds, visible, path);
+				const bool parallelMatches = visible == reference;
+
+				if (!matches || !parallelMatches)
+				{
+					std::cout << count << " spheres, " << getCullPathName(path) << " : " << (matches ? "" : "DIFFERS FROM SCALAR ")
+						<< (parallelMatches ? "" : "DIFFERS FROM SCALAR on the job system") << "\n";
+					passed = false;
+				}
+			}
+		}
+	}
+
+	std::cout << "Culling paths " << getCullPathName(CullPath::Scalar);
+	for (CullPath path : { CullPath::SSE, CullPath::AVX2 })
+	{
+		if (isPathSupported(path))
+		{
+			std::cout << ", " << getCullPathName(path);
+		}
+	}
+	std::cout << " : " << (passed ? "passed" : "FAILED") << "\n";
+
+	return passed;
+}
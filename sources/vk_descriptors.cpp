@@ -0,0 +1,81 @@
+#include "vk_descriptors.hpp"
+
+#include <algorithm>
+
+#include "vk_check.hpp"
+
+bool DescriptorLayoutCache::LayoutInfo::operator==(const LayoutInfo& other) const
+{
+	return std::equal(bindings.begin(), bindings.end(), other.bindings.begin(), other.bindings.end(),
+		[](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+			return a.binding == b.binding && a.descriptorType == b.descriptorType &&
+				a.descriptorCount == b.descriptorCount && a.stageFlags == b.stageFlags;
+		});
+}
+
+size_t DescriptorLayoutCache::LayoutHash::operator()(const LayoutInfo& info) const
+{
+	size_t hash = std::hash<size_t>()(info.bindings.size());
+
+	for (const VkDescriptorSetLayoutBinding& binding : info.bindings)
+	{
+		const uint64_t packed = binding.binding | uint64_t(binding.descriptorType) << 8 | uint64_t(binding.descriptorCount) << 16 | uint64_t(binding.stageFlags) << 32;
+		hash ^= std::hash<uint64_t>()(packed) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	}
+
+	return hash;
+}
+
+void DescriptorLayoutCache::init(VkDevice device)
+{
+	_device = device;
+}
+
+void DescriptorLayoutCache::cleanup()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	for (auto& [info, layout] : _layouts)
+	{
+		vkDestroyDescriptorSetLayout(_device, layout, nullptr);
+	}
+
+	_layouts.clear();
+}
+
+VkDescriptorSetLayout DescriptorLayoutCache::getLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	LayoutInfo info;
+	info.bindings = bindings;
+	std::sort(info.bindings.begin(), info.bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+		return a.binding < b.binding;
+		});
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto it = _layouts.find(info);
+	if (it != _layouts.end())
+	{
+		return it->second;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = nullptr;
+	layoutInfo.flags = 0;
+	layoutInfo.bindingCount = static_cast<uint32_t>(info.bindings.size());
+	layoutInfo.pBindings = info.bindings.data();
+
+	VkDescriptorSetLayout layout;
+	VK_CHECK(vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr, &layout));
+
+	_layouts[info] = layout;
+
+	return layout;
+}
+
+size_t DescriptorLayoutCache::getLayoutCount() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _layouts.size();
+}
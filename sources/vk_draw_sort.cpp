@@ -0,0 +1,72 @@
+#include "vk_draw_sort.hpp"
+
+#include <algorithm>
+
+uint64_t vkSort::makeDrawKey(uint32_t pipelineId, uint32_t descriptorId, uint32_t meshId, uint32_t depthBucket)
+{
+	return (uint64_t(pipelineId & 0xFFF) << PIPELINE_SHIFT)
+		| (uint64_t(descriptorId & 0xFFF) << DESCRIPTOR_SHIFT)
+		| (uint64_t(meshId & 0xFFFF) << MESH_SHIFT)
+		| (uint64_t(depthBucket & 0xFFFF) << DEPTH_SHIFT);
+}
+
+uint32_t vkSort::getDepthBucket(float depth, float maxDepth)
+{
+	float normalized = std::clamp(depth / maxDepth, 0.0f, 1.0f);
+	return static_cast<uint32_t>(normalized * 65535.0f);
+}
+
+void vkSort::radixSort(std::vector<DrawKey>& keys, std::vector<DrawKey>& scratch)
+{
+	const size_t count = keys.size();
+	if (count < 2)
+	{
+		return;
+	}
+
+	// one histogram per byte, filled in a single pass over the keys
+	uint32_t histograms[8][256] = {};
+	for (const DrawKey& drawKey : keys)
+	{
+		for (int pass = 0; pass < 8; pass++)
+		{
+			histograms[pass][(drawKey.key >> (pass * 8)) & 0xFF]++;
+		}
+	}
+
+	scratch.resize(count);
+
+	DrawKey* source = keys.data();
+	DrawKey* destination = scratch.data();
+
+	for (int pass = 0; pass < 8; pass++)
+	{
+		uint32_t* histogram = histograms[pass];
+		const int shift = pass * 8;
+
+		if (histogram[(source[0].key >> shift) & 0xFF] == count)
+		{
+			continue;
+		}
+
+		uint32_t offset = 0;
+		for (int digit = 0; digit < 256; digit++)
+		{
+			uint32_t digitCount = histogram[digit];
+			histogram[digit] = offset;
+			offset += digitCount;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			destination[histogram[(source[i].key >> shift) & 0xFF]++] = source[i];
+		}
+
+		std::swap(source, destination);
+	}
+
+	if (source != keys.data())
+	{
+		keys.swap(scratch);
+	}
+}
@@ -1,7 +1,12 @@
 #include "../includes/vk_engine.hpp"
 #include "../includes/vk_types.hpp"
+#include "../includes/vk_check.hpp"
 #include "../includes/vk_initializers.hpp"
 #include "../includes/vk_textures.hpp"
+#include "../includes/vk_task_graph.hpp"
+#include "../includes/vk_jobs.hpp"
+#include "../includes/vk_profiler.hpp"
+#include "../includes/vk_pipeline_cache.hpp"
 
 #include "../includes/VkBootstrap.h"
 
@@ -13,6 +18,9 @@
 #include <SDL2/SDL_vulkan.h>
 #include <fstream>
 #include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
 #include "vk_engine.hpp"
 
 #include "imgui.h"
@@ -20,25 +28,46 @@
 #include "backends/imgui_impl_vulkan.h"
 
 /*
-Define check macro
+Define VulkanEngine functions
 */
 
-#define VK_CHECK(res) vk_check(res, __FILE__, __LINE__)
+static const char* getPresentModeName(VkPresentModeKHR presentMode)
+{
+	switch (presentMode)
+	{
+	case VK_PRESENT_MODE_IMMEDIATE_KHR:
+		return "IMMEDIATE";
+	case VK_PRESENT_MODE_MAILBOX_KHR:
+		return "MAILBOX";
+	case VK_PRESENT_MODE_FIFO_KHR:
+		return "FIFO";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+		return "FIFO_RELAXED";
+	default:
+		return "unknown";
+	}
+}
 
-static void vk_check(VkResult result, const char* file, int line)
+bool VulkanEngine::isDeviceAvailable()
 {
-	if (result == VK_SUCCESS)
+	vkb::InstanceBuilder instanceBuilder;
+	auto instanceRef = instanceBuilder.set_app_name("Vulkan Sandbox")
+		.set_headless(true)
+		.require_api_version(1, 1, 0)
+		.build();
+
+	if (!instanceRef)
 	{
-		return;
+		return false;
 	}
 
-	printf("::VK_CHECK:: [%s] %d\n", file, line);
-	exit(1);
-}
+	vkb::PhysicalDeviceSelector deviceSelector{ instanceRef.value() };
+	const bool found = deviceSelector.set_minimum_version(1, 1).select().has_value();
 
-/*
-Define VulkanEngine functions
-*/
+	vkb::destroy_instance(instanceRef.value());
+
+	return found;
+}
 
 void VulkanEngine::initVulkan()
 {
@@ -48,7 +77,9 @@ void VulkanEngine::initVulkan()
 
 	vkb::InstanceBuilder instanceBuilder;
 
+	// headless instances skip the surface extensions, so no window system is needed at all
 	auto instanceRef = instanceBuilder.set_app_name("Vulkan Sandbox")
+		.set_headless(_headless)
 		.request_validation_layers(true)
 		.require_api_version(1, 1, 0)
 		.use_default_debug_messenger()
@@ -62,14 +93,47 @@ void VulkanEngine::initVulkan()
 	// ---------------------------------------------------------------------
 	// Physical Device & Device
 	// ---------------------------------------------------------------------
-	// create actual window to render
-	SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
-
 	vkb::PhysicalDeviceSelector deviceSelector{ vkbInstance };
-	vkb::PhysicalDevice physicalDevice = deviceSelector.set_minimum_version(1, 1)
-		.set_surface(_surface)
-		.select()
-		.value();
+	deviceSelector.set_minimum_version(1, 1)
+		.add_desired_extension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)
+		.add_desired_extension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+
+	// without a surface the selector drops the present and swapchain requirements, software ICDs
+	// such as lavapipe are accepted like any other device
+	if (!_headless)
+	{
+		// create actual window to render
+		SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
+		deviceSelector.set_surface(_surface);
+	}
+
+	vkb::PhysicalDevice physicalDevice = deviceSelector.select().value();
+
+	// the GPU driven path uses these when present and falls back or stays disabled otherwise
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice.physical_device, &supportedFeatures);
+	physicalDevice.features.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	physicalDevice.features.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+
+	std::vector<std::string> deviceExtensions = physicalDevice.get_extensions();
+	_drawIndirectCountSupported = std::find(deviceExtensions.begin(), deviceExtensions.end(), VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) != deviceExtensions.end();
+	_multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
+	_gpuDrivenSupported = supportedFeatures.drawIndirectFirstInstance == VK_TRUE && !_usePackedVertices;
+
+	// uploads signal a timeline semaphore when the device supports it and block on a fence otherwise
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_semaphore_features = {};
+	timeline_semaphore_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	timeline_semaphore_features.pNext = nullptr;
+
+	if (std::find(deviceExtensions.begin(), deviceExtensions.end(), VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) != deviceExtensions.end())
+	{
+		VkPhysicalDeviceFeatures2 features2 = {};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &timeline_semaphore_features;
+		vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &features2);
+	}
+
+	_timelineSemaphoreSupported = timeline_semaphore_features.timelineSemaphore == VK_TRUE;
 
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
 	VkPhysicalDeviceShaderDrawParametersFeatures shader_draw_parameters_features = {};
@@ -77,17 +141,42 @@ void VulkanEngine::initVulkan()
 	shader_draw_parameters_features.pNext = nullptr;
 	shader_draw_parameters_features.shaderDrawParameters = VK_TRUE;
 
+	deviceBuilder.add_pNext(&shader_draw_parameters_features);
+
+	if (_timelineSemaphoreSupported)
+	{
+		deviceBuilder.add_pNext(&timeline_semaphore_features);
+	}
+
 	vkb::Device vkbDevice = deviceBuilder
-		.add_pNext(&shader_draw_parameters_features)
 		.build()
 		.value();
 
 	_device = vkbDevice.device;
 	_physicalDevice = physicalDevice.physical_device;
 
+	if (_drawIndirectCountSupported)
+	{
+		_vkCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(_device, "vkCmdDrawIndexedIndirectCountKHR");
+		_drawIndirectCountSupported = _vkCmdDrawIndexedIndirectCount != nullptr;
+	}
+
 	_graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
 	_graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+	// vk-bootstrap creates one queue for every family, a transfer only family is used when present
+	auto transferQueue = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+	if (transferQueue.has_value())
+	{
+		_transferQueue = transferQueue.value();
+		_transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+	}
+	else
+	{
+		_transferQueue = _graphicsQueue;
+		_transferQueueFamily = _graphicsQueueFamily;
+	}
+
 	VmaAllocatorCreateInfo allocatorInfo = {};
 	allocatorInfo.physicalDevice = _physicalDevice;
 	allocatorInfo.device = _device;
@@ -97,10 +186,41 @@ void VulkanEngine::initVulkan()
 
 	_gpuProperties = vkbDevice.physical_device.properties;
 	std::cout << "GPU has a min buffer alignment of " << _gpuProperties.limits.minUniformBufferOffsetAlignment << "\n";
+
+	_uploadManager.init(_device, _allocator, _transferQueue, _transferQueueFamily, _graphicsQueueFamily, _timelineSemaphoreSupported,
+		_stagingRingSize, _gpuProperties.limits.optimalBufferCopyOffsetAlignment);
+
+	_mainDeleteionQueue.pushFunction([=]() {
+		_uploadManager.cleanup();
+		});
+
+	_pipelineCache = vkCache::loadPipelineCache(_device, _gpuProperties, _pipelineCachePath, _pipelineCacheLoadedSize);
+
+	_mainDeleteionQueue.pushFunction([=]() {
+		vkDestroyPipelineCache(_device, _pipelineCache, nullptr);
+		});
+
+	_pipelineRegistry.init(_device, _pipelineCache);
+
+	_mainDeleteionQueue.pushFunction([=]() {
+		_pipelineRegistry.cleanup();
+		});
+
+	_layoutCache.init(_device);
+
+	_mainDeleteionQueue.pushFunction([=]() {
+		_layoutCache.cleanup();
+		});
 }
 
 void VulkanEngine::initImgui()
 {
+	// the SDL backend needs a window, headless frames are drawn without the overlay
+	if (_headless)
+	{
+		return;
+	}
+
 	VkDescriptorPoolSize poolSizes[] =
 	{
 		{ VK_DESCRIPTOR_TYPE_SAMPLER, 1000 },
@@ -136,11 +256,16 @@ void VulkanEngine::initImgui()
 	initInfo.Device = _device;
 	initInfo.Queue = _graphicsQueue;
 	initInfo.DescriptorPool = imguiPool;
-	initInfo.MinImageCount = 3;
-	initInfo.ImageCount = 3;
+	// the backend checks MinImageCount >= 2
+	initInfo.MinImageCount = std::max(2u, _swapchainMinImageCount);
+	initInfo.ImageCount = static_cast<uint32_t>(_swapchainImages.size());
 	initInfo.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
+	initInfo.PipelineCache = _pipelineCache;
 
+	// the backend builds its pipeline in Init, the few other objects it creates there are counted along
+	auto pipelineStart = std::chrono::high_resolution_clock::now();
 	ImGui_ImplVulkan_Init(&initInfo, _renderpass);
+	_pipelineCreateMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - pipelineStart).count();
 
 	immediateSubmit([&](VkCommandBuffer cmd) {
 		ImGui_ImplVulkan_CreateFontsTexture(cmd);
@@ -156,23 +281,37 @@ void VulkanEngine::initImgui()
 
 void VulkanEngine::initSwapchain()
 {
-	vkb::SwapchainBuilder swapchainBuilder{ _physicalDevice, _device, _surface };
-	vkb::Swapchain vkbSwapchain = swapchainBuilder
-		.use_default_format_selection()
-		// strong vsync
-		.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
-		.set_desired_extent(_windowExtent.width, _windowExtent.height)
-		.build()
-		.value();
-
-	_swapchain = vkbSwapchain.swapchain;
-	_swapchainImages = vkbSwapchain.get_images().value();
-	_swapchainImageViews = vkbSwapchain.get_image_views().value();
-	_swapchainImageFormat = vkbSwapchain.image_format;
+	if (_headless)
+	{
+		initOffscreenTargets();
+	}
+	else
+	{
+		vkb::SwapchainBuilder swapchainBuilder{ _physicalDevice, _device, _surface };
+		vkb::Swapchain vkbSwapchain = swapchainBuilder
+			.use_default_format_selection()
+			// FIFO is always supported and gives strong vsync
+			.set_desired_present_mode(_presentMode)
+			.add_fallback_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+			.set_desired_min_image_count(_swapchainImageCount)
+			.set_desired_extent(_windowExtent.width, _windowExtent.height)
+			.build()
+			.value();
+
+		_swapchain = vkbSwapchain.swapchain;
+		_swapchainImages = vkbSwapchain.get_images().value();
+		_swapchainImageViews = vkbSwapchain.get_image_views().value();
+		_swapchainImageFormat = vkbSwapchain.image_format;
+		_swapchainPresentMode = vkbSwapchain.present_mode;
+		_swapchainMinImageCount = vkbSwapchain.requested_min_image_count;
+
+		std::cout << "Swapchain : " << _swapchainImages.size() << " images (min " << _swapchainMinImageCount << "), "
+			<< getPresentModeName(_swapchainPresentMode) << ", " << _frames.size() << " frames in flight\n";
 
-	_mainDeleteionQueue.pushFunction([=]() {
-		vkDestroySwapchainKHR(_device, _swapchain, nullptr);
-		});
+		_mainDeleteionQueue.pushFunction([=]() {
+			vkDestroySwapchainKHR(_device, _swapchain, nullptr);
+			});
+	}
 
 	VkExtent3D depthImageExtent = {
 		_windowExtent.width,
@@ -201,11 +340,57 @@ void VulkanEngine::initSwapchain()
 		});
 }
 
+void VulkanEngine::initOffscreenTargets()
+{
+	// the format use_default_format_selection picks on most surfaces, so both modes share the pipelines
+	_swapchainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+	_swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+	_swapchainMinImageCount = static_cast<uint32_t>(_frames.size());
+
+	VkExtent3D extent = { _windowExtent.width, _windowExtent.height, 1 };
+
+	VmaAllocationCreateInfo imageAllocInfo = {};
+	imageAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	imageAllocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	// one image per frame in flight, so a frame never renders into an image an earlier frame still reads
+	_offscreenImages.resize(_frames.size());
+	for (size_t i = 0; i < _offscreenImages.size(); i++)
+	{
+		VkImageCreateInfo imageInfo = vkInit::imageCreateInfo(_swapchainImageFormat,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, extent);
+
+		VK_CHECK(vmaCreateImage(_allocator, &imageInfo, &imageAllocInfo, &_offscreenImages[i]._image, &_offscreenImages[i]._allocation, nullptr));
+
+		VkImageViewCreateInfo viewInfo = vkInit::imageviewCreateInfo(_swapchainImageFormat, _offscreenImages[i]._image, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		VkImageView view;
+		VK_CHECK(vkCreateImageView(_device, &viewInfo, nullptr, &view));
+
+		_swapchainImages.push_back(_offscreenImages[i]._image);
+		_swapchainImageViews.push_back(view);
+
+		// the view goes with the framebuffer
+		_mainDeleteionQueue.pushFunction([=]() {
+			vmaDestroyImage(_allocator, _offscreenImages[i]._image, _offscreenImages[i]._allocation);
+			});
+	}
+
+	_readbackBuffer = createBuffer(size_t(_windowExtent.width) * _windowExtent.height * 4,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU, true);
+
+	_mainDeleteionQueue.pushFunction([=]() {
+		vmaDestroyBuffer(_allocator, _readbackBuffer._buffer, _readbackBuffer._allocation);
+		});
+
+	std::cout << "Headless : " << _offscreenImages.size() << " offscreen images, " << _frames.size() << " frames in flight\n";
+}
+
 void VulkanEngine::initCommands()
 {
 	VkCommandPoolCreateInfo commandPoolInfo = vkInit::commandPoolCreateInfo(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
-	for (int i = 0; i < FRAME_OVERLAP; i++)
+	for (size_t i = 0; i < _frames.size(); i++)
 	{
 		VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_frames[i]._commandPool));
 
@@ -213,9 +398,31 @@ void VulkanEngine::initCommands()
 
 		VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i]._mainCommandBuffer));
 
+		VkCommandBufferAllocateInfo overlayAllocInfo = vkInit::commandBufferAllocateInfo(_frames[i]._commandPool, 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+		VK_CHECK(vkAllocateCommandBuffers(_device, &overlayAllocInfo, &_frames[i]._overlayCommandBuffer));
+
 		_mainDeleteionQueue.pushFunction([=]() {
 			vkDestroyCommandPool(_device, _frames[i]._commandPool, nullptr);
 			});
+
+		// command pools are externally synchronized, so every slice gets its own and resets it as a whole
+		VkCommandPoolCreateInfo workerPoolInfo = vkInit::commandPoolCreateInfo(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		const uint32_t workerCount = std::max(1u, vkJobs::getGlobal().getThreadCount());
+
+		_frames[i]._workerCommandPools.resize(workerCount);
+		_frames[i]._workerCommandBuffers.resize(workerCount);
+
+		for (uint32_t w = 0; w < workerCount; w++)
+		{
+			VK_CHECK(vkCreateCommandPool(_device, &workerPoolInfo, nullptr, &_frames[i]._workerCommandPools[w]));
+
+			VkCommandBufferAllocateInfo workerAllocInfo = vkInit::commandBufferAllocateInfo(_frames[i]._workerCommandPools[w], 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+			VK_CHECK(vkAllocateCommandBuffers(_device, &workerAllocInfo, &_frames[i]._workerCommandBuffers[w]));
+
+			_mainDeleteionQueue.pushFunction([=]() {
+				vkDestroyCommandPool(_device, _frames[i]._workerCommandPools[w], nullptr);
+				});
+		}
 	}
 
 	VkCommandPoolCreateInfo uploadCommandPoolInfo = vkInit::commandPoolCreateInfo(_graphicsQueueFamily);
@@ -239,7 +446,8 @@ void VulkanEngine::initDefaultRenderpass()
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// PRESENT_SRC needs VK_KHR_swapchain, offscreen images are left ready for the readback copy
+	colorAttachment.finalLayout = _headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference colorAttachmentRef = {};
 	colorAttachmentRef.attachment = 0;
@@ -286,7 +494,16 @@ void VulkanEngine::initDefaultRenderpass()
 		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
 	depthDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
-	VkSubpassDependency dependencies[2] = { dependency, depthDependency };
+	// headless frames copy the color attachment right after the pass
+	VkSubpassDependency readbackDependency = {};
+	readbackDependency.srcSubpass = 0;
+	readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+	readbackDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	readbackDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	readbackDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	readbackDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	VkSubpassDependency dependencies[3] = { dependency, depthDependency, readbackDependency };
 
 	VkRenderPassCreateInfo renderPassInfo = {};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -294,7 +511,7 @@ void VulkanEngine::initDefaultRenderpass()
 	renderPassInfo.pAttachments = &attachments[0];
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 2;
+	renderPassInfo.dependencyCount = _headless ? 3 : 2;
 	renderPassInfo.pDependencies = &dependencies[0];
 
 	VK_CHECK(vkCreateRenderPass(_device, &renderPassInfo, nullptr, &_renderpass));
@@ -340,7 +557,7 @@ void VulkanEngine::initSyncStructures()
 	VkFenceCreateInfo fenceCreateInfo = vkInit::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
 	VkSemaphoreCreateInfo semaphoreCreateInfo = vkInit::semaphoreCreateInfo();
 
-	for (int i = 0; i < FRAME_OVERLAP; i++)
+	for (size_t i = 0; i < _frames.size(); i++)
 	{
 		VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_frames[i]._renderFence));
 
@@ -357,6 +574,26 @@ void VulkanEngine::initSyncStructures()
 			});
 	}
 
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	for (size_t i = 0; i < _frames.size(); i++)
+	{
+		_frames[i].gpuProfiler.init(_device, _gpuProperties, queueFamilies[_graphicsQueueFamily].timestampValidBits);
+
+		_mainDeleteionQueue.pushFunction([=]() {
+			_frames[i].gpuProfiler.cleanup();
+			});
+	}
+
+	_timestampsSupported = !_frames.empty() && _frames[0].gpuProfiler.isSupported();
+	if (!_timestampsSupported)
+	{
+		std::cout << "GPU timestamps are not supported on the graphics queue, GPU times are unavailable\n";
+	}
+
 	VkFenceCreateInfo uploadFenceCreateInfo = vkInit::fenceCreateInfo();
 	VK_CHECK(vkCreateFence(_device, &uploadFenceCreateInfo, nullptr, &_uploadContext.uploadFence));
 	_mainDeleteionQueue.pushFunction([=]() {
@@ -447,39 +684,69 @@ void VulkanEngine::initPipelines()
 	// ---------------------------------------------------------------------------------------------------------------
 	VkPipelineLayoutCreateInfo meshPipelineLayoutInfo = vkInit::pipelineLayoutCreateInfo();
 
-	VkPushConstantRange pushConstant;
-	pushConstant.offset = 0;
-	pushConstant.size = sizeof(MeshPushConstants);
-	pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	// the range is the shader's block, the draws push the whole MeshPushConstants from the vertex stage
+	// so anything else would make every vkCmdPushConstants invalid, as fatal as a VK_CHECK
+	const VkPushConstantRange pushConstant = _meshReflection.pushConstants;
+	if (pushConstant.offset != 0 || pushConstant.size != sizeof(MeshPushConstants) || pushConstant.stageFlags != VK_SHADER_STAGE_VERTEX_BIT)
+	{
+		std::cout << "The mesh shaders' push constants (offset " << pushConstant.offset << ", " << pushConstant.size
+			<< " bytes) do not match MeshPushConstants (" << sizeof(MeshPushConstants) << " bytes) or are not read by the vertex stage alone\n";
+		exit(1);
+	}
 
 	meshPipelineLayoutInfo.pPushConstantRanges = &pushConstant;
 	meshPipelineLayoutInfo.pushConstantRangeCount = 1;
 
-	VkDescriptorSetLayout setLayouts[] = { _globalSetLayout, _objectSetLayout, _singleTextureSetLayout };
+	// the same bindings give the same layouts init_descriptors allocated the sets with
+	std::vector<VkDescriptorSetLayout> setLayouts;
+	for (uint32_t set = 0; set < vkReflect::getSetCount(_meshReflection); set++)
+	{
+		setLayouts.push_back(_layoutCache.getLayout(vkReflect::getSetBindings(_meshReflection, set)));
+	}
 
-	meshPipelineLayoutInfo.setLayoutCount = 3;
-	meshPipelineLayoutInfo.pSetLayouts = setLayouts;
+	meshPipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+	meshPipelineLayoutInfo.pSetLayouts = setLayouts.data();
 
 	VK_CHECK(vkCreatePipelineLayout(_device, &meshPipelineLayoutInfo, nullptr, &_meshPipelineLayout));
 
-	VertexInputDescription vertexDescription = Vertex::getVertexDescription();
+	VertexInputDescription vertexDescription = _usePackedVertices ? getVertexDescription<PackedVertex>() : getVertexDescription<Vertex>();
+
+	// attributes the vertex shader does not read are dropped
+	std::vector<VkVertexInputAttributeDescription> attributes;
+	for (const VkVertexInputAttributeDescription& attribute : vertexDescription.attributes)
+	{
+		if (std::any_of(_meshReflection.inputs.begin(), _meshReflection.inputs.end(), [&](const vkReflect::VertexInput& input) { return input.location == attribute.location; }))
+		{
+			attributes.push_back(attribute);
+		}
+	}
+
+	for (const vkReflect::VertexInput& input : _meshReflection.inputs)
+	{
+		if (std::none_of(attributes.begin(), attributes.end(), [&](const VkVertexInputAttributeDescription& attribute) { return attribute.location == input.location; }))
+		{
+			std::cout << "The mesh vertex shader reads location " << input.location << " (" << input.name << "), which the vertex format does not have\n";
+		}
+	}
 
-	pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = vertexDescription.attributes.data();
-	pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = vertexDescription.attributes.size();
+	pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = attributes.data();
+	pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = attributes.size();
 
 	pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = vertexDescription.bindings.data();
 	pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = vertexDescription.bindings.size();
 
 	pipelineBuilder._shaderStages.clear();
 
+	const char* meshVertShaderPath = getMeshVertShaderPath();
+
 	VkShaderModule meshVertShader;
-	if (!loadShaderModule("shaders/triangle_mesh_vert.spv", meshVertShader))
+	if (!loadShaderModule(meshVertShaderPath, meshVertShader))
 	{
-		std::cout << "Error building triangle_mesh_vert.spv shader\n";
+		std::cout << "Error building " << meshVertShaderPath << " shader\n";
 	}
 	else
 	{
-		std::cout << "triangle_mesh_vert.spv is loaded\n";
+		std::cout << meshVertShaderPath << " is loaded\n";
 	}
 
 	VkShaderModule meshFragShader;
@@ -505,25 +772,29 @@ void VulkanEngine::initPipelines()
 		true, true, VK_COMPARE_OP_LESS_OR_EQUAL
 	);
 
-	_meshPipeline = pipelineBuilder.buildPipeline(_device, _renderpass);
+	auto pipelineStart = std::chrono::high_resolution_clock::now();
+	std::vector<PipelineKey> pipelineKeys = _pipelineRegistry.buildBatch({ pipelineBuilder }, _renderpass);
+	_pipelineCreateMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - pipelineStart).count();
 
-	createMaterial(_meshPipeline, _meshPipelineLayout, "texturedmesh");
+	createMaterial(pipelineKeys[0], _meshPipelineLayout, "texturedmesh");
 
-	vkDestroyShaderModule(_device, redTriangleVertShader, nullptr);
-	vkDestroyShaderModule(_device, redTriangleFragShader, nullptr);
-	vkDestroyShaderModule(_device, triangleVertShader, nullptr);
-	vkDestroyShaderModule(_device, triangleFragShader, nullptr);
-	vkDestroyShaderModule(_device, meshVertShader, nullptr);
-	vkDestroyShaderModule(_device, meshFragShader, nullptr);
+	vkReflect::ShaderReflection meshLayout = _meshReflection;
+	meshLayout.pushConstants = pushConstant;
+	_reloadableMaterials["texturedmesh"] = { { meshVertShaderPath, "shaders/triangle_mesh_frag.spv" }, pipelineKeys[0], meshLayout };
 
-	_mainDeleteionQueue.pushFunction([=]() {
-		vkDestroyPipeline(_device, _meshPipeline, nullptr);
+	destroyShaderModule(redTriangleVertShader);
+	destroyShaderModule(redTriangleFragShader);
+	destroyShaderModule(triangleVertShader);
+	destroyShaderModule(triangleFragShader);
+	destroyShaderModule(meshVertShader);
+	destroyShaderModule(meshFragShader);
 
+	_mainDeleteionQueue.pushFunction([=]() {
 		vkDestroyPipelineLayout(_device, _meshPipelineLayout, nullptr);
 		});
 }
 
-bool VulkanEngine::loadShaderModule(const char* path, VkShaderModule& outShaderModule)
+static bool readShaderCode(const char* path, std::vector<uint32_t>& outBuffer)
 {
 	std::ifstream file(path, std::ios::ate | std::ios::binary);
 
@@ -535,12 +806,29 @@ bool VulkanEngine::loadShaderModule(const char* path, VkShaderModule& outShaderM
 
 	size_t fileSize = (size_t)file.tellg();
 
-	std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+	outBuffer.resize(fileSize / sizeof(uint32_t));
 
 	file.seekg(0);
-	file.read((char*)buffer.data(), fileSize);
+	file.read((char*)outBuffer.data(), fileSize);
 	file.close();
 
+	return true;
+}
+
+bool VulkanEngine::loadShaderModule(const char* path, VkShaderModule& outShaderModule, vkReflect::ShaderReflection* outReflection)
+{
+	std::vector<uint32_t> buffer;
+	if (!readShaderCode(path, buffer))
+	{
+		return false;
+	}
+
+	if (outReflection != nullptr && !vkReflect::reflectShader(buffer.data(), buffer.size(), *outReflection))
+	{
+		std::cout << "Cannot reflect " << path << "\n";
+		return false;
+	}
+
 	VkShaderModuleCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	createInfo.pNext = nullptr;
@@ -554,227 +842,993 @@ bool VulkanEngine::loadShaderModule(const char* path, VkShaderModule& outShaderM
 		return false;
 	}
 
+	_pipelineRegistry.registerShaderModule(shaderModule, buffer.data(), buffer.size());
+
 	outShaderModule = shaderModule;
 	return true;
 }
 
-void VulkanEngine::loadMeshes()
+void VulkanEngine::destroyShaderModule(VkShaderModule module)
 {
-	_triangleMesh._vertices.resize(3);
+	_pipelineRegistry.unregisterShaderModule(module);
+	vkDestroyShaderModule(_device, module, nullptr);
+}
 
-	_triangleMesh._vertices[0].position = { 1.f, 1.f, 0.0f };
-	_triangleMesh._vertices[1].position = { -1.f, 1.f, 0.0f };
-	_triangleMesh._vertices[2].position = { 0.f,-1.f, 0.0f };
+bool VulkanEngine::reflectShaders(const std::vector<const char*>& paths, vkReflect::ShaderReflection& outReflection)
+{
+	outReflection = {};
 
-	_triangleMesh._vertices[0].color = { 0.42f, 0.523f, 0.123f };
-	_triangleMesh._vertices[1].color = { 0.42f, 0.523f, 0.123f };
-	_triangleMesh._vertices[2].color = { 0.42f, 0.523f, 0.123f };
+	for (const char* path : paths)
+	{
+		std::vector<uint32_t> buffer;
+		vkReflect::ShaderReflection stage;
+		if (!readShaderCode(path, buffer) || !vkReflect::reflectShader(buffer.data(), buffer.size(), stage))
+		{
+			std::cout << "Cannot reflect " << path << "\n";
+			return false;
+		}
+
+		if (!vkReflect::mergeReflection(outReflection, stage))
+		{
+			return false;
+		}
+	}
 
-	_modelMesh.loadFromObj("models/monkey_smooth.obj");
+	return true;
+}
 
-	Mesh lostEmpire{};
-	lostEmpire.loadFromObj("assets/lost_empire.obj");
+const char* VulkanEngine::getMeshVertShaderPath() const
+{
+	return _usePackedVertices ? "shaders/triangle_mesh_packed_vert.spv" : "shaders/triangle_mesh_vert.spv";
+}
 
-	uploadMesh(_triangleMesh);
-	uploadMesh(_modelMesh);
-	uploadMesh(lostEmpire);
+void VulkanEngine::initShaderReload()
+{
+	_shaderReloader.addDirectory("shaders");
+	// the PackedVertex variant, the same extra rule the build has
+	_shaderReloader.addShader("shaders/triangle_mesh.vert", "shaders/triangle_mesh_packed_vert.spv", "-DPACKED_VERTEX");
 
-	_meshes["monkey"] = _modelMesh;
-	_meshes["triangle"] = _triangleMesh;
-	_meshes["empire"] = lostEmpire;
+	if (_shaderReloader.start("shaders", [this](const std::vector<std::string>& spirvPaths) { rebuildPipelines(spirvPaths); }))
+	{
+		std::cout << "Watching shaders/ for changes\n";
+	}
 }
 
-void VulkanEngine::uploadMesh(Mesh& mesh)
+void VulkanEngine::rebuildPipelines(const std::vector<std::string>& spirvPaths)
 {
-	const size_t bufferSize = mesh._vertices.size() * sizeof(Vertex);
+	for (auto& [name, material] : _reloadableMaterials)
+	{
+		const bool affected = std::any_of(material.shaderPaths.begin(), material.shaderPaths.end(), [&](const std::string& path) {
+			return std::find(spirvPaths.begin(), spirvPaths.end(), path) != spirvPaths.end();
+			});
 
-	VkBufferCreateInfo stagingBufferInfo = {};
-	stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	stagingBufferInfo.pNext = nullptr;
-	stagingBufferInfo.size = bufferSize;
-	stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		if (!affected)
+		{
+			continue;
+		}
 
-	/*
-	VkBufferCreateInfo bufferInfo = {};
-	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bufferInfo.size = mesh._vertices.size() * sizeof(Vertex);
-	bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-	VmaAllocationCreateInfo vmaallocInfo = {};
-	vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-	*/
+		auto start = std::chrono::high_resolution_clock::now();
 
-	VmaAllocationCreateInfo vmaallocInfo = {};
-	vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+		std::vector<VkShaderModule> modules;
+		vkReflect::ShaderReflection reflection;
+		bool compatible = true;
+		for (const std::string& path : material.shaderPaths)
+		{
+			VkShaderModule module;
+			vkReflect::ShaderReflection stage;
+			if (!loadShaderModule(path.c_str(), module, &stage))
+			{
+				break;
+			}
 
-	AllocatedBuffer stagingBuffer;
+			modules.push_back(module);
+			compatible = vkReflect::mergeReflection(reflection, stage) && compatible;
+		}
 
-	VK_CHECK(vmaCreateBuffer(
-		_allocator,
-		&stagingBufferInfo,
-		&vmaallocInfo,
-		&stagingBuffer._buffer,
-		&stagingBuffer._allocation,
-		nullptr
-	));
+		// the layout stays, a shader declaring something it does not provide would read garbage
+		if (modules.size() == material.shaderPaths.size() && !vkReflect::isCompatible(reflection, material.layout))
+		{
+			compatible = false;
+			std::cout << "The " << name << " shaders no longer match their pipeline layout\n";
+		}
 
-	void* data;
-	vmaMapMemory(_allocator, stagingBuffer._allocation, &data);
-	memcpy(data, mesh._vertices.data(), mesh._vertices.size() * sizeof(Vertex));
-	vmaUnmapMemory(_allocator, stagingBuffer._allocation);
+		PipelineKey key = 0;
+		if (modules.size() == material.shaderPaths.size() && compatible)
+		{
+			key = _pipelineRegistry.requestVariant(material.pipelineKey, modules);
+			// on this thread only, the job system threads belong to the frames
+			_pipelineRegistry.buildPending(false);
+		}
 
-	VkBufferCreateInfo vertexBufferInfo = {};
-	vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	vertexBufferInfo.pNext = nullptr;
-	vertexBufferInfo.size = bufferSize;
-	vertexBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		for (VkShaderModule module : modules)
+		{
+			destroyShaderModule(module);
+		}
 
-	vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+		// the same code as before keeps its key
+		if (key == material.pipelineKey)
+		{
+			continue;
+		}
 
-	VK_CHECK(vmaCreateBuffer(_allocator, &vertexBufferInfo, &vmaallocInfo, &mesh._vertexBuffer._buffer, &mesh._vertexBuffer._allocation, nullptr));
+		if (key == 0 || _pipelineRegistry.get(key) == VK_NULL_HANDLE)
+		{
+			_pipelineRegistry.remove(key);
+			std::cout << "Failed to rebuild the " << name << " pipeline, keeping the old one\n";
+			continue;
+		}
 
-	immediateSubmit([=](VkCommandBuffer cmd) {
-		VkBufferCopy copy;
-		copy.dstOffset = 0;
-		copy.srcOffset = 0;
-		copy.size = bufferSize;
-		vkCmdCopyBuffer(cmd, stagingBuffer._buffer, mesh._vertexBuffer._buffer, 1, &copy);
-		});
+		material.pipelineKey = key;
 
-	_mainDeleteionQueue.pushFunction([=]() {
-		vmaDestroyBuffer(_allocator, mesh._vertexBuffer._buffer, mesh._vertexBuffer._allocation);
-		});
+		{
+			std::lock_guard<std::mutex> lock(_reloadMutex);
+			_reloadedPipelines.push_back({ name, key });
+		}
 
-	vmaDestroyBuffer(_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+		printf("Rebuilt the %s pipeline in %.1f ms\n", name.c_str(),
+			std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+	}
 }
 
-Material* VulkanEngine::createMaterial(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name)
+void VulkanEngine::applyReloadedPipelines()
 {
-	Material mat;
-	mat.pipeline = pipeline;
-	mat.pipelineLayout = layout;
-	_materials[name] = mat;
+	std::vector<std::pair<std::string, PipelineKey>> reloaded;
+	{
+		std::lock_guard<std::mutex> lock(_reloadMutex);
+		reloaded.swap(_reloadedPipelines);
+	}
 
-	return &_materials[name];
-}
+	for (const auto& [name, key] : reloaded)
+	{
+		Material& material = _materials[name];
+		const PipelineKey oldKey = material.pipelineKey;
 
-Material* VulkanEngine::getMaterial(const std::string& name)
-{
-	auto it = _materials.find(name);
-	if (it == _materials.end())
+		material.pipeline = _pipelineRegistry.get(key);
+		material.pipelineKey = key;
+
+		// another material may still draw with the old pipeline
+		const bool shared = std::any_of(_materials.begin(), _materials.end(), [&](const auto& other) {
+			return other.second.pipelineKey == oldKey;
+			});
+
+		if (!shared)
+		{
+			_retiredPipelines.push_back({ _pipelineRegistry.remove(oldKey), _framenumber, static_cast<uint32_t>(_frames.size()) });
+		}
+	}
+
+	if (!reloaded.empty())
 	{
-		return nullptr;
+		assignSortIds();
 	}
 
-	return &(*it).second;
+	// frames finish in order and every draw waits on the frame _frames.size() before it, so when this
+	// frame starts every frame up to _framenumber - _frames.size() - 1 finished, the count the pipeline
+	// was retired with is kept as well so a count changed since then never shortens the wait
+	auto it = std::remove_if(_retiredPipelines.begin(), _retiredPipelines.end(), [&](const RetiredPipeline& retired) {
+		const size_t framesInFlight = std::max<size_t>(retired.framesInFlight, _frames.size());
+		if (retired.frame + framesInFlight > _framenumber)
+		{
+			return false;
+		}
+
+		vkDestroyPipeline(_device, retired.pipeline, nullptr);
+		return true;
+		});
+	_retiredPipelines.erase(it, _retiredPipelines.end());
 }
 
-Mesh* VulkanEngine::getMesh(const std::string& name)
+void VulkanEngine::parseMesh(const char* path, Mesh& outMesh)
 {
-	auto it = _meshes.find(name);
-	if (it == _meshes.end())
+	outMesh.loadFromObjCached(path);
+
+	if (_usePackedVertices)
 	{
-		return nullptr;
+		outMesh.packVertices();
+		std::cout << "Packed vertices : " << outMesh.getVertexCount() * sizeof(Vertex) << " -> "
+			<< outMesh.getVertexCount() * sizeof(PackedVertex) << " bytes\n";
 	}
-
-	return &(*it).second;
 }
 
-void VulkanEngine::drawObjects(VkCommandBuffer cmd, RenderObject* first, int count)
+void VulkanEngine::loadMeshes()
 {
-	glm::mat4 view = glm::translate(glm::mat4{ 1.0f }, _camPos);
-	glm::mat4 projection = glm::perspective(
-		glm::radians(70.0f), 1700.0f / 900.0f, 0.1f, 200.0f
-	);
-	projection[1][1] *= -1;
-
-	float framed = (_framenumber / 120.0f);
-	_sceneParameters.ambientColor = { std::sin(framed), 0.0f, std::cos(framed), 1.0f };
+	_triangleMesh._vertices.resize(3);
 
-	char* sceneData;
-	vmaMapMemory(_allocator, _sceneParameterBuffer._allocation, (void**)&sceneData);
+	_triangleMesh._vertices[0].position = { 1.f, 1.f, 0.0f };
+	_triangleMesh._vertices[1].position = { -1.f, 1.f, 0.0f };
+	_triangleMesh._vertices[2].position = { 0.f,-1.f, 0.0f };
 
-	int frameIndex = _framenumber % FRAME_OVERLAP;
+	_triangleMesh._vertices[0].color = { 0.42f, 0.523f, 0.123f };
+	_triangleMesh._vertices[1].color = { 0.42f, 0.523f, 0.123f };
+	_triangleMesh._vertices[2].color = { 0.42f, 0.523f, 0.123f };
+
+	_triangleMesh._indices = { 0, 1, 2 };
+	_triangleMesh.computeBounds();
+
+	if (_usePackedVertices)
+	{
+		_triangleMesh.packVertices();
+	}
+
+	// _modelMesh and _empireMesh were filled by parseMesh
+	uploadMesh(_triangleMesh);
+	uploadMesh(_modelMesh);
+	uploadMesh(_empireMesh);
+
+	_meshes["monkey"] = _modelMesh;
+	_meshes["triangle"] = _triangleMesh;
+	_meshes["empire"] = _empireMesh;
+
+	uploadMegaBuffer();
 
-	sceneData += padUniformBufferSize(sizeof(GPUSceneData)) * frameIndex;
-	memcpy(sceneData, &_sceneParameters, sizeof(GPUSceneData));
-	vmaUnmapMemory(_allocator, _sceneParameterBuffer._allocation);
+	// every mesh copy above goes out in one submission, the first frame waits for it on the GPU
+	_uploadManager.flush();
+}
+
+UploadTicket VulkanEngine::uploadMesh(Mesh& mesh)
+{
+	const size_t vertexBufferSize = mesh.getVertexCount() * mesh.getVertexStride();
+	const size_t indexBufferSize = mesh.getIndexCount() * mesh.getIndexSize();
+
+	VkBufferCreateInfo vertexBufferInfo = {};
+	vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	vertexBufferInfo.pNext = nullptr;
+	vertexBufferInfo.size = vertexBufferSize;
+	vertexBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	VK_CHECK(vmaCreateBuffer(_allocator, &vertexBufferInfo, &vmaallocInfo, &mesh._vertexBuffer._buffer, &mesh._vertexBuffer._allocation, nullptr));
+
+	VkBufferCreateInfo indexBufferInfo = vertexBufferInfo;
+	indexBufferInfo.size = indexBufferSize;
+	indexBufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	VK_CHECK(vmaCreateBuffer(_allocator, &indexBufferInfo, &vmaallocInfo, &mesh._indexBuffer._buffer, &mesh._indexBuffer._allocation, nullptr));
+
+	// a cached mesh is copied straight from its mapping into the staging memory
+	_uploadManager.uploadBuffer(mesh._vertexBuffer._buffer, 0,
+		mesh.isPacked() ? (const void*)mesh._packedVertices.data() : (const void*)mesh.getVertexData(), vertexBufferSize,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+	const uint32_t* indices = mesh.getIndexData();
+	UploadTicket ticket;
+
+	if (mesh.getIndexType() == VK_INDEX_TYPE_UINT16)
+	{
+		// chunks are split at even byte offsets, so every chunk holds whole indices
+		ticket = _uploadManager.uploadBuffer(mesh._indexBuffer._buffer, 0, indexBufferSize, [&](void* staging, size_t offset, size_t size) {
+			uint16_t* indexData = (uint16_t*)staging;
+			const uint32_t* source = indices + offset / sizeof(uint16_t);
+			for (size_t i = 0; i < size / sizeof(uint16_t); i++)
+			{
+				indexData[i] = static_cast<uint16_t>(source[i]);
+			}
+			}, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+	}
+	else
+	{
+		ticket = _uploadManager.uploadBuffer(mesh._indexBuffer._buffer, 0, indices, indexBufferSize,
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+	}
+
+	AllocatedBuffer vertexBuffer = mesh._vertexBuffer;
+	AllocatedBuffer indexBuffer = mesh._indexBuffer;
+
+	_mainDeleteionQueue.pushFunction([=]() {
+		vmaDestroyBuffer(_allocator, vertexBuffer._buffer, vertexBuffer._allocation);
+		vmaDestroyBuffer(_allocator, indexBuffer._buffer, indexBuffer._allocation);
+		});
+
+	return ticket;
+}
+
+Material* VulkanEngine::createMaterial(PipelineKey pipeline, VkPipelineLayout layout, const std::string& name)
+{
+	Material mat;
+	mat.pipeline = _pipelineRegistry.get(pipeline);
+	mat.pipelineKey = pipeline;
+	mat.pipelineLayout = layout;
+	_materials[name] = mat;
+
+	return &_materials[name];
+}
+
+Material* VulkanEngine::getMaterial(const std::string& name)
+{
+	auto it = _materials.find(name);
+	if (it == _materials.end())
+	{
+		return nullptr;
+	}
+
+	return &(*it).second;
+}
+
+Mesh* VulkanEngine::getMesh(const std::string& name)
+{
+	auto it = _meshes.find(name);
+	if (it == _meshes.end())
+	{
+		return nullptr;
+	}
+
+	return &(*it).second;
+}
+
+GPUCameraData VulkanEngine::getCameraData() const
+{
+	glm::mat4 view = glm::translate(glm::mat4{ 1.0f }, _camPos);
+	view = glm::rotate(glm::mat4{ 1.0f }, glm::radians(_camYaw), glm::vec3(0.0f, 1.0f, 0.0f)) * view;
+	view = glm::rotate(glm::mat4{ 1.0f }, glm::radians(_camPitch), glm::vec3(1.0f, 0.0f, 0.0f)) * view;
+	glm::mat4 projection = glm::perspective(
+		glm::radians(70.0f), 1700.0f / 900.0f, 0.1f, 200.0f
+	);
+	projection[1][1] *= -1;
 
 	GPUCameraData camData;
 	camData.proj = projection;
 	camData.view = view;
 	camData.viewproj = projection * view;
 
-	void* data;
-	vmaMapMemory(_allocator, getCurrentFrame().cameraBuffer._allocation, &data);
-	memcpy(data, &camData, sizeof(GPUCameraData));
-	vmaUnmapMemory(_allocator, getCurrentFrame().cameraBuffer._allocation);
+	return camData;
+}
+
+double VulkanEngine::getDeviceMemoryUsage() const
+{
+	const VkPhysicalDeviceMemoryProperties* memoryProperties = nullptr;
+	vmaGetMemoryProperties(_allocator, &memoryProperties);
+
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetHeapBudgets(_allocator, budgets);
 
-	void* objectData;
-	vmaMapMemory(_allocator, getCurrentFrame().objectBuffer._allocation, &objectData);
+	VkDeviceSize usage = 0;
+	for (uint32_t heap = 0; heap < memoryProperties->memoryHeapCount; heap++)
+	{
+		usage += budgets[heap].usage;
+	}
+
+	return usage / (1024.0 * 1024.0);
+}
+
+void VulkanEngine::updateRenderableBounds()
+{
+	_renderableBounds.resize(_renderables.size());
+
+	for (size_t i = 0; i < _renderables.size(); i++)
+	{
+		const RenderObject& object = _renderables[i];
+		const Submesh& submesh = object.mesh->_submeshes[object.submeshIndex];
+
+		glm::vec3 center;
+		float radius;
+		vkCull::transformSphere(object.transformMatrix, submesh.sphereCenter, submesh.sphereRadius, center, radius);
+
+		_renderableBounds.set(i, center, radius);
+	}
+}
+
+void VulkanEngine::cullRenderables(const glm::mat4& viewProj)
+{
+	VK_PROFILE_FUNCTION();
 
-	GPUObjectData* objectSSBO = (GPUObjectData*)objectData;
+	auto start = std::chrono::high_resolution_clock::now();
+
+	if (_renderableBounds.count != _renderables.size())
+	{
+		updateRenderableBounds();
+	}
+
+	vkCull::cullSpheresParallel(vkCull::extractFrustum(viewProj), _renderableBounds, _visibleRenderables);
+
+	_cullTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void VulkanEngine::assignSortIds()
+{
+	std::unordered_map<VkPipeline, uint32_t> pipelineIds;
+	std::unordered_map<VkDescriptorSet, uint32_t> descriptorIds;
 
-	for (int i = 0; i < count; i++)
+	for (auto& [name, material] : _materials)
 	{
-		RenderObject& object = first[i];
-		objectSSBO[i].modelMatrix = object.transformMatrix;
+		material.pipelineSortId = pipelineIds.try_emplace(material.pipeline, static_cast<uint32_t>(pipelineIds.size())).first->second;
+		material.descriptorSortId = descriptorIds.try_emplace(material.textureSet, static_cast<uint32_t>(descriptorIds.size())).first->second;
 	}
 
-	vmaUnmapMemory(_allocator, getCurrentFrame().objectBuffer._allocation);
+	uint32_t meshId = 0;
+	for (auto& [name, mesh] : _meshes)
+	{
+		mesh._sortId = meshId++;
+	}
+}
+
+void VulkanEngine::sortRenderables(const glm::vec3& eye)
+{
+	VK_PROFILE_FUNCTION();
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	const float maxDepth = 200.0f;
+
+	_drawKeys.resize(_visibleRenderables.size());
+
+	for (size_t v = 0; v < _visibleRenderables.size(); v++)
+	{
+		const uint32_t i = _visibleRenderables[v];
+		const RenderObject& object = _renderables[i];
+
+		glm::vec3 center(_renderableBounds.centerX[i], _renderableBounds.centerY[i], _renderableBounds.centerZ[i]);
+		uint32_t depthBucket = vkSort::getDepthBucket(glm::length(center - eye), maxDepth);
+
+		uint32_t pipelineId = object.material ? object.material->pipelineSortId : 0;
+		uint32_t descriptorId = object.material ? object.material->descriptorSortId : 0;
+
+		_drawKeys[v].key = vkSort::makeDrawKey(pipelineId, descriptorId, object.mesh->_sortId, depthBucket);
+		_drawKeys[v].index = i;
+	}
+
+	vkSort::radixSort(_drawKeys, _drawKeyScratch);
+
+	_drawOrder.resize(_drawKeys.size());
+	for (size_t d = 0; d < _drawKeys.size(); d++)
+	{
+		_drawOrder[d] = _drawKeys[d].index;
+	}
+
+	_sortTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void VulkanEngine::uploadFrameUniforms()
+{
+	VK_PROFILE_FUNCTION();
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	float framed = (_framenumber / 120.0f);
+	_sceneParameters.ambientColor = { std::sin(framed), 0.0f, std::cos(framed), 1.0f };
+
+	size_t frameIndex = _framenumber % _frames.size();
+
+	const size_t sceneOffset = padUniformBufferSize(sizeof(GPUSceneData)) * frameIndex;
+	memcpy((char*)_sceneParameterBuffer._mapped + sceneOffset, &_sceneParameters, sizeof(GPUSceneData));
+	flushBuffer(_sceneParameterBuffer, sceneOffset, sizeof(GPUSceneData));
+
+	*getCurrentFrame().cameraData = getCameraData();
+	flushBuffer(getCurrentFrame().cameraBuffer, 0, sizeof(GPUCameraData));
+
+	_uploadTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void VulkanEngine::drawObjects(VkCommandBuffer cmd, VkFramebuffer framebuffer, RenderObject* first, const uint32_t* order, size_t drawCount)
+{
+	VK_PROFILE_FUNCTION();
+
+	FrameData& frame = getCurrentFrame();
+
+	// the object buffer holds MAX_OBJECTS entries, the draws past it are dropped
+	if (drawCount > MAX_OBJECTS)
+	{
+		if (!_objectLimitWarned)
+		{
+			std::cout << drawCount << " visible objects, only the first " << MAX_OBJECTS << " are drawn\n";
+			_objectLimitWarned = true;
+		}
+
+		drawCount = MAX_OBJECTS;
+	}
+
+	auto uploadStart = std::chrono::high_resolution_clock::now();
+
+	GPUObjectData* objectSSBO = frame.objectData;
+
+	// slots follow the draw order so an instanced run reads contiguous objects
+	vkJobs::parallelFor(drawCount, 4096, [&](size_t begin, size_t end) {
+		for (size_t d = begin; d < end; d++)
+		{
+			RenderObject& object = first[order[d]];
+			objectSSBO[d].modelMatrix = object.transformMatrix;
+		}
+	});
+
+	flushBuffer(frame.objectBuffer, 0, sizeof(GPUObjectData) * drawCount);
+
+	_uploadTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - uploadStart).count();
+
+	auto recordStart = std::chrono::high_resolution_clock::now();
+
+	// below a few hundred draws per slice the secondaries cost more than they save
+	const size_t minDrawsPerSlice = 256;
+	const uint32_t threadCount = _recordThreadCount != 0 ? _recordThreadCount : vkJobs::getGlobal().getThreadCount();
+	const size_t sliceCount = std::max<size_t>(1, std::min<size_t>({ threadCount, frame._workerCommandPools.size(), drawCount / minDrawsPerSlice }));
+
+	std::vector<vkSort::DrawStats> sliceStats(sliceCount);
+
+	vkJobs::parallelFor(sliceCount, 1, [&](size_t begin, size_t end) {
+		for (size_t slice = begin; slice < end; slice++)
+		{
+			VK_CHECK(vkResetCommandPool(_device, frame._workerCommandPools[slice], 0));
+
+			VkCommandBuffer secondary = frame._workerCommandBuffers[slice];
+			beginSecondary(secondary, framebuffer);
+			recordObjects(secondary, first, order, drawCount * slice / sliceCount, drawCount * (slice + 1) / sliceCount, sliceStats[slice]);
+			VK_CHECK(vkEndCommandBuffer(secondary));
+		}
+	});
+
+	// executed in slice order, so the sorted order survives the split
+	vkCmdExecuteCommands(cmd, static_cast<uint32_t>(sliceCount), frame._workerCommandBuffers.data());
+
+	_recordTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - recordStart).count();
+	_recordSliceCount = static_cast<uint32_t>(sliceCount);
+
+	_drawStats = {};
+	for (const vkSort::DrawStats& stats : sliceStats)
+	{
+		_drawStats.draws += stats.draws;
+		_drawStats.objects += stats.objects;
+		_drawStats.pipelineBinds += stats.pipelineBinds;
+		_drawStats.descriptorBinds += stats.descriptorBinds;
+		_drawStats.vertexBufferBinds += stats.vertexBufferBinds;
+		_drawStats.triangles += stats.triangles;
+	}
+}
+
+void VulkanEngine::recordObjects(VkCommandBuffer cmd, RenderObject* first, const uint32_t* order, size_t begin, size_t end, vkSort::DrawStats& outStats)
+{
+	VK_PROFILE_FUNCTION();
+
+	FrameData& frame = getCurrentFrame();
+	const uint32_t uniformOffset = padUniformBufferSize(sizeof(GPUSceneData)) * (_framenumber % _frames.size());
 
+	// draws follow the sorted visible order, every bind is skipped while the state it sets is unchanged
+	// and runs of the same submesh and material become one instanced draw, a secondary starts without
+	// any state so the first draw of every slice binds everything again
 	Mesh* lastMesh = nullptr;
-	Material* lastMaterial = nullptr;
-	for (int i = 0; i < count; i++)
+	VkPipeline lastPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout lastLayout = VK_NULL_HANDLE;
+	VkDescriptorSet lastTextureSet = VK_NULL_HANDLE;
+
+	outStats = {};
+
+	for (size_t d = begin; d < end; )
 	{
-		RenderObject& object = first[i];
+		RenderObject& object = first[order[d]];
+
+		size_t runEnd = d + 1;
+		while (runEnd < end)
+		{
+			const RenderObject& next = first[order[runEnd]];
+			if (next.mesh != object.mesh || next.submeshIndex != object.submeshIndex || next.material != object.material)
+			{
+				break;
+			}
+
+			runEnd++;
+		}
+
+		const uint32_t firstInstance = static_cast<uint32_t>(d);
+		const uint32_t instanceCount = static_cast<uint32_t>(runEnd - d);
+		d = runEnd;
 
 		if (object.material == nullptr)
 		{
 			continue;
 		}
 
-		if (object.material != lastMaterial)
-		{
-			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline);
-			lastMaterial = object.material;
+		if (object.material->pipeline != lastPipeline)
+		{
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline);
+			lastPipeline = object.material->pipeline;
+			outStats.pipelineBinds++;
+		}
+
+		if (object.material->pipelineLayout != lastLayout)
+		{
+			lastLayout = object.material->pipelineLayout;
+			lastTextureSet = VK_NULL_HANDLE;
+
+			vkCmdBindDescriptorSets(cmd,
+				VK_PIPELINE_BIND_POINT_GRAPHICS,
+				object.material->pipelineLayout,
+				0, 1, &frame.globalDescriptor, 1, &uniformOffset);
+
+			vkCmdBindDescriptorSets(cmd,
+				VK_PIPELINE_BIND_POINT_GRAPHICS,
+				object.material->pipelineLayout,
+				1, 1, &frame.objectDescriptor, 0, nullptr
+			);
+
+			outStats.descriptorBinds += 2;
+		}
+
+		if (object.material->textureSet != VK_NULL_HANDLE && object.material->textureSet != lastTextureSet)
+		{
+			vkCmdBindDescriptorSets(
+				cmd,
+				VK_PIPELINE_BIND_POINT_GRAPHICS,
+				object.material->pipelineLayout,
+				2, 1, &object.material->textureSet, 0, nullptr
+			);
+
+			lastTextureSet = object.material->textureSet;
+			outStats.descriptorBinds++;
+		}
+
+		MeshPushConstants constants;
+		constants.renderMatrix = object.transformMatrix;
+		constants.positionOffset = glm::vec4(object.mesh->_boundsMin, 0.0f);
+		constants.positionScale = glm::vec4(object.mesh->getBoundsExtent(), 0.0f);
+
+		vkCmdPushConstants(cmd, object.material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+
+		if (object.mesh != lastMesh)
+		{
+			VkDeviceSize offset = 0;
+			vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->_vertexBuffer._buffer, &offset);
+			vkCmdBindIndexBuffer(cmd, object.mesh->_indexBuffer._buffer, 0, object.mesh->getIndexType());
+			lastMesh = object.mesh;
+			outStats.vertexBufferBinds++;
+		}
+
+		const Submesh& submesh = object.mesh->_submeshes[object.submeshIndex];
+		vkCmdDrawIndexed(cmd, submesh.indexCount, instanceCount, submesh.firstIndex, 0, firstInstance);
+		outStats.draws++;
+		outStats.objects += instanceCount;
+		outStats.triangles += uint64_t(submesh.indexCount / 3) * instanceCount;
+	}
+}
+
+void VulkanEngine::beginSecondary(VkCommandBuffer cmd, VkFramebuffer framebuffer)
+{
+	VkCommandBufferInheritanceInfo inheritanceInfo = vkInit::commandBufferInheritanceInfo(_renderpass, 0, framebuffer);
+
+	VkCommandBufferBeginInfo beginInfo = vkInit::commandBufferBeginInfo(
+		VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+}
+
+void VulkanEngine::initIndirect()
+{
+	VkDescriptorSetLayoutBinding cullDataBind = vkInit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0);
+	VkDescriptorSetLayoutBinding drawDataBind = vkInit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1);
+	VkDescriptorSetLayoutBinding commandBind = vkInit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2);
+	VkDescriptorSetLayoutBinding countBind = vkInit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3);
+
+	VkDescriptorSetLayoutBinding bindings[] = { cullDataBind, drawDataBind, commandBind, countBind };
+
+	VkDescriptorSetLayoutCreateInfo setInfo = {};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setInfo.pNext = nullptr;
+	setInfo.flags = 0;
+	setInfo.bindingCount = 4;
+	setInfo.pBindings = bindings;
+
+	vkCreateDescriptorSetLayout(_device, &setInfo, nullptr, &_cullSetLayout);
+
+	for (size_t i = 0; i < _frames.size(); i++)
+	{
+		_frames[i].drawDataBuffer = createBuffer(sizeof(GPUDrawData) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, true);
+		_frames[i].cullDataBuffer = createBuffer(sizeof(GPUCullData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, true);
+		_frames[i].drawData = (GPUDrawData*)_frames[i].drawDataBuffer._mapped;
+		_frames[i].cullData = (GPUCullData*)_frames[i].cullDataBuffer._mapped;
+		_frames[i].indirectBuffer = createBuffer(
+			sizeof(VkDrawIndexedIndirectCommand) * MAX_OBJECTS,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VMA_MEMORY_USAGE_GPU_ONLY
+		);
+		// one counter per batch, at most one batch per material
+		_frames[i].drawCountBuffer = createBuffer(
+			sizeof(uint32_t) * MAX_OBJECTS,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VMA_MEMORY_USAGE_GPU_ONLY
+		);
+
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.pNext = nullptr;
+		allocInfo.descriptorPool = _descriptorPool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &_cullSetLayout;
+
+		vkAllocateDescriptorSets(_device, &allocInfo, &_frames[i].cullDescriptor);
+
+		VkDescriptorBufferInfo cullDataInfo = { _frames[i].cullDataBuffer._buffer, 0, sizeof(GPUCullData) };
+		VkDescriptorBufferInfo drawDataInfo = { _frames[i].drawDataBuffer._buffer, 0, sizeof(GPUDrawData) * MAX_OBJECTS };
+		VkDescriptorBufferInfo commandInfo = { _frames[i].indirectBuffer._buffer, 0, sizeof(VkDrawIndexedIndirectCommand) * MAX_OBJECTS };
+		VkDescriptorBufferInfo countInfo = { _frames[i].drawCountBuffer._buffer, 0, sizeof(uint32_t) * MAX_OBJECTS };
+
+		VkWriteDescriptorSet setWrites[] = {
+			vkInit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, _frames[i].cullDescriptor, &cullDataInfo, 0),
+			vkInit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _frames[i].cullDescriptor, &drawDataInfo, 1),
+			vkInit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _frames[i].cullDescriptor, &commandInfo, 2),
+			vkInit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, _frames[i].cullDescriptor, &countInfo, 3)
+		};
+
+		vkUpdateDescriptorSets(_device, 4, setWrites, 0, nullptr);
+
+		_mainDeleteionQueue.pushFunction([=]() {
+			vmaDestroyBuffer(_allocator, _frames[i].drawDataBuffer._buffer, _frames[i].drawDataBuffer._allocation);
+			vmaDestroyBuffer(_allocator, _frames[i].cullDataBuffer._buffer, _frames[i].cullDataBuffer._allocation);
+			vmaDestroyBuffer(_allocator, _frames[i].indirectBuffer._buffer, _frames[i].indirectBuffer._allocation);
+			vmaDestroyBuffer(_allocator, _frames[i].drawCountBuffer._buffer, _frames[i].drawCountBuffer._allocation);
+			});
+	}
+
+	VkPipelineLayoutCreateInfo cullPipelineLayoutInfo = vkInit::pipelineLayoutCreateInfo();
+	cullPipelineLayoutInfo.setLayoutCount = 1;
+	cullPipelineLayoutInfo.pSetLayouts = &_cullSetLayout;
+
+	VK_CHECK(vkCreatePipelineLayout(_device, &cullPipelineLayoutInfo, nullptr, &_cullPipelineLayout));
+
+	_mainDeleteionQueue.pushFunction([=]() {
+		vkDestroyPipelineLayout(_device, _cullPipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(_device, _cullSetLayout, nullptr);
+		});
+
+	VkShaderModule cullShader;
+	if (!loadShaderModule("shaders/indirect_cull_comp.spv", cullShader))
+	{
+		std::cout << "Error building indirect_cull_comp.spv shader, GPU driven rendering is disabled\n";
+		_gpuDrivenSupported = false;
+		return;
+	}
+
+	std::cout << "indirect_cull_comp.spv is loaded\n";
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.pNext = nullptr;
+	pipelineInfo.stage = vkInit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+	pipelineInfo.layout = _cullPipelineLayout;
+
+	auto pipelineStart = std::chrono::high_resolution_clock::now();
+	VkResult pipelineResult = vkCreateComputePipelines(_device, _pipelineCache, 1, &pipelineInfo, nullptr, &_cullPipeline);
+	_pipelineCreateMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - pipelineStart).count();
+
+	if (pipelineResult != VK_SUCCESS)
+	{
+		std::cout << "Failed to create the indirect cull pipeline, GPU driven rendering is disabled\n";
+		_cullPipeline = VK_NULL_HANDLE;
+		_gpuDrivenSupported = false;
+	}
+	else
+	{
+		_mainDeleteionQueue.pushFunction([=]() {
+			vkDestroyPipeline(_device, _cullPipeline, nullptr);
+			});
+	}
+
+	destroyShaderModule(cullShader);
+}
+
+void VulkanEngine::uploadMegaBuffer()
+{
+	if (!_gpuDrivenSupported)
+	{
+		return;
+	}
+
+	size_t vertexCount = 0;
+	size_t indexCount = 0;
+
+	for (auto& [name, mesh] : _meshes)
+	{
+		mesh._megaVertexOffset = static_cast<int32_t>(vertexCount);
+		mesh._megaFirstIndex = static_cast<uint32_t>(indexCount);
+
+		vertexCount += mesh.getVertexCount();
+		indexCount += mesh.getIndexCount();
+	}
+
+	const size_t vertexBufferSize = vertexCount * sizeof(Vertex);
+	const size_t indexBufferSize = indexCount * sizeof(uint32_t);
+
+	_megaVertexBuffer = createBuffer(vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	_megaIndexBuffer = createBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+	// indices stay local to their mesh, the draws add the mesh's vertex offset
+	for (auto& [name, mesh] : _meshes)
+	{
+		_uploadManager.uploadBuffer(_megaVertexBuffer._buffer, mesh._megaVertexOffset * sizeof(Vertex), mesh.getVertexData(), mesh.getVertexCount() * sizeof(Vertex),
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+		_uploadManager.uploadBuffer(_megaIndexBuffer._buffer, mesh._megaFirstIndex * sizeof(uint32_t), mesh.getIndexData(), mesh.getIndexCount() * sizeof(uint32_t),
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+	}
+
+	_mainDeleteionQueue.pushFunction([=]() {
+		vmaDestroyBuffer(_allocator, _megaVertexBuffer._buffer, _megaVertexBuffer._allocation);
+		vmaDestroyBuffer(_allocator, _megaIndexBuffer._buffer, _megaIndexBuffer._allocation);
+		});
+
+	std::cout << "Mega buffer : " << vertexCount << " vertices, " << indexCount << " indices, "
+		<< vertexBufferSize + indexBufferSize << " bytes\n";
+}
+
+void VulkanEngine::buildIndirectBatches()
+{
+	_indirectBatches.clear();
+	_indirectObjects.clear();
+
+	// the object buffer is indexed by renderable and the draw data by slot, both hold MAX_OBJECTS entries
+	if (_renderables.size() > MAX_OBJECTS)
+	{
+		std::cout << _renderables.size() << " renderables, the GPU driven path only draws the first " << MAX_OBJECTS << "\n";
+	}
+
+	// command slots are grouped by material so each batch is one contiguous range
+	std::vector<uint32_t> objects;
+	for (uint32_t i = 0; i < _renderables.size() && i < MAX_OBJECTS; i++)
+	{
+		if (_renderables[i].material != nullptr)
+		{
+			objects.push_back(i);
+		}
+	}
+
+	std::stable_sort(objects.begin(), objects.end(), [&](uint32_t a, uint32_t b) {
+		return _renderables[a].material->pipelineSortId < _renderables[b].material->pipelineSortId ||
+			(_renderables[a].material->pipelineSortId == _renderables[b].material->pipelineSortId &&
+				_renderables[a].material->descriptorSortId < _renderables[b].material->descriptorSortId);
+		});
+
+	for (uint32_t object : objects)
+	{
+		Material* material = _renderables[object].material;
+
+		if (_indirectBatches.empty() || _indirectBatches.back().material != material)
+		{
+			_indirectBatches.push_back({ material, static_cast<uint32_t>(_indirectObjects.size()), 0 });
+		}
+
+		const RenderObject& renderable = _renderables[object];
+		_indirectBatches.back().count++;
+		_indirectBatches.back().triangles += renderable.mesh->_submeshes[renderable.submeshIndex].indexCount / 3;
+		_indirectObjects.push_back(object);
+	}
+}
+
+void VulkanEngine::cullIndirect(VkCommandBuffer cmd)
+{
+	if (_renderableBounds.count != _renderables.size())
+	{
+		updateRenderableBounds();
+	}
+
+	FrameData& frame = getCurrentFrame();
+	const uint32_t drawCount = static_cast<uint32_t>(_indirectObjects.size());
+
+	auto uploadStart = std::chrono::high_resolution_clock::now();
+
+	// the object buffer is indexed by renderable here, firstInstance carries the index, buildIndirectBatches only
+	// takes renderables below MAX_OBJECTS so neither the renderable index nor the slot leaves the buffers
+	GPUObjectData* objectSSBO = frame.objectData;
+	GPUDrawData* drawSSBO = frame.drawData;
+
+	for (uint32_t batch = 0; batch < _indirectBatches.size(); batch++)
+	{
+		const IndirectBatch& indirectBatch = _indirectBatches[batch];
+
+		for (uint32_t slot = indirectBatch.first; slot < indirectBatch.first + indirectBatch.count; slot++)
+		{
+			const uint32_t i = _indirectObjects[slot];
+			const RenderObject& object = _renderables[i];
+			const Submesh& submesh = object.mesh->_submeshes[object.submeshIndex];
+
+			objectSSBO[i].modelMatrix = object.transformMatrix;
+
+			GPUDrawData& draw = drawSSBO[slot];
+			draw.sphere = glm::vec4(_renderableBounds.centerX[i], _renderableBounds.centerY[i], _renderableBounds.centerZ[i], _renderableBounds.radius[i]);
+			draw.firstIndex = object.mesh->_megaFirstIndex + submesh.firstIndex;
+			draw.indexCount = submesh.indexCount;
+			draw.vertexOffset = object.mesh->_megaVertexOffset;
+			draw.batch = batch;
+			draw.batchStart = indirectBatch.first;
+			draw.objectIndex = i;
+		}
+	}
+
+	GPUCullData& cullData = *frame.cullData;
+	vkCull::Frustum frustum = vkCull::extractFrustum(getCameraData().viewproj);
+	for (int p = 0; p < 6; p++)
+	{
+		cullData.planes[p] = frustum.planes[p];
+	}
+	cullData.drawCount = drawCount;
+	cullData.compact = _drawIndirectCountSupported ? 1 : 0;
+
+	flushBuffer(frame.objectBuffer, 0, VK_WHOLE_SIZE);
+	flushBuffer(frame.drawDataBuffer, 0, sizeof(GPUDrawData) * drawCount);
+	flushBuffer(frame.cullDataBuffer, 0, sizeof(GPUCullData));
+
+	_uploadTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - uploadStart).count();
+
+	vkCmdFillBuffer(cmd, frame.drawCountBuffer._buffer, 0, sizeof(uint32_t) * std::max<size_t>(1, _indirectBatches.size()), 0);
+
+	VkMemoryBarrier clearBarrier = {};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+	if (drawCount > 0)
+	{
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipelineLayout, 0, 1, &frame.cullDescriptor, 0, nullptr);
+		vkCmdDispatch(cmd, (drawCount + 63) / 64, 1, 1);
+	}
+
+	VkMemoryBarrier commandBarrier = {};
+	commandBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	commandBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	commandBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &commandBarrier, 0, nullptr, 0, nullptr);
+}
+
+void VulkanEngine::drawIndirect(VkCommandBuffer cmd)
+{
+	FrameData& frame = getCurrentFrame();
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	const uint32_t uniformOffset = padUniformBufferSize(sizeof(GPUSceneData)) * (_framenumber % _frames.size());
 
-			uint32_t uniform_offset = padUniformBufferSize(sizeof(GPUSceneData)) * frameIndex;
+	_drawStats = {};
 
-			vkCmdBindDescriptorSets(cmd,
-				VK_PIPELINE_BIND_POINT_GRAPHICS,
-				object.material->pipelineLayout,
-				0, 1, &getCurrentFrame().globalDescriptor, 1, &uniform_offset);
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(cmd, 0, 1, &_megaVertexBuffer._buffer, &offset);
+	vkCmdBindIndexBuffer(cmd, _megaIndexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+	_drawStats.vertexBufferBinds++;
 
-			vkCmdBindDescriptorSets(cmd,
-				VK_PIPELINE_BIND_POINT_GRAPHICS,
-				object.material->pipelineLayout,
-				1, 1, &getCurrentFrame().objectDescriptor, 0, nullptr
-			);
+	for (uint32_t batch = 0; batch < _indirectBatches.size(); batch++)
+	{
+		const IndirectBatch& indirectBatch = _indirectBatches[batch];
+		Material* material = indirectBatch.material;
 
-			if (object.material->textureSet != VK_NULL_HANDLE)
-			{
-				vkCmdBindDescriptorSets(
-					cmd,
-					VK_PIPELINE_BIND_POINT_GRAPHICS,
-					object.material->pipelineLayout,
-					2, 1, &object.material->textureSet, 0, nullptr
-				);
-			}
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipeline);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 0, 1, &frame.globalDescriptor, 1, &uniformOffset);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 1, 1, &frame.objectDescriptor, 0, nullptr);
+		_drawStats.pipelineBinds++;
+		_drawStats.descriptorBinds += 2;
+
+		if (material->textureSet != VK_NULL_HANDLE)
+		{
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipelineLayout, 2, 1, &material->textureSet, 0, nullptr);
+			_drawStats.descriptorBinds++;
 		}
 
-		MeshPushConstants constants;
-		constants.renderMatrix = object.transformMatrix;
+		// the vertex shader only needs the object matrix, the bounds offset and scale are unused for Vertex
+		MeshPushConstants constants = {};
+		vkCmdPushConstants(cmd, material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
 
-		vkCmdPushConstants(cmd, object.material->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+		const VkDeviceSize commandOffset = VkDeviceSize(indirectBatch.first) * stride;
 
-		if (object.mesh != lastMesh)
+		if (_drawIndirectCountSupported)
 		{
-			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->_vertexBuffer._buffer, &offset);
-			lastMesh = object.mesh;
+			_vkCmdDrawIndexedIndirectCount(cmd, frame.indirectBuffer._buffer, commandOffset,
+				frame.drawCountBuffer._buffer, batch * sizeof(uint32_t), indirectBatch.count, stride);
+			_drawStats.draws++;
+		}
+		else if (_multiDrawIndirectSupported)
+		{
+			// culled slots hold zero instances
+			vkCmdDrawIndexedIndirect(cmd, frame.indirectBuffer._buffer, commandOffset, indirectBatch.count, stride);
+			_drawStats.draws++;
+		}
+		else
+		{
+			for (uint32_t c = 0; c < indirectBatch.count; c++)
+			{
+				vkCmdDrawIndexedIndirect(cmd, frame.indirectBuffer._buffer, commandOffset + VkDeviceSize(c) * stride, 1, stride);
+				_drawStats.draws++;
+			}
 		}
 
-		vkCmdDraw(cmd, object.mesh->_vertices.size(), 1, 0, i);
+		_drawStats.objects += indirectBatch.count;
+		// the culled count stays on the GPU, so this is an upper bound
+		_drawStats.triangles += indirectBatch.triangles;
 	}
 }
 
@@ -782,7 +1836,7 @@ void VulkanEngine::initScene()
 {
 	RenderObject monkey;
 	monkey.mesh = getMesh("monkey");
-	monkey.material = getMaterial("defaultMesh");
+	monkey.material = getMaterial("texturedmesh");
 	monkey.transformMatrix = glm::mat4(1.0f);
 
 	_renderables.push_back(monkey);
@@ -793,7 +1847,7 @@ void VulkanEngine::initScene()
 		{
 			RenderObject tri;
 			tri.mesh = getMesh("triangle");
-			tri.material = getMaterial("defaultMesh");
+			tri.material = getMaterial("texturedmesh");
 			glm::mat4 translation = glm::translate(glm::mat4{ 1.0f }, glm::vec3(x, 0, y));
 			glm::mat4 scale = glm::scale(glm::mat4{ 1.0f }, glm::vec3(0.2, 0.2, 0.2));
 			tri.transformMatrix = translation * scale;
@@ -802,10 +1856,18 @@ void VulkanEngine::initScene()
 		}
 	}
 
-	RenderObject map;
-	map.mesh = getMesh("empire");
-	map.material = getMaterial("texturedmesh");
-	map.transformMatrix = glm::translate(glm::vec3(5, -10, 0));
+	// one object per submesh so the map can be culled and sorted per object/material range
+	Mesh* empire = getMesh("empire");
+	for (uint32_t i = 0; i < empire->_submeshes.size(); i++)
+	{
+		RenderObject map;
+		map.mesh = empire;
+		map.submeshIndex = i;
+		map.material = getMaterial("texturedmesh");
+		map.transformMatrix = glm::translate(glm::vec3(5, -10, 0));
+
+		_renderables.push_back(map);
+	}
 
 	VkSamplerCreateInfo samplerInfo = vkInit::samplerCreateInfo(VK_FILTER_NEAREST);
 
@@ -834,10 +1896,12 @@ void VulkanEngine::initScene()
 
 	vkUpdateDescriptorSets(_device, 1, &texture1, 0, nullptr);
 
-	_renderables.push_back(map);
+	updateRenderableBounds();
+	assignSortIds();
+	buildIndirectBatches();
 }
 
-AllocatedBuffer VulkanEngine::createBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage)
+AllocatedBuffer VulkanEngine::createBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, bool persistentlyMapped)
 {
 	VkBufferCreateInfo bufferInfo = {};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -849,101 +1913,110 @@ AllocatedBuffer VulkanEngine::createBuffer(size_t allocSize, VkBufferUsageFlags
 	VmaAllocationCreateInfo vmaallocInfo = {};
 	vmaallocInfo.usage = memoryUsage;
 
+	if (persistentlyMapped)
+	{
+		vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	}
+
 	AllocatedBuffer newBuffer;
+	VmaAllocationInfo allocationInfo = {};
 
 	VK_CHECK(vmaCreateBuffer(
 		_allocator, &bufferInfo, &vmaallocInfo,
-		&newBuffer._buffer, &newBuffer._allocation, nullptr
+		&newBuffer._buffer, &newBuffer._allocation, &allocationInfo
 	));
 
+	newBuffer._mapped = persistentlyMapped ? allocationInfo.pMappedData : nullptr;
+
 	return newBuffer;
 }
 
+void VulkanEngine::flushBuffer(const AllocatedBuffer& buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+	// VMA skips coherent memory types and aligns the range to nonCoherentAtomSize
+	VK_CHECK(vmaFlushAllocation(_allocator, buffer._allocation, offset, size));
+}
+
 void VulkanEngine::init_descriptors()
 {
+	// every frame in flight allocates a global, an object and a cull set
+	const uint32_t frameCount = static_cast<uint32_t>(_frames.size());
+
 	std::vector<VkDescriptorPoolSize> sizes =
 	{
-		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
-		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10},
-		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10},
+		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 5 * frameCount},
+		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 5 * frameCount},
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10 * frameCount},
 		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10}
 	};
 
 	VkDescriptorPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.flags = 0;
-	poolInfo.maxSets = 10;
+	poolInfo.maxSets = 10 * frameCount;
 	poolInfo.poolSizeCount = (uint32_t)sizes.size();
 	poolInfo.pPoolSizes = sizes.data();
 
 	vkCreateDescriptorPool(_device, &poolInfo, nullptr, &_descriptorPool);
 
-	VkDescriptorSetLayoutBinding cameraBind = vkInit::descriptorSetLayoutBinding(
-		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0
-	);
-
-	VkDescriptorSetLayoutBinding sceneBind = vkInit::descriptorSetLayoutBinding(
-		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-		VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-		1
-	);
-
-	VkDescriptorSetLayoutBinding objectBind = vkInit::descriptorSetLayoutBinding(
-		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-		VK_SHADER_STAGE_VERTEX_BIT,
-		0
-	);
-
-	VkDescriptorSetLayoutBinding textureBind = vkInit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0);
-
-	VkDescriptorSetLayoutCreateInfo set3Info = {};
-	set3Info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	set3Info.pNext = nullptr;
-	set3Info.bindingCount = 1;
-	set3Info.flags = 0;
-	set3Info.pBindings = &textureBind;
-
-	vkCreateDescriptorSetLayout(_device, &set3Info, nullptr, &_singleTextureSetLayout);
-
-	VkDescriptorSetLayoutCreateInfo set2Info = {};
-	set2Info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	set2Info.pNext = nullptr;
-	set2Info.flags = 0;
-	set2Info.bindingCount = 1;
-	set2Info.pBindings = &objectBind;
+	// the mesh shaders declare the sets every draw binds, binding stages are the stages declaring them,
+	// without them the layouts would miss bindings the sets below are written with, as fatal as a VK_CHECK
+	if (!reflectShaders({ getMeshVertShaderPath(), "shaders/triangle_mesh_frag.spv" }, _meshReflection))
+	{
+		std::cout << "Error reflecting the mesh shaders\n";
+		exit(1);
+	}
 
-	vkCreateDescriptorSetLayout(_device, &set2Info, nullptr, &_objectSetLayout);
+	// the scene parameters of every frame share one buffer, each frame binds its part with a dynamic offset
+	vkReflect::makeDynamic(_meshReflection, 0, 1);
 
-	VkDescriptorSetLayoutBinding bindings[] = { cameraBind, sceneBind };
+	// what the sets below and initScene write
+	const std::pair<uint32_t, uint32_t> writtenBindings[] = { { 0, 0 }, { 0, 1 }, { 1, 0 }, { 2, 0 } };
+	bool allDeclared = true;
+	for (const auto& [set, binding] : writtenBindings)
+	{
+		const bool declared = std::any_of(_meshReflection.bindings.begin(), _meshReflection.bindings.end(), [&](const vkReflect::DescriptorBinding& candidate) {
+			return candidate.set == set && candidate.binding == binding;
+			});
 
-	VkDescriptorSetLayoutCreateInfo setInfo = {};
-	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	setInfo.pNext = nullptr;
-	setInfo.flags = 0;
-	setInfo.bindingCount = 2;
-	setInfo.pBindings = bindings;
+		if (!declared)
+		{
+			std::cout << "The mesh shaders do not declare set " << set << " binding " << binding << ", which the engine writes\n";
+			allDeclared = false;
+		}
+	}
 
-	vkCreateDescriptorSetLayout(_device, &setInfo, nullptr, &_globalSetLayout);
+	if (!allDeclared)
+	{
+		exit(1);
+	}
 
-	const size_t sceneParamBufferSize = FRAME_OVERLAP * padUniformBufferSize(sizeof(GPUSceneData));
-	_sceneParameterBuffer = createBuffer(sceneParamBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	_globalSetLayout = _layoutCache.getLayout(vkReflect::getSetBindings(_meshReflection, 0));
+	_objectSetLayout = _layoutCache.getLayout(vkReflect::getSetBindings(_meshReflection, 1));
+	_singleTextureSetLayout = _layoutCache.getLayout(vkReflect::getSetBindings(_meshReflection, 2));
 
-	const int MAX_OBJECTS = 10000;
+	const size_t sceneParamBufferSize = _frames.size() * padUniformBufferSize(sizeof(GPUSceneData));
+	_sceneParameterBuffer = createBuffer(sceneParamBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, true);
 
-	for (int i = 0; i < FRAME_OVERLAP; i++)
+	for (size_t i = 0; i < _frames.size(); i++)
 	{
 		_frames[i].objectBuffer = createBuffer(
 			sizeof(GPUObjectData) * MAX_OBJECTS,
 			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-			VMA_MEMORY_USAGE_CPU_TO_GPU
+			VMA_MEMORY_USAGE_CPU_TO_GPU,
+			true
 		);
 
 		_frames[i].cameraBuffer = createBuffer(
 			sizeof(GPUCameraData),
 			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VMA_MEMORY_USAGE_CPU_TO_GPU
+			VMA_MEMORY_USAGE_CPU_TO_GPU,
+			true
 		);
 
+		_frames[i].objectData = (GPUObjectData*)_frames[i].objectBuffer._mapped;
+		_frames[i].cameraData = (GPUCameraData*)_frames[i].cameraBuffer._mapped;
+
 		VkDescriptorSetAllocateInfo allocInfo = {};
 		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 		allocInfo.pNext = nullptr;
@@ -992,120 +2065,616 @@ void VulkanEngine::init_descriptors()
 			_frames[i].objectDescriptor, &objectInfo, 0
 		);
 
-		VkWriteDescriptorSet setWrites[] = { cameraWrite, sceneWrite, objectWrite };
+		VkWriteDescriptorSet setWrites[] = { cameraWrite, sceneWrite, objectWrite };
+
+		vkUpdateDescriptorSets(_device, 3, setWrites, 0, nullptr);
+	}
+
+	for (size_t i = 0; i < _frames.size(); i++)
+	{
+		_mainDeleteionQueue.pushFunction([=]() {
+			vmaDestroyBuffer(_allocator, _frames[i].objectBuffer._buffer, _frames[i].objectBuffer._allocation);
+			vmaDestroyBuffer(_allocator, _frames[i].cameraBuffer._buffer, _frames[i].cameraBuffer._allocation);
+			});
+	}
+
+	_mainDeleteionQueue.pushFunction([=]() {
+		vkDestroyDescriptorPool(_device, _descriptorPool, nullptr);
+		vmaDestroyBuffer(_allocator, _sceneParameterBuffer._buffer, _sceneParameterBuffer._allocation);
+		});
+}
+
+size_t VulkanEngine::padUniformBufferSize(size_t originalSize)
+{
+	size_t minUboAlignment = _gpuProperties.limits.minUniformBufferOffsetAlignment;
+	size_t alignedSize = originalSize;
+
+	if (minUboAlignment > 0)
+	{
+		alignedSize = (alignedSize + minUboAlignment - 1) & ~(minUboAlignment - 1);
+	}
+
+	return alignedSize;
+}
+
+void VulkanEngine::decodeImages()
+{
+	DecodedImage lostEmpire;
+
+	if (vkUtil::decodeImageFromFile("assets/lost_empire-RGBA.png", lostEmpire))
+	{
+		_decodedImages["empire_diffuse"] = lostEmpire;
+	}
+}
+
+void VulkanEngine::loadImages()
+{
+	for (auto& [name, image] : _decodedImages)
+	{
+		Texture texture;
+
+		vkUtil::uploadDecodedImage(this, image, texture.image);
+
+		VkImageViewCreateInfo imageInfo = vkInit::imageviewCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, texture.image._image, VK_IMAGE_ASPECT_COLOR_BIT);
+		VK_CHECK(vkCreateImageView(_device, &imageInfo, nullptr, &texture.imageView));
+
+		_mainDeleteionQueue.pushFunction([=]() {
+			vkDestroyImageView(_device, texture.imageView, nullptr);
+			});
+
+		_loadedTextures[name] = texture;
+	}
+
+	_decodedImages.clear();
+}
+
+void VulkanEngine::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function)
+{
+	VkCommandBuffer cmd = _uploadContext.commandBuffer;
+
+	VkCommandBufferBeginInfo cmdBeginInfo = vkInit::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+	function(cmd);
+	VK_CHECK(vkEndCommandBuffer(cmd));
+	VkSubmitInfo submit = vkInit::submitInfo(&cmd);
+
+	VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, _uploadContext.uploadFence));
+	vkWaitForFences(_device, 1, &_uploadContext.uploadFence, true, 9999999999);
+	vkResetFences(_device, 1, &_uploadContext.uploadFence);
+
+	vkResetCommandPool(_device, _uploadContext.commandPool, 0);
+}
+
+void VulkanEngine::benchmarkRecording(uint32_t maxThreadCount)
+{
+	const uint32_t workerCount = static_cast<uint32_t>(_frames[0]._workerCommandPools.size());
+	if (maxThreadCount == 0 || maxThreadCount > workerCount)
+	{
+		maxThreadCount = workerCount;
+	}
+
+	// a 50 x 40 x 50 block of small triangles with every 8th a monkey, all of it in front of the camera
+	Mesh* monkey = getMesh("monkey");
+	Mesh* triangle = getMesh("triangle");
+	Material* material = getMaterial("texturedmesh");
+
+	_renderables.clear();
+	for (uint32_t i = 0; i < MAX_OBJECTS; i++)
+	{
+		glm::vec3 position((i % 50) * 0.48f - 12.0f, ((i / 50) % 40) * 0.4f - 2.0f, -5.0f - (i / 2000) * 0.5f);
+
+		RenderObject object;
+		object.mesh = i % 8 == 0 ? monkey : triangle;
+		object.material = material;
+		object.transformMatrix = glm::translate(position) * glm::scale(glm::vec3(0.1f));
+
+		_renderables.push_back(object);
+	}
+
+	_gpuDriven = false;
+	updateRenderableBounds();
+	assignSortIds();
+
+	const int warmupFrames = 10;
+	const int frameCount = 100;
+	double baseTime = 0.0;
+
+	for (uint32_t threadCount = 1; ; threadCount = std::min(threadCount * 2, maxThreadCount))
+	{
+		_recordThreadCount = threadCount;
+
+		double recordTime = 0.0;
+		for (int frame = 0; frame < warmupFrames + frameCount; frame++)
+		{
+			beginUiFrame();
+			draw();
+
+			if (frame >= warmupFrames)
+			{
+				recordTime += _recordTime;
+			}
+		}
+
+		recordTime /= frameCount;
+
+		// a scene that records nothing would time an empty loop
+		if (_drawStats.draws == 0)
+		{
+			std::cout << "No draws were recorded, the benchmark objects have no drawable material\n";
+			break;
+		}
+
+		if (threadCount == 1)
+		{
+			baseTime = recordTime;
+		}
+
+		std::cout << threadCount << " threads : record " << recordTime << " ms (" << baseTime / recordTime << "x), "
+			<< _recordSliceCount << " slices, " << _drawStats.draws << " draws for " << _drawStats.objects << " objects\n";
+
+		if (threadCount == maxThreadCount)
+		{
+			break;
+		}
+	}
+
+	vkDeviceWaitIdle(_device);
+}
+
+void VulkanEngine::benchmarkPipelineCache()
+{
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.pNext = nullptr;
+
+	VkPipelineCache coldCache;
+	VK_CHECK(vkCreatePipelineCache(_device, &cacheInfo, nullptr, &coldCache));
+
+	uint32_t coldBuilt = 0;
+	const double coldTime = _pipelineRegistry.timeRebuild(coldCache, coldBuilt);
+
+	size_t size = 0;
+	VK_CHECK(vkGetPipelineCacheData(_device, coldCache, &size, nullptr));
+	std::vector<char> data(size);
+	VK_CHECK(vkGetPipelineCacheData(_device, coldCache, &size, data.data()));
+
+	// the same data loadPipelineCache would read back from the file on the next launch
+	cacheInfo.initialDataSize = size;
+	cacheInfo.pInitialData = data.data();
+
+	VkPipelineCache warmCache;
+	VK_CHECK(vkCreatePipelineCache(_device, &cacheInfo, nullptr, &warmCache));
+
+	uint32_t warmBuilt = 0;
+	const double warmTime = _pipelineRegistry.timeRebuild(warmCache, warmBuilt);
+
+	vkDestroyPipelineCache(_device, coldCache, nullptr);
+	vkDestroyPipelineCache(_device, warmCache, nullptr);
+
+	// a driver keeping its own shader disk cache serves the cold builds from it too, which narrows the gap
+	printf("Pipeline cache : %u pipelines in %.2f ms with an empty cache, %u in %.2f ms with the %zu bytes it filled, %.1fx\n",
+		coldBuilt, coldTime, warmBuilt, warmTime, size, warmTime > 0.0 ? coldTime / warmTime : 0.0);
+}
+
+void VulkanEngine::benchmarkLatency(uint32_t frameCount)
+{
+	const uint32_t warmupFrames = 30;
+
+	std::vector<double> fenceWaits;
+	std::vector<double> latencies;
+	std::vector<double> frameTimes;
+
+	auto last = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t frame = 0; frame < warmupFrames + frameCount; frame++)
+	{
+		beginUiFrame();
+
+		// one synthetic input right before every frame reads the camera
+		_pendingInputTime = std::chrono::high_resolution_clock::now();
+		_hasPendingInput = true;
+
+		draw();
+
+		auto now = std::chrono::high_resolution_clock::now();
+
+		if (frame >= warmupFrames)
+		{
+			frameTimes.push_back(std::chrono::duration<double, std::milli>(now - last).count());
+			fenceWaits.push_back(_fenceWaitTime);
+
+			if (_inputLatency >= 0.0)
+			{
+				latencies.push_back(_inputLatency);
+			}
+		}
+
+		last = now;
+	}
+
+	vkDeviceWaitIdle(_device);
+
+	auto percentile = [](std::vector<double>& values, double p) {
+		if (values.empty())
+		{
+			return 0.0;
+		}
+
+		std::sort(values.begin(), values.end());
+		return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+	};
+
+	auto average = [](const std::vector<double>& values) {
+		double sum = 0.0;
+		for (double value : values)
+		{
+			sum += value;
+		}
+
+		return values.empty() ? 0.0 : sum / values.size();
+	};
+
+	std::cout << _frames.size() << " frames in flight, " << _swapchainImages.size() << " images (min " << _swapchainMinImageCount << "), "
+		<< getPresentModeName(_swapchainPresentMode) << "\n";
+	std::cout << "  frame " << average(frameTimes) << " ms avg, " << percentile(frameTimes, 0.99) << " ms p99\n";
+	std::cout << "  fence wait " << average(fenceWaits) << " ms avg, " << percentile(fenceWaits, 0.99) << " ms p99\n";
+	std::cout << "  input to present " << average(latencies) << " ms avg, " << percentile(latencies, 0.5) << " ms p50, "
+		<< percentile(latencies, 0.99) << " ms p99\n";
+}
+
+void VulkanEngine::beginUiFrame()
+{
+	if (_headless)
+	{
+		return;
+	}
+
+	SDL_PumpEvents();
+
+	ImGui_ImplVulkan_NewFrame();
+	ImGui_ImplSDL2_NewFrame(_window);
+	ImGui::NewFrame();
+}
+
+void VulkanEngine::renderAndReadback(uint32_t frameCount)
+{
+	for (uint32_t frame = 0; frame < frameCount; frame++)
+	{
+		_readbackRequested = frame + 1 == frameCount;
+		draw();
+	}
+}
+
+void VulkanEngine::runHeadless(uint32_t frameCount, const char* readbackPath)
+{
+	if (!_headless)
+	{
+		std::cout << "runHeadless needs _headless set before init\n";
+		return;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	double cullTime = 0.0;
+	double sortTime = 0.0;
+	double recordTime = 0.0;
+
+	for (uint32_t frame = 0; frame < frameCount; frame++)
+	{
+		_readbackRequested = readbackPath != nullptr && frame + 1 == frameCount;
+		draw();
+
+		cullTime += _cullTime;
+		sortTime += _sortTime;
+		recordTime += _recordTime;
+	}
+
+	vkDeviceWaitIdle(_device);
+
+	double totalTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << frameCount << " headless frames in " << totalTime << " ms, " << totalTime / frameCount << " ms per frame, "
+		<< "cull " << cullTime / frameCount << " ms, sort " << sortTime / frameCount << " ms, record " << recordTime / frameCount << " ms\n";
+
+	if (readbackPath != nullptr && vkUtil::writeImagePPM(readbackPath, _readbackPixels.data(), _windowExtent.width, _windowExtent.height))
+	{
+		std::cout << "Last frame written to " << readbackPath << "\n";
+	}
+}
+
+bool VulkanEngine::compareDrawPaths(const char* readbackPath)
+{
+	if (!_headless || !_gpuDrivenSupported)
+	{
+		std::cout << "Comparing draw paths needs headless mode and GPU driven support\n";
+		return false;
+	}
+
+	// enough frames that every frame in flight has been through the path once
+	const uint32_t frameCount = static_cast<uint32_t>(_frames.size()) + 1;
+
+	_gpuDriven = false;
+	renderAndReadback(frameCount);
+	std::vector<uint8_t> cpuPixels = _readbackPixels;
+
+	_gpuDriven = true;
+	renderAndReadback(frameCount);
+	std::vector<uint8_t> gpuPixels = _readbackPixels;
+
+	vkDeviceWaitIdle(_device);
+
+	// both paths draw the same triangles but in a different order, so equal depth may resolve differently
+	const int channelTolerance = 2;
+	const double maxMismatchRatio = 0.001;
+
+	size_t mismatches = 0;
+	int maxDifference = 0;
+	const size_t pixelCount = cpuPixels.size() / 4;
 
-		vkUpdateDescriptorSets(_device, 3, setWrites, 0, nullptr);
+	for (size_t i = 0; i < pixelCount; i++)
+	{
+		int difference = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			difference = std::max(difference, std::abs(int(cpuPixels[i * 4 + c]) - int(gpuPixels[i * 4 + c])));
+		}
+
+		maxDifference = std::max(maxDifference, difference);
+		mismatches += difference > channelTolerance ? 1 : 0;
 	}
 
-	for (int i = 0; i < FRAME_OVERLAP; i++)
+	const double mismatchRatio = pixelCount > 0 ? double(mismatches) / pixelCount : 1.0;
+	const bool matches = pixelCount > 0 && mismatchRatio <= maxMismatchRatio;
+
+	std::cout << "CPU vs GPU driven : " << mismatches << " / " << pixelCount << " pixels differ (" << mismatchRatio * 100.0
+		<< "%), max difference " << maxDifference << ", " << (matches ? "match" : "DIFFER") << "\n";
+
+	if (readbackPath != nullptr)
 	{
-		_mainDeleteionQueue.pushFunction([=]() {
-			vmaDestroyBuffer(_allocator, _frames[i].objectBuffer._buffer, _frames[i].objectBuffer._allocation);
-			vmaDestroyBuffer(_allocator, _frames[i].cameraBuffer._buffer, _frames[i].cameraBuffer._allocation);
-			});
+		std::string path = readbackPath;
+		vkUtil::writeImagePPM((path + "_cpu.ppm").c_str(), cpuPixels.data(), _windowExtent.width, _windowExtent.height);
+		vkUtil::writeImagePPM((path + "_gpu.ppm").c_str(), gpuPixels.data(), _windowExtent.width, _windowExtent.height);
 	}
 
-	_mainDeleteionQueue.pushFunction([=]() {
-		vkDestroyDescriptorSetLayout(_device, _globalSetLayout, nullptr);
-		vkDestroyDescriptorSetLayout(_device, _objectSetLayout, nullptr);
-		vkDestroyDescriptorPool(_device, _descriptorPool, nullptr);
-		vmaDestroyBuffer(_allocator, _sceneParameterBuffer._buffer, _sceneParameterBuffer._allocation);
-		});
+	return matches;
 }
 
-size_t VulkanEngine::padUniformBufferSize(size_t originalSize)
+bool VulkanEngine::runBenchmark(const vkBench::BenchmarkSettings& settings)
 {
-	size_t minUboAlignment = _gpuProperties.limits.minUniformBufferOffsetAlignment;
-	size_t alignedSize = originalSize;
-
-	if (minUboAlignment > 0)
+	vkBench::CameraPath path;
+	if (settings.cameraPath == nullptr || !path.load(settings.cameraPath) || settings.frameCount == 0)
 	{
-		alignedSize = (alignedSize + minUboAlignment - 1) & ~(minUboAlignment - 1);
+		return false;
 	}
 
-	return alignedSize;
-}
+	const uint32_t warmupFrames = 30;
+	const uint32_t frameCount = settings.frameCount;
+	// the camera advances by a fixed step per frame, so every run draws the same frames whatever the frame rate
+	const float timeStep = frameCount > 1 ? path.getDuration() / (frameCount - 1) : 0.0f;
+	const unsigned int firstMeasuredFrame = _framenumber + warmupFrames;
 
-void VulkanEngine::loadImages()
-{
-	Texture lostEmpire;
+	const glm::vec3 camPos = _camPos;
+	const float camYaw = _camYaw;
+	const float camPitch = _camPitch;
 
-	vkUtil::loadImageFromFile(this, "assets/lost_empire-RGBA.png", lostEmpire.image);
+	std::vector<vkBench::FrameSample> samples(frameCount);
 
-	VkImageViewCreateInfo imageInfo = vkInit::imageviewCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, lostEmpire.image._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	VK_CHECK(vkCreateImageView(_device, &imageInfo, nullptr, &lostEmpire.imageView));
+	auto last = std::chrono::high_resolution_clock::now();
 
-	_mainDeleteionQueue.pushFunction([=]() {
-		vkDestroyImageView(_device, lostEmpire.imageView, nullptr);
-		});
+	// the trailing frames only read back the timestamps of the last measured ones
+	const uint32_t totalFrames = warmupFrames + frameCount + static_cast<uint32_t>(_frames.size());
+	for (uint32_t frame = 0; frame < totalFrames; frame++)
+	{
+		const uint32_t pathFrame = frame < warmupFrames ? 0 : std::min(frame - warmupFrames, frameCount - 1);
+		vkBench::CameraKeyframe keyframe = path.sample(pathFrame * timeStep);
+		_camPos = -keyframe.position;
+		_camYaw = keyframe.yaw;
+		_camPitch = keyframe.pitch;
 
-	_loadedTextures["empire_diffuse"] = lostEmpire;
-}
+		beginUiFrame();
 
-void VulkanEngine::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function)
-{
-	VkCommandBuffer cmd = _uploadContext.commandBuffer;
+		auto drawStart = std::chrono::high_resolution_clock::now();
+		draw();
+		auto drawEnd = std::chrono::high_resolution_clock::now();
 
-	VkCommandBufferBeginInfo cmdBeginInfo = vkInit::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		// timestamps arrive frames in flight later and belong to the frame that wrote them
+		if (_gpuTime >= 0.0 && _gpuTimeFrame >= firstMeasuredFrame && _gpuTimeFrame - firstMeasuredFrame < frameCount)
+		{
+			vkBench::FrameSample& sample = samples[_gpuTimeFrame - firstMeasuredFrame];
+			sample.gpuTime = _gpuTime;
+			for (const GpuScopeResult& scope : _gpuScopes)
+			{
+				sample.gpuScopes.emplace_back(scope.name, scope.time);
+			}
+		}
 
-	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
-	function(cmd);
-	VK_CHECK(vkEndCommandBuffer(cmd));
-	VkSubmitInfo submit = vkInit::submitInfo(&cmd);
+		if (frame >= warmupFrames && frame - warmupFrames < frameCount)
+		{
+			vkBench::FrameSample& sample = samples[frame - warmupFrames];
+			sample.frameTime = std::chrono::duration<double, std::milli>(drawEnd - last).count();
+			sample.cpuTime = std::chrono::duration<double, std::milli>(drawEnd - drawStart).count() - _fenceWaitTime;
+			sample.draws = _drawStats.draws;
+			sample.triangles = _drawStats.triangles;
+			sample.memory = getDeviceMemoryUsage();
+		}
 
-	VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, _uploadContext.uploadFence));
-	vkWaitForFences(_device, 1, &_uploadContext.uploadFence, true, 9999999999);
-	vkResetFences(_device, 1, &_uploadContext.uploadFence);
+		last = drawEnd;
+	}
 
-	vkResetCommandPool(_device, _uploadContext.commandPool, 0);
+	vkDeviceWaitIdle(_device);
+
+	_camPos = camPos;
+	_camYaw = camYaw;
+	_camPitch = camPitch;
+
+	std::cout << "Benchmark " << settings.cameraPath << ", " << (_gpuDriven ? "GPU driven" : "CPU") << " path, "
+		<< (_timestampsSupported ? "with" : "without") << " GPU timestamps\n";
+
+	bool written = true;
+	if (settings.jsonPath != nullptr)
+	{
+		written &= vkBench::writeJson(settings.jsonPath, settings.cameraPath, samples);
+	}
+
+	if (settings.csvPath != nullptr)
+	{
+		written &= vkBench::writeCsv(settings.csvPath, samples);
+	}
+
+	return vkBench::checkResults(settings, samples) && written;
 }
 
 FrameData& VulkanEngine::getCurrentFrame()
 {
-	return _frames[_framenumber % FRAME_OVERLAP];
+	return _frames[_framenumber % _frames.size()];
 }
 
 void VulkanEngine::init()
 {
-	SDL_Init(SDL_INIT_VIDEO); // initialize window includes input events
-	SDL_WindowFlags windowFlags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN);
-
-	// create window
-	_window = SDL_CreateWindow(
-		"Vulkan Sandbox",
-		SDL_WINDOWPOS_CENTERED,
-		SDL_WINDOWPOS_CENTERED,
-		_windowExtent.width,
-		_windowExtent.height,
-		windowFlags
-	);
+	auto initStart = std::chrono::high_resolution_clock::now();
 
-	initVulkan();
-	initSwapchain();
-	initCommands();
-	initDefaultRenderpass();
-	initFramebuffers();
-	initSyncStructures();
-	init_descriptors();
-	initPipelines();
+	vkProf::setThreadName("main");
 
-	initImgui();
+	if (!_headless)
+	{
+		SDL_Init(SDL_INIT_VIDEO); // initialize window includes input events
+		SDL_WindowFlags windowFlags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN | (_startupBenchmark ? SDL_WINDOW_HIDDEN : 0));
+
+		// create window
+		_window = SDL_CreateWindow(
+			"Vulkan Sandbox",
+			SDL_WINDOWPOS_CENTERED,
+			SDL_WINDOWPOS_CENTERED,
+			_windowExtent.width,
+			_windowExtent.height,
+			windowFlags
+		);
+	}
+
+	auto windowEnd = std::chrono::high_resolution_clock::now();
+
+	// started before the graph so the main thread is worker 0, tasks on the graph threads push
+	// their jobs through the injection queue and help while they wait
+	vkJobs::initGlobal(0);
+
+	// every init task indexes _frames, so it is sized before any of them runs
+	_frames.resize(std::max(1u, _framesInFlight));
+
+	// file reads, PNG decoding and OBJ parsing start right away and overlap the device setup,
+	// everything recording into the upload manager or a queue is chained so it stays serialized
+	vkTask::TaskGraph initGraph;
+
+	vkTask::TaskId vulkan = initGraph.addMainThreadTask("vulkan", [this]() { initVulkan(); });
+	vkTask::TaskId swapchain = initGraph.addTask("swapchain", [this]() { initSwapchain(); }, { vulkan });
+	vkTask::TaskId commands = initGraph.addTask("commands", [this]() { initCommands(); }, { vulkan });
+	vkTask::TaskId renderpass = initGraph.addTask("renderpass", [this]() { initDefaultRenderpass(); }, { swapchain });
+	vkTask::TaskId framebuffers = initGraph.addTask("framebuffers", [this]() { initFramebuffers(); }, { renderpass });
+	vkTask::TaskId sync = initGraph.addTask("sync", [this]() { initSyncStructures(); }, { vulkan });
+	vkTask::TaskId descriptors = initGraph.addTask("descriptors", [this]() { init_descriptors(); }, { vulkan });
+
+	vkTask::TaskId pipelines = initGraph.addTask("pipelines", [this]() { initPipelines(); }, { renderpass, descriptors });
+	vkTask::TaskId indirect = initGraph.addTask("indirect", [this]() { initIndirect(); }, { descriptors });
+	vkTask::TaskId imgui = initGraph.addMainThreadTask("imgui", [this]() { initImgui(); }, { renderpass, commands, sync });
+
+	vkTask::TaskId decode = initGraph.addTask("decode textures", [this]() { decodeImages(); });
+	vkTask::TaskId parseMonkey = initGraph.addTask("parse monkey", [this]() { parseMesh("models/monkey_smooth.obj", _modelMesh); });
+	vkTask::TaskId parseEmpire = initGraph.addTask("parse empire", [this]() { parseMesh("assets/lost_empire.obj", _empireMesh); });
+
+	// the ImGui font upload may share the graphics queue with the upload manager
+	vkTask::TaskId images = initGraph.addTask("upload textures", [this]() { loadImages(); }, { decode, imgui });
+	// initIndirect clears _gpuDrivenSupported when it fails, the mega buffer upload reads it
+	vkTask::TaskId meshes = initGraph.addTask("upload meshes", [this]() { loadMeshes(); }, { parseMonkey, parseEmpire, images, indirect });
+
+	initGraph.addTask("scene", [this]() { initScene(); }, { pipelines, indirect, framebuffers, images, meshes });
+
+	initGraph.execute();
+
+	if (_shaderHotReload && !_headless && !_startupBenchmark)
+	{
+		initShaderReload();
+	}
 
-	loadImages();
-	loadMeshes();
-	initScene();
+	auto initEnd = std::chrono::high_resolution_clock::now();
+
+	initGraph.printTimeline("Init");
+	printf("Init done in %.2f ms, %.2f ms of it creating the window\n",
+		std::chrono::duration<double, std::milli>(initEnd - initStart).count(),
+		std::chrono::duration<double, std::milli>(windowEnd - initStart).count());
+	printf("Pipelines created in %.2f ms with a %s pipeline cache (%zu bytes loaded)\n",
+		_pipelineCreateMicroseconds.load() / 1000.0, _pipelineCacheLoadedSize > 0 ? "warm" : "cold", _pipelineCacheLoadedSize);
+
+	PipelineRegistryStats registryStats = _pipelineRegistry.getStats();
+	printf("Pipeline registry: %u pipelines from %u requests (%u deduplicated, %u failed), %.2f ms building\n",
+		registryStats.pipelines, registryStats.requests, registryStats.deduplicated, registryStats.failed, registryStats.buildTime);
 }
 
 void VulkanEngine::draw()
 {
-	ImGui::Render();
+	VK_PROFILE_FUNCTION();
+
+	applyReloadedPipelines();
+
+	if (!_headless)
+	{
+		VK_PROFILE_ZONE("ImGui::Render");
+		ImGui::Render();
+	}
+
+	if (!_gpuDriven)
+	{
+		cullRenderables(getCameraData().viewproj);
+		// the view matrix translates by _camPos before rotating, so the eye is -_camPos
+		sortRenderables(-_camPos);
+	}
 
 	FrameData& currentFrame = getCurrentFrame();
-	VK_CHECK(vkWaitForFences(_device, 1, &currentFrame._renderFence, true, 1000000000));
+
+	auto fenceStart = std::chrono::high_resolution_clock::now();
+	{
+		VK_PROFILE_ZONE("vkWaitForFences");
+		VK_CHECK(vkWaitForFences(_device, 1, &currentFrame._renderFence, true, 1000000000));
+	}
+	auto fenceEnd = std::chrono::high_resolution_clock::now();
 	VK_CHECK(vkResetFences(_device, 1, &currentFrame._renderFence));
 
-	uint32_t swapchainImageIndex;
-	VK_CHECK(vkAcquireNextImageKHR(_device, _swapchain, 1000000000, currentFrame._presentSemaphore, nullptr, &swapchainImageIndex));
+	_fenceWaitTime = std::chrono::duration<double, std::milli>(fenceEnd - fenceStart).count();
+
+	// the fence signals when the frame is handed to the presentation engine, the time to scanout on
+	// top of it would need VK_KHR_present_wait
+	_inputLatency = -1.0;
+	if (currentFrame.hasInput)
+	{
+		_inputLatency = std::chrono::duration<double, std::milli>(fenceEnd - currentFrame.inputTime).count();
+		_averageInputLatency = _averageInputLatency == 0.0 ? _inputLatency : _averageInputLatency * 0.9 + _inputLatency * 0.1;
+		currentFrame.hasInput = false;
+	}
+
+	// the fence covers the frame that last used this profiler, so its timestamps are
+	// available and are taken before beginFrame resets the pool
+	GpuProfiler& profiler = currentFrame.gpuProfiler;
+	_gpuTime = -1.0;
+	if (profiler.collect() && !profiler.getResults().empty())
+	{
+		_gpuScopes = profiler.getResults();
+		_gpuTime = _gpuScopes[0].time;
+		_gpuTimeFrame = profiler.getResultFrame();
+	}
+
+	if (_hasPendingInput)
+	{
+		currentFrame.inputTime = _pendingInputTime;
+		currentFrame.hasInput = true;
+		_hasPendingInput = false;
+	}
+
+	// offscreen images belong to their frame, so there is nothing to acquire
+	uint32_t swapchainImageIndex = static_cast<uint32_t>(_framenumber % _frames.size());
+	if (!_headless)
+	{
+		VK_PROFILE_ZONE("vkAcquireNextImageKHR");
+		VK_CHECK(vkAcquireNextImageKHR(_device, _swapchain, 1000000000, currentFrame._presentSemaphore, nullptr, &swapchainImageIndex));
+	}
 
 	VK_CHECK(vkResetCommandBuffer(currentFrame._mainCommandBuffer, 0));
 
@@ -1119,6 +2688,29 @@ void VulkanEngine::draw()
 
 	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
+	profiler.beginFrame(cmd, _framenumber);
+	profiler.beginScope(cmd, "frame");
+
+	// uploads recorded since the last frame are submitted now and acquired before any draw reads them,
+	// the copies run on the transfer queue so the scope only covers the acquire barriers
+	profiler.beginScope(cmd, "uploads");
+	_uploadManager.flush();
+	uint64_t uploadWaitValue = _uploadManager.acquireSubmitted(cmd);
+	profiler.endScope(cmd);
+
+	_uploadTime = 0.0;
+	_recordTime = 0.0;
+	_recordSliceCount = 0;
+	uploadFrameUniforms();
+
+	// culling writes the indirect commands, so it is recorded before the render pass
+	if (_gpuDriven)
+	{
+		profiler.beginScope(cmd, "cull");
+		cullIndirect(cmd);
+		profiler.endScope(cmd);
+	}
+
 	VkClearValue clearValue;
 	clearValue.color = { {0.0f, 0.0f, 0.0f, 1.0f} };
 
@@ -1139,43 +2731,155 @@ void VulkanEngine::draw()
 	rpBeginInfo.clearValueCount = 2;
 	rpBeginInfo.pClearValues = &clearValues[0];
 
-	vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	// timestamps inside the pass can only go into the secondaries, so the scene scope ends in the overlay
+	profiler.beginScope(cmd, "scene");
+
+	// everything inside the pass comes from secondaries, the CPU path records its slices in parallel
+	vkCmdBeginRenderPass(cmd, &rpBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	if (!_gpuDriven)
+	{
+		drawObjects(cmd, rpBeginInfo.framebuffer, _renderables.data(), _drawOrder.data(), _drawOrder.size());
+	}
+
+	VkCommandBuffer overlay = currentFrame._overlayCommandBuffer;
+	beginSecondary(overlay, rpBeginInfo.framebuffer);
+
+	if (_gpuDriven)
+	{
+		drawIndirect(overlay);
+	}
 
-	drawObjects(cmd, _renderables.data(), _renderables.size());
+	profiler.endScope(overlay);
+
+	if (!_headless)
+	{
+		profiler.beginScope(overlay, "imgui");
+		ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), overlay);
+		profiler.endScope(overlay);
+	}
 
-	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd);
+	VK_CHECK(vkEndCommandBuffer(overlay));
+	vkCmdExecuteCommands(cmd, 1, &overlay);
 
 	vkCmdEndRenderPass(cmd);
+
+	const bool readback = _headless && _readbackRequested;
+	if (readback)
+	{
+		profiler.beginScope(cmd, "readback");
+
+		VkBufferImageCopy copyRegion = {};
+		copyRegion.bufferOffset = 0;
+		copyRegion.bufferRowLength = 0;
+		copyRegion.bufferImageHeight = 0;
+		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copyRegion.imageSubresource.mipLevel = 0;
+		copyRegion.imageSubresource.baseArrayLayer = 0;
+		copyRegion.imageSubresource.layerCount = 1;
+		copyRegion.imageExtent = { _windowExtent.width, _windowExtent.height, 1 };
+
+		vkCmdCopyImageToBuffer(cmd, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, _readbackBuffer._buffer, 1, &copyRegion);
+
+		VkBufferMemoryBarrier hostBarrier = {};
+		hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		hostBarrier.pNext = nullptr;
+		hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		hostBarrier.buffer = _readbackBuffer._buffer;
+		hostBarrier.offset = 0;
+		hostBarrier.size = VK_WHOLE_SIZE;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &hostBarrier, 0, nullptr);
+
+		profiler.endScope(cmd);
+	}
+
+	profiler.endScope(cmd);
+
 	VK_CHECK(vkEndCommandBuffer(cmd));
 
 	VkSubmitInfo submit = {};
 	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submit.pNext = nullptr;
 
-	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	submit.pWaitDstStageMask = &waitStage;
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &currentFrame._presentSemaphore;
-	submit.signalSemaphoreCount = 1;
+	VkPipelineStageFlags waitStages[2] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+	VkSemaphore waitSemaphores[2] = { currentFrame._presentSemaphore, _uploadManager.getSemaphore() };
+	// the binary present semaphore ignores its value
+	uint64_t waitValues[2] = { 0, uploadWaitValue };
+
+	// headless frames acquire nothing, so their waits start at the upload semaphore
+	const uint32_t firstWait = _headless ? 1 : 0;
+	const uint32_t waitCount = (uploadWaitValue != 0 ? 2 : 1) - firstWait;
+
+	submit.pWaitDstStageMask = waitStages + firstWait;
+	submit.waitSemaphoreCount = waitCount;
+	submit.pWaitSemaphores = waitSemaphores + firstWait;
+
+	VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	timelineInfo.pNext = nullptr;
+	timelineInfo.waitSemaphoreValueCount = waitCount;
+	timelineInfo.pWaitSemaphoreValues = waitValues + firstWait;
+
+	if (uploadWaitValue != 0)
+	{
+		submit.pNext = &timelineInfo;
+	}
+	submit.signalSemaphoreCount = _headless ? 0 : 1;
 	submit.pSignalSemaphores = &currentFrame._renderSemaphore;
 	submit.commandBufferCount = 1;
 	submit.pCommandBuffers = &cmd;
 
-	VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, currentFrame._renderFence));
+	{
+		VK_PROFILE_ZONE("vkQueueSubmit");
+		VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, currentFrame._renderFence));
+	}
+
+	if (_headless)
+	{
+		// the present step becomes the optional readback, the frame is waited for right away
+		if (readback)
+		{
+			VK_PROFILE_ZONE("readback");
+			VK_CHECK(vkWaitForFences(_device, 1, &currentFrame._renderFence, true, UINT64_MAX));
+			VK_CHECK(vmaInvalidateAllocation(_allocator, _readbackBuffer._allocation, 0, VK_WHOLE_SIZE));
+
+			// B8G8R8A8 to tightly packed RGBA8
+			const uint8_t* source = static_cast<const uint8_t*>(_readbackBuffer._mapped);
+			const size_t pixelCount = size_t(_windowExtent.width) * _windowExtent.height;
+
+			_readbackPixels.resize(pixelCount * 4);
+			for (size_t i = 0; i < pixelCount; i++)
+			{
+				_readbackPixels[i * 4 + 0] = source[i * 4 + 2];
+				_readbackPixels[i * 4 + 1] = source[i * 4 + 1];
+				_readbackPixels[i * 4 + 2] = source[i * 4 + 0];
+				_readbackPixels[i * 4 + 3] = source[i * 4 + 3];
+			}
 
-	VkPresentInfoKHR presentInfo = {};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.pNext = nullptr;
+			_readbackRequested = false;
+		}
+	}
+	else
+	{
+		VkPresentInfoKHR presentInfo = {};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.pNext = nullptr;
 
-	presentInfo.pSwapchains = &_swapchain;
-	presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &_swapchain;
+		presentInfo.swapchainCount = 1;
 
-	presentInfo.pWaitSemaphores = &currentFrame._renderSemaphore;
-	presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &currentFrame._renderSemaphore;
+		presentInfo.waitSemaphoreCount = 1;
 
-	presentInfo.pImageIndices = &swapchainImageIndex;
+		presentInfo.pImageIndices = &swapchainImageIndex;
 
-	VK_CHECK(vkQueuePresentKHR(_graphicsQueue, &presentInfo));
+		VK_PROFILE_ZONE("vkQueuePresentKHR");
+		VK_CHECK(vkQueuePresentKHR(_graphicsQueue, &presentInfo));
+	}
 
 	_framenumber += 1;
 }
@@ -1187,74 +2891,246 @@ void VulkanEngine::run()
 
 	while (!isQuit)
 	{
+		VK_PROFILE_FRAME();
+
 		// handling events
-		while (SDL_PollEvent(&event) != 0)
 		{
-			ImGui_ImplSDL2_ProcessEvent(&event);
-
-			if (event.type == SDL_QUIT)
+			VK_PROFILE_ZONE("SDL_PollEvent");
+			while (SDL_PollEvent(&event) != 0)
 			{
-				isQuit = true;
-			}
-			else if (event.type == SDL_KEYDOWN)
-			{
-				if (event.key.keysym.sym == SDLK_SPACE)
-				{
-					_selectedShader += 1;
-					if (_selectedShader > 2)
-					{
-						_selectedShader = 0;
-					}
-				}
-				if (event.key.keysym.sym == SDLK_w)
-				{
-					_camPos.z += 3.0f;
-				}
-				if (event.key.keysym.sym == SDLK_s)
-				{
-					_camPos.z -= 3.0f;
-				}
-				if (event.key.keysym.sym == SDLK_a)
-				{
-					_camPos.x += 3.0f;
-				}
-				if (event.key.keysym.sym == SDLK_d)
+				ImGui_ImplSDL2_ProcessEvent(&event);
+
+				// the oldest input not consumed by a frame yet
+				if (!_hasPendingInput && (event.type == SDL_KEYDOWN || event.type == SDL_MOUSEBUTTONDOWN || event.type == SDL_MOUSEMOTION))
 				{
-					_camPos.x -= 3.0f;
+					_pendingInputTime = std::chrono::high_resolution_clock::now();
+					_hasPendingInput = true;
 				}
-				if (event.key.keysym.sym == SDLK_SPACE)
+
+				if (event.type == SDL_QUIT)
 				{
-					_camPos.y -= 2.0f;
+					isQuit = true;
 				}
-				if (event.key.keysym.sym == SDLK_LSHIFT)
+				else if (event.type == SDL_KEYDOWN)
 				{
-					_camPos.y += 2.0f;
+					if (event.key.keysym.sym == SDLK_SPACE)
+					{
+						_selectedShader += 1;
+						if (_selectedShader > 2)
+						{
+							_selectedShader = 0;
+						}
+					}
+					if (event.key.keysym.sym == SDLK_w)
+					{
+						_camPos.z += 3.0f;
+					}
+					if (event.key.keysym.sym == SDLK_s)
+					{
+						_camPos.z -= 3.0f;
+					}
+					if (event.key.keysym.sym == SDLK_a)
+					{
+						_camPos.x += 3.0f;
+					}
+					if (event.key.keysym.sym == SDLK_d)
+					{
+						_camPos.x -= 3.0f;
+					}
+					if (event.key.keysym.sym == SDLK_SPACE)
+					{
+						_camPos.y -= 2.0f;
+					}
+					if (event.key.keysym.sym == SDLK_LSHIFT)
+					{
+						_camPos.y += 2.0f;
+					}
+					if (event.key.keysym.sym == SDLK_g && _gpuDrivenSupported)
+					{
+						_gpuDriven = !_gpuDriven;
+					}
 				}
 			}
 		}
 
-		ImGui_ImplVulkan_NewFrame();
-		ImGui_ImplSDL2_NewFrame(_window);
-
-		ImGui::NewFrame();
+		{
+			VK_PROFILE_ZONE("ImGui::NewFrame");
+			ImGui_ImplVulkan_NewFrame();
+			ImGui_ImplSDL2_NewFrame(_window);
+			ImGui::NewFrame();
+		}
 
 		ImGui::ShowDemoWindow();
 
+		ImGui::Begin("Culling");
+		if (_gpuDrivenSupported)
+		{
+			ImGui::Checkbox("GPU driven (G)", &_gpuDriven);
+			ImGui::Text("%s", _drawIndirectCountSupported ? "draw indirect count" : "fixed count indirect");
+		}
+		ImGui::Text("%s path", vkCull::getCullPathName(vkCull::getBestCullPath()));
+		ImGui::Text("%zu / %zu objects visible", _visibleRenderables.size(), _renderables.size());
+		ImGui::Text("cull %.3f ms, sort %.3f ms, upload %.3f ms", _cullTime, _sortTime, _uploadTime);
+		ImGui::Text("record %.3f ms on %u slices", _recordTime, _recordSliceCount);
+		ImGui::Text("%u frames in flight, %zu images (min %u), %s", static_cast<uint32_t>(_frames.size()), _swapchainImages.size(),
+			_swapchainMinImageCount, getPresentModeName(_swapchainPresentMode));
+		ImGui::Text("fence wait %.3f ms, input to present %.2f ms", _fenceWaitTime, _averageInputLatency);
+		ImGui::Text("%u draws for %u objects, %llu triangles", _drawStats.draws, _drawStats.objects, (unsigned long long)_drawStats.triangles);
+		ImGui::Text("%u pipeline binds", _drawStats.pipelineBinds);
+		ImGui::Text("%u descriptor binds", _drawStats.descriptorBinds);
+		ImGui::Text("%u vertex buffer binds", _drawStats.vertexBufferBinds);
+
+		UploadStats uploadStats = _uploadManager.getStats();
+		ImGui::Text("staging %.1f / %.1f MB (peak %.1f), %llu stalls", uploadStats.ringUsed / (1024.0 * 1024.0),
+			uploadStats.ringCapacity / (1024.0 * 1024.0), uploadStats.ringPeakUsed / (1024.0 * 1024.0), (unsigned long long)uploadStats.stalls);
+		ImGui::End();
+
+		ImGui::Begin("GPU");
+		if (!_timestampsSupported)
+		{
+			ImGui::Text("timestamps are not supported");
+		}
+		else
+		{
+			ImGui::Text("frame %u", _gpuTimeFrame);
+			for (const GpuScopeResult& scope : _gpuScopes)
+			{
+				ImGui::Text("%*s%s %.3f ms", static_cast<int>(scope.depth * 2), "", scope.name, scope.time);
+			}
+		}
+		ImGui::End();
+
+		drawProfilerUi();
+
 		draw();
 	}
 }
 
+void VulkanEngine::drawProfilerUi()
+{
+	ImGui::Begin("CPU profiler");
+
+	bool enabled = vkProf::isEnabled();
+	if (ImGui::Checkbox("record zones", &enabled))
+	{
+		vkProf::setEnabled(enabled);
+	}
+
+	ImGui::SameLine();
+	if (ImGui::Button("save trace"))
+	{
+		vkProf::writeChromeTrace(_tracePath != nullptr ? _tracePath : "trace.json");
+	}
+
+	vkProf::Ticks frameBegin = 0;
+	vkProf::Ticks frameEnd = 0;
+	if (!vkProf::getLastFrame(frameBegin, frameEnd) || frameEnd <= frameBegin)
+	{
+		ImGui::End();
+		return;
+	}
+
+	const double frameTicks = double(frameEnd - frameBegin);
+	const double msPerTick = vkProf::getNanosecondsPerTick() / 1000000.0;
+	ImGui::Text("last frame %.3f ms", frameTicks * msPerTick);
+
+	// one flame graph per thread, zones that began in the frame before are clipped to its start
+	const std::vector<vkProf::ZoneEvent> zones = vkProf::collect(frameBegin, frameEnd);
+	const std::vector<vkProf::ThreadInfo> threads = vkProf::getThreads();
+
+	const float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+	ImDrawList* drawList = ImGui::GetWindowDrawList();
+
+	for (const vkProf::ThreadInfo& thread : threads)
+	{
+		uint32_t maxDepth = 0;
+		bool hasZones = false;
+		for (const vkProf::ZoneEvent& zone : zones)
+		{
+			if (zone.thread == thread.id)
+			{
+				maxDepth = std::max(maxDepth, zone.depth);
+				hasZones = true;
+			}
+		}
+
+		if (!hasZones)
+		{
+			continue;
+		}
+
+		ImGui::Text("%s", thread.name.c_str());
+
+		const ImVec2 origin = ImGui::GetCursorScreenPos();
+		const float width = std::max(1.0f, ImGui::GetContentRegionAvail().x);
+		ImGui::PushID(static_cast<int>(thread.id));
+		ImGui::InvisibleButton("zones", ImVec2(width, rowHeight * (maxDepth + 1)));
+		ImGui::PopID();
+
+		for (const vkProf::ZoneEvent& zone : zones)
+		{
+			if (zone.thread != thread.id)
+			{
+				continue;
+			}
+
+			const double start = double(std::max(zone.start, frameBegin) - frameBegin) / frameTicks;
+			const double end = double(zone.end - frameBegin) / frameTicks;
+
+			const ImVec2 min(origin.x + float(start) * width, origin.y + zone.depth * rowHeight);
+			const ImVec2 max(std::max(min.x + 1.0f, origin.x + float(end) * width), min.y + rowHeight - 1.0f);
+
+			const size_t hash = std::hash<const void*>()(zone.name);
+			drawList->AddRectFilled(min, max, IM_COL32(90 + hash % 110, 90 + (hash >> 8) % 110, 140 + (hash >> 16) % 110, 255));
+
+			if (ImGui::CalcTextSize(zone.name).x < max.x - min.x)
+			{
+				drawList->AddText(ImVec2(min.x + 2.0f, min.y), IM_COL32(0, 0, 0, 255), zone.name);
+			}
+
+			if (ImGui::IsMouseHoveringRect(min, max))
+			{
+				ImGui::SetTooltip("%s %.3f ms", zone.name, double(zone.end - zone.start) * msPerTick);
+			}
+		}
+	}
+
+	ImGui::End();
+}
+
 void VulkanEngine::cleanup()
 {
+	// a rebuild in progress still uses the device and the pipeline cache
+	_shaderReloader.stop();
+
 	// wait till GPU finishes
 	vkDeviceWaitIdle(_device);
 
+	for (const RetiredPipeline& retired : _retiredPipelines)
+	{
+		vkDestroyPipeline(_device, retired.pipeline, nullptr);
+	}
+
+	if (_tracePath != nullptr)
+	{
+		vkProf::writeChromeTrace(_tracePath);
+	}
+
+	// the deletion queue destroys the cache, so its data is taken first
+	if (_pipelineCachePath != nullptr && !vkCache::savePipelineCache(_device, _pipelineCache, _pipelineCachePath))
+	{
+		std::cout << "Failed to write the pipeline cache to " << _pipelineCachePath << "\n";
+	}
+
 	_mainDeleteionQueue.flush();
 
 	vmaDestroyAllocator(_allocator);
 
 	vkDestroyDevice(_device, nullptr);
-	vkDestroySurfaceKHR(_instance, _surface, nullptr);
+	if (_surface != VK_NULL_HANDLE)
+	{
+		vkDestroySurfaceKHR(_instance, _surface, nullptr);
+	}
 	vkb::destroy_debug_utils_messenger(_instance, _debugMessenger);
 	vkDestroyInstance(_instance, nullptr);
 
@@ -1263,55 +3139,3 @@ void VulkanEngine::cleanup()
 		SDL_DestroyWindow(_window);
 	}
 }
-
-VkPipeline PipelineBuilder::buildPipeline(VkDevice device, VkRenderPass pass)
-{
-	VkPipelineViewportStateCreateInfo viewportState = {};
-	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportState.pNext = nullptr;
-
-	viewportState.viewportCount = 1;
-	viewportState.pViewports = &_viewport;
-	viewportState.scissorCount = 1;
-	viewportState.pScissors = &_scissor;
-
-	VkPipelineColorBlendStateCreateInfo colorBlending = {};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlending.pNext = nullptr;
-
-	colorBlending.logicOpEnable = VK_FALSE;
-	colorBlending.logicOp = VK_LOGIC_OP_COPY;
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &_colorBlendAttachment;
-
-	VkGraphicsPipelineCreateInfo pipelineInfo = {};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.pNext = nullptr;
-
-	pipelineInfo.stageCount = _shaderStages.size();
-	pipelineInfo.pStages = _shaderStages.data();
-	pipelineInfo.pVertexInputState = &_vertexInputInfo;
-	pipelineInfo.pInputAssemblyState = &_inputAssembly;
-	pipelineInfo.pViewportState = &viewportState;
-	pipelineInfo.pRasterizationState = &_rasterizer;
-	pipelineInfo.pMultisampleState = &_multisampling;
-	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.layout = _pipelineLayout;
-	pipelineInfo.renderPass = pass;
-	pipelineInfo.subpass = 0;
-	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-	pipelineInfo.pDepthStencilState = &_depthStencil;
-
-	VkPipeline newPipeline;
-	if (vkCreateGraphicsPipelines(
-		device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &newPipeline
-	) != VK_SUCCESS)
-	{
-		std::cout << "Failed to create pipeline\n";
-		return VK_NULL_HANDLE;
-	}
-	else
-	{
-		return newPipeline;
-	}
-}
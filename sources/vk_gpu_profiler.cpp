@@ -0,0 +1,129 @@
+#include "vk_gpu_profiler.hpp"
+
+#include "vk_check.hpp"
+
+void GpuProfiler::init(VkDevice device, const VkPhysicalDeviceProperties& properties, uint32_t timestampValidBits, uint32_t maxScopes)
+{
+	_device = device;
+	_maxScopes = maxScopes;
+	_period = properties.limits.timestampPeriod;
+	_validMask = timestampValidBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << timestampValidBits) - 1;
+
+	if (properties.limits.timestampComputeAndGraphics != VK_TRUE || timestampValidBits == 0)
+	{
+		return;
+	}
+
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.pNext = nullptr;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = _maxScopes * 2;
+
+	VK_CHECK(vkCreateQueryPool(_device, &queryPoolInfo, nullptr, &_queryPool));
+
+	_scopes.reserve(_maxScopes);
+	_results.reserve(_maxScopes);
+}
+
+void GpuProfiler::cleanup()
+{
+	if (_queryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(_device, _queryPool, nullptr);
+		_queryPool = VK_NULL_HANDLE;
+	}
+}
+
+bool GpuProfiler::collect()
+{
+	if (!_recorded)
+	{
+		return false;
+	}
+
+	_recorded = false;
+	_results.clear();
+
+	for (uint32_t i = 0; i < _scopes.size(); i++)
+	{
+		if (!_scopes[i].ended)
+		{
+			continue;
+		}
+
+		// no WAIT_BIT, a scope that is somehow not available yet is skipped instead of stalling
+		uint64_t timestamps[2];
+		VkResult result = vkGetQueryPoolResults(_device, _queryPool, i * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT);
+
+		if (result != VK_SUCCESS)
+		{
+			continue;
+		}
+
+		GpuScopeResult scope;
+		scope.name = _scopes[i].name;
+		scope.depth = _scopes[i].depth;
+		scope.time = double((timestamps[1] - timestamps[0]) & _validMask) * _period / 1000000.0;
+		_results.push_back(scope);
+	}
+
+	_resultFrame = _frameNumber;
+
+	return true;
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer cmd, unsigned int frameNumber)
+{
+	if (_queryPool == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	vkCmdResetQueryPool(cmd, _queryPool, 0, _maxScopes * 2);
+
+	_scopes.clear();
+	_openScopes.clear();
+	_recorded = true;
+	_frameNumber = frameNumber;
+}
+
+void GpuProfiler::beginScope(VkCommandBuffer cmd, const char* name, VkPipelineStageFlagBits stage)
+{
+	if (_queryPool == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	if (_scopes.size() >= _maxScopes || (!_openScopes.empty() && _openScopes.back() == UINT32_MAX))
+	{
+		_openScopes.push_back(UINT32_MAX);
+		return;
+	}
+
+	const uint32_t index = static_cast<uint32_t>(_scopes.size());
+	_scopes.push_back({ name, static_cast<uint32_t>(_openScopes.size()), false });
+	_openScopes.push_back(index);
+
+	vkCmdWriteTimestamp(cmd, stage, _queryPool, index * 2);
+}
+
+void GpuProfiler::endScope(VkCommandBuffer cmd, VkPipelineStageFlagBits stage)
+{
+	if (_queryPool == VK_NULL_HANDLE || _openScopes.empty())
+	{
+		return;
+	}
+
+	const uint32_t index = _openScopes.back();
+	_openScopes.pop_back();
+
+	if (index == UINT32_MAX)
+	{
+		return;
+	}
+
+	vkCmdWriteTimestamp(cmd, stage, _queryPool, index * 2 + 1);
+	_scopes[index].ended = true;
+}
@@ -35,6 +35,21 @@ VkCommandBufferBeginInfo vkInit::commandBufferBeginInfo(VkCommandBufferUsageFlag
     return info;
 }
 
+VkCommandBufferInheritanceInfo vkInit::commandBufferInheritanceInfo(VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer)
+{
+    VkCommandBufferInheritanceInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    info.pNext = nullptr;
+    info.renderPass = renderPass;
+    info.subpass = subpass;
+    info.framebuffer = framebuffer;
+    info.occlusionQueryEnable = VK_FALSE;
+    info.queryFlags = 0;
+    info.pipelineStatistics = 0;
+
+    return info;
+}
+
 VkSubmitInfo vkInit::submitInfo(VkCommandBuffer* cmd)
 {
     VkSubmitInfo info = {};
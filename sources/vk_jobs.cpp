@@ -0,0 +1,670 @@
+#include "vk_jobs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+#include "vk_profiler.hpp"
+
+struct vkJobs::Job
+{
+	std::function<void()> function;
+	JobCounter* counter;
+};
+
+namespace
+{
+	thread_local vkJobs::JobSystem* tlsSystem = nullptr;
+	thread_local int32_t tlsWorkerIndex = -1;
+
+	// xorshift, only picks the first steal victim
+	uint32_t nextRandom(uint32_t& state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	vkJobs::JobSystem& getGlobalSystem()
+	{
+		static vkJobs::JobSystem system;
+		return system;
+	}
+
+	std::once_flag globalInitFlag;
+}
+
+/*
+Define deque functions
+*/
+
+// the job pointer is stored with release and loaded with acquire, so the job a thief takes is
+// fully constructed without relying on standalone fences alone (ThreadSanitizer does not model those)
+bool vkJobs::WorkStealingDeque::push(Job* job)
+{
+	const int64_t bottom = _bottom.load(std::memory_order_relaxed);
+	const int64_t top = _top.load(std::memory_order_acquire);
+
+	if (bottom - top >= CAPACITY)
+	{
+		return false;
+	}
+
+	_buffer[bottom & (CAPACITY - 1)].store(job, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_release);
+	_bottom.store(bottom + 1, std::memory_order_release);
+
+	return true;
+}
+
+vkJobs::Job* vkJobs::WorkStealingDeque::pop()
+{
+	const int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+	_bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t top = _top.load(std::memory_order_relaxed);
+
+	if (top > bottom)
+	{
+		_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job* job = _buffer[bottom & (CAPACITY - 1)].load(std::memory_order_acquire);
+
+	if (top == bottom)
+	{
+		// the last job, a thief may be taking it at the same time
+		if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			job = nullptr;
+		}
+
+		_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+
+	return job;
+}
+
+vkJobs::Job* vkJobs::WorkStealingDeque::steal()
+{
+	int64_t top = _top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const int64_t bottom = _bottom.load(std::memory_order_acquire);
+
+	if (top >= bottom)
+	{
+		return nullptr;
+	}
+
+	Job* job = _buffer[top & (CAPACITY - 1)].load(std::memory_order_acquire);
+
+	if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+		return nullptr;
+	}
+
+	return job;
+}
+
+size_t vkJobs::WorkStealingDeque::size() const
+{
+	const int64_t bottom = _bottom.load(std::memory_order_relaxed);
+	const int64_t top = _top.load(std::memory_order_relaxed);
+
+	return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+}
+
+/*
+Define job system functions
+*/
+
+vkJobs::JobSystem::~JobSystem()
+{
+	shutdown();
+}
+
+void vkJobs::JobSystem::init(uint32_t threadCount)
+{
+	shutdown();
+
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	_workers.clear();
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		_workers.push_back(std::make_unique<Worker>());
+		_workers[i]->random = 0x9E3779B9u * (i + 1);
+	}
+
+	_initThread = std::this_thread::get_id();
+	_previousSystem = tlsSystem;
+	_previousWorkerIndex = tlsWorkerIndex;
+
+	tlsSystem = this;
+	tlsWorkerIndex = 0;
+
+	_running.store(true, std::memory_order_release);
+
+	for (uint32_t i = 1; i < threadCount; i++)
+	{
+		_workers[i]->thread = std::thread(&JobSystem::workerLoop, this, i);
+	}
+}
+
+void vkJobs::JobSystem::shutdown()
+{
+	if (!_running.exchange(false))
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_sleepMutex);
+		_wake.notify_all();
+	}
+
+	for (std::unique_ptr<Worker>& worker : _workers)
+	{
+		if (worker->thread.joinable())
+		{
+			worker->thread.join();
+		}
+	}
+
+	_workers.clear();
+
+	for (Job* job : _injection)
+	{
+		delete job;
+	}
+
+	_injection.clear();
+	_injectionSize = 0;
+
+	if (std::this_thread::get_id() == _initThread)
+	{
+		tlsSystem = _previousSystem;
+		tlsWorkerIndex = _previousWorkerIndex;
+	}
+}
+
+int32_t vkJobs::JobSystem::getWorkerIndex() const
+{
+	return tlsSystem == this ? tlsWorkerIndex : -1;
+}
+
+void vkJobs::JobSystem::submit(std::function<void()>&& function, JobCounter* counter)
+{
+	Job* job = new Job{ std::move(function), counter };
+
+	if (counter != nullptr)
+	{
+		counter->_pending.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	const int32_t workerIndex = getWorkerIndex();
+
+	if (workerIndex >= 0)
+	{
+		if (!_workers[workerIndex]->deque.push(job))
+		{
+			_workers[workerIndex]->inlined.fetch_add(1, std::memory_order_relaxed);
+			execute(job, workerIndex);
+			return;
+		}
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(_injectionMutex);
+		_injection.push_back(job);
+		_injectionSize.fetch_add(1, std::memory_order_release);
+	}
+
+	if (_sleeping.load(std::memory_order_acquire) > 0)
+	{
+		std::lock_guard<std::mutex> lock(_sleepMutex);
+		_wake.notify_one();
+	}
+}
+
+vkJobs::Job* vkJobs::JobSystem::findJob(int32_t workerIndex)
+{
+	Worker* self = workerIndex >= 0 ? _workers[workerIndex].get() : nullptr;
+
+	if (self != nullptr)
+	{
+		if (Job* job = self->deque.pop())
+		{
+			return job;
+		}
+	}
+
+	if (_injectionSize.load(std::memory_order_acquire) > 0)
+	{
+		std::lock_guard<std::mutex> lock(_injectionMutex);
+		if (!_injection.empty())
+		{
+			Job* job = _injection.front();
+			_injection.pop_front();
+			_injectionSize.fetch_sub(1, std::memory_order_relaxed);
+			return job;
+		}
+	}
+
+	const uint32_t workerCount = static_cast<uint32_t>(_workers.size());
+	static thread_local uint32_t externalRandom = 0x2545F491u;
+	const uint32_t first = nextRandom(self != nullptr ? self->random : externalRandom) % workerCount;
+
+	for (uint32_t i = 0; i < workerCount; i++)
+	{
+		const uint32_t victim = (first + i) % workerCount;
+		if (static_cast<int32_t>(victim) == workerIndex)
+		{
+			continue;
+		}
+
+		if (self != nullptr)
+		{
+			self->stealAttempts.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		if (Job* job = _workers[victim]->deque.steal())
+		{
+			if (self != nullptr)
+			{
+				self->stolen.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			return job;
+		}
+	}
+
+	return nullptr;
+}
+
+void vkJobs::JobSystem::execute(Job* job, int32_t workerIndex)
+{
+	job->function();
+
+	if (job->counter != nullptr)
+	{
+		job->counter->_pending.fetch_sub(1, std::memory_order_release);
+	}
+
+	if (workerIndex >= 0)
+	{
+		_workers[workerIndex]->executed.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	delete job;
+}
+
+void vkJobs::JobSystem::workerLoop(uint32_t index)
+{
+	tlsSystem = this;
+	tlsWorkerIndex = static_cast<int32_t>(index);
+
+	vkProf::setThreadName(("job worker " + std::to_string(index)).c_str());
+
+	uint32_t idleRounds = 0;
+
+	while (_running.load(std::memory_order_acquire))
+	{
+		if (Job* job = findJob(static_cast<int32_t>(index)))
+		{
+			execute(job, static_cast<int32_t>(index));
+			idleRounds = 0;
+			continue;
+		}
+
+		if (++idleRounds < 64)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		// the timeout covers a submit that checked _sleeping just before this thread incremented it
+		std::unique_lock<std::mutex> lock(_sleepMutex);
+		_sleeping.fetch_add(1, std::memory_order_acq_rel);
+		_wake.wait_for(lock, std::chrono::microseconds(500));
+		_sleeping.fetch_sub(1, std::memory_order_acq_rel);
+		idleRounds = 0;
+	}
+
+	tlsSystem = nullptr;
+	tlsWorkerIndex = -1;
+}
+
+void vkJobs::JobSystem::wait(JobCounter& counter)
+{
+	const int32_t workerIndex = getWorkerIndex();
+
+	while (!counter.isDone())
+	{
+		if (Job* job = findJob(workerIndex))
+		{
+			execute(job, workerIndex);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void vkJobs::JobSystem::parallelFor(size_t count, size_t minGrain, const std::function<void(size_t begin, size_t end)>& body)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	const size_t threadCount = std::max<size_t>(1, _workers.size());
+	const size_t grain = std::max(std::max<size_t>(1, minGrain), (count + threadCount * 4 - 1) / (threadCount * 4));
+
+	if (count <= grain || threadCount == 1)
+	{
+		body(0, count);
+		return;
+	}
+
+	JobCounter counter;
+
+	// the upper half is handed out and the lower half split again, so thieves take the largest ranges first
+	std::function<void(size_t, size_t)> split = [&](size_t begin, size_t end) {
+		while (end - begin > grain)
+		{
+			const size_t middle = begin + (end - begin) / 2;
+			submit([&split, middle, end]() { split(middle, end); }, &counter);
+			end = middle;
+		}
+
+		body(begin, end);
+	};
+
+	split(0, count);
+	wait(counter);
+}
+
+vkJobs::JobStats vkJobs::JobSystem::getStats() const
+{
+	JobStats stats;
+
+	for (const std::unique_ptr<Worker>& worker : _workers)
+	{
+		stats.executed += worker->executed.load(std::memory_order_relaxed);
+		stats.stolen += worker->stolen.load(std::memory_order_relaxed);
+		stats.stealAttempts += worker->stealAttempts.load(std::memory_order_relaxed);
+		stats.inlined += worker->inlined.load(std::memory_order_relaxed);
+	}
+
+	return stats;
+}
+
+void vkJobs::JobSystem::resetStats()
+{
+	for (std::unique_ptr<Worker>& worker : _workers)
+	{
+		worker->executed = 0;
+		worker->stolen = 0;
+		worker->stealAttempts = 0;
+		worker->inlined = 0;
+	}
+}
+
+vkJobs::JobSystem& vkJobs::getGlobal()
+{
+	std::call_once(globalInitFlag, []() {
+		getGlobalSystem().init(0);
+	});
+
+	return getGlobalSystem();
+}
+
+void vkJobs::initGlobal(uint32_t threadCount)
+{
+	std::call_once(globalInitFlag, []() {});
+
+	getGlobalSystem().init(threadCount);
+}
+
+/*
+Define benchmark and stress test functions
+*/
+
+void vkJobs::benchmarkJobs(uint32_t maxThreadCount)
+{
+	using Clock = std::chrono::high_resolution_clock;
+
+	if (maxThreadCount == 0)
+	{
+		maxThreadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	const size_t itemCount = 1 << 22;
+	const size_t spawnCount = 100000;
+	const int iterations = 10;
+
+	std::vector<float> input(itemCount);
+	std::vector<float> output(itemCount);
+	for (size_t i = 0; i < itemCount; i++)
+	{
+		input[i] = static_cast<float>(i % 1000) * 0.01f;
+	}
+
+	double baseComputeTime = 0.0;
+	double baseSpawnTime = 0.0;
+
+	for (uint32_t threadCount = 1; ; threadCount = std::min(threadCount * 2, maxThreadCount))
+	{
+		JobSystem jobs;
+		jobs.init(threadCount);
+
+		auto start = Clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			jobs.parallelFor(itemCount, 1024, [&](size_t begin, size_t end) {
+				for (size_t j = begin; j < end; j++)
+				{
+					output[j] = std::sqrt(input[j]) * std::sin(input[j]) + std::cos(input[j] * 0.5f);
+				}
+			});
+		}
+		double computeTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+
+		jobs.resetStats();
+
+		start = Clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			JobCounter counter;
+			std::atomic<size_t> sum{ 0 };
+			for (size_t j = 0; j < spawnCount; j++)
+			{
+				jobs.submit([&sum, j]() { sum.fetch_add(j, std::memory_order_relaxed); }, &counter);
+			}
+			jobs.wait(counter);
+		}
+		double spawnTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+
+		JobStats stats = jobs.getStats();
+
+		if (threadCount == 1)
+		{
+			baseComputeTime = computeTime;
+			baseSpawnTime = spawnTime;
+		}
+
+		std::cout << threadCount << " threads : parallelFor " << computeTime << " ms (" << baseComputeTime / computeTime << "x), "
+			<< spawnCount << " jobs " << spawnTime << " ms (" << baseSpawnTime / spawnTime << "x, "
+			<< spawnCount / (spawnTime * 1000.0) << " M jobs/s), "
+			<< stats.stolen << " / " << stats.stealAttempts << " steals, " << stats.inlined << " inlined\n";
+
+		if (threadCount == maxThreadCount)
+		{
+			break;
+		}
+	}
+}
+
+bool vkJobs::stressTestJobs(uint32_t iterations)
+{
+	bool passed = true;
+
+	// at least four threads so the races happen even on small machines
+	const uint32_t threadCount = std::max(4u, std::thread::hardware_concurrency());
+
+	for (uint32_t iteration = 0; iteration < iterations && passed; iteration++)
+	{
+		// one owner pushing and popping against three thieves, every job must be taken exactly once
+		{
+			const size_t jobCount = 100000;
+			std::vector<Job> jobs(jobCount);
+			std::vector<std::atomic<uint32_t>> taken(jobCount);
+			for (size_t i = 0; i < jobCount; i++)
+			{
+				jobs[i].counter = nullptr;
+				taken[i] = 0;
+			}
+
+			WorkStealingDeque deque;
+			std::atomic<bool> ownerDone{ false };
+
+			auto take = [&](Job* job) {
+				taken[job - jobs.data()].fetch_add(1, std::memory_order_relaxed);
+			};
+
+			std::vector<std::thread> thieves;
+			for (int t = 0; t < 3; t++)
+			{
+				thieves.emplace_back([&]() {
+					while (!ownerDone.load(std::memory_order_acquire) || deque.size() > 0)
+					{
+						if (Job* job = deque.steal())
+						{
+							take(job);
+						}
+					}
+				});
+			}
+
+			for (size_t i = 0; i < jobCount; i++)
+			{
+				while (!deque.push(&jobs[i]))
+				{
+					if (Job* job = deque.pop())
+					{
+						take(job);
+					}
+				}
+
+				if (i % 3 == 0)
+				{
+					if (Job* job = deque.pop())
+					{
+						take(job);
+					}
+				}
+			}
+
+			while (Job* job = deque.pop())
+			{
+				take(job);
+			}
+
+			ownerDone.store(true, std::memory_order_release);
+			for (std::thread& thief : thieves)
+			{
+				thief.join();
+			}
+
+			for (size_t i = 0; i < jobCount; i++)
+			{
+				if (taken[i].load() != 1)
+				{
+					std::cout << "deque : job " << i << " taken " << taken[i].load() << " times\n";
+					passed = false;
+					break;
+				}
+			}
+		}
+
+		JobSystem system;
+		system.init(threadCount);
+
+		// nested parallelFor, every index must be visited exactly once
+		{
+			const size_t outerCount = 512;
+			const size_t innerCount = 257;
+			std::vector<std::atomic<uint32_t>> visits(outerCount * innerCount);
+			for (std::atomic<uint32_t>& visit : visits)
+			{
+				visit = 0;
+			}
+
+			system.parallelFor(outerCount, 1, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++)
+				{
+					system.parallelFor(innerCount, 16, [&](size_t innerBegin, size_t innerEnd) {
+						for (size_t j = innerBegin; j < innerEnd; j++)
+						{
+							visits[i * innerCount + j].fetch_add(1, std::memory_order_relaxed);
+						}
+					});
+				}
+			});
+
+			for (size_t i = 0; i < visits.size(); i++)
+			{
+				if (visits[i].load() != 1)
+				{
+					std::cout << "parallelFor : index " << i << " visited " << visits[i].load() << " times\n";
+					passed = false;
+					break;
+				}
+			}
+		}
+
+		// threads outside the system submit through the injection queue and help while they wait
+		{
+			const size_t jobsPerThread = 2000;
+			std::atomic<size_t> sum{ 0 };
+
+			std::vector<std::thread> submitters;
+			for (int t = 0; t < 4; t++)
+			{
+				submitters.emplace_back([&]() {
+					JobCounter counter;
+					for (size_t j = 0; j < jobsPerThread; j++)
+					{
+						system.submit([&sum]() { sum.fetch_add(1, std::memory_order_relaxed); }, &counter);
+					}
+					system.wait(counter);
+				});
+			}
+
+			for (std::thread& submitter : submitters)
+			{
+				submitter.join();
+			}
+
+			if (sum.load() != jobsPerThread * 4)
+			{
+				std::cout << "injection : " << sum.load() << " of " << jobsPerThread * 4 << " jobs ran\n";
+				passed = false;
+			}
+		}
+
+		system.shutdown();
+	}
+
+	std::cout << "job system stress test " << (passed ? "passed" : "FAILED") << " after " << iterations << " iterations\n";
+	return passed;
+}
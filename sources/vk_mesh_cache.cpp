@@ -0,0 +1,420 @@
+#include "vk_mesh_cache.hpp"
+#include "vk-mesh.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+Define MappedFile functions
+*/
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	_file = file;
+	_mapping = mapping;
+	_data = static_cast<const uint8_t*>(view);
+	_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+	int file = ::open(path, O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		::close(file);
+		return false;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	if (view == MAP_FAILED)
+	{
+		::close(file);
+		return false;
+	}
+
+	_file = file;
+	_data = static_cast<const uint8_t*>(view);
+	_size = static_cast<size_t>(fileStat.st_size);
+#endif
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data == nullptr)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(_data);
+	CloseHandle(_mapping);
+	CloseHandle(_file);
+	_mapping = nullptr;
+	_file = nullptr;
+#else
+	munmap(const_cast<uint8_t*>(_data), _size);
+	::close(_file);
+	_file = -1;
+#endif
+
+	_data = nullptr;
+	_size = 0;
+}
+
+/*
+Define cache functions
+*/
+
+namespace
+{
+	struct SourceInfo
+	{
+		uint64_t size = 0;
+		int64_t modifiedTime = 0;
+	};
+
+	bool getSourceInfo(const char* sourcePath, SourceInfo& outInfo)
+	{
+		std::error_code error;
+
+		uint64_t size = std::filesystem::file_size(sourcePath, error);
+		if (error)
+		{
+			return false;
+		}
+
+		auto modifiedTime = std::filesystem::last_write_time(sourcePath, error);
+		if (error)
+		{
+			return false;
+		}
+
+		outInfo.size = size;
+		outInfo.modifiedTime = static_cast<int64_t>(modifiedTime.time_since_epoch().count());
+
+		return true;
+	}
+
+	// FNV-1a over the whole source file
+	bool hashSourceFile(const char* sourcePath, uint64_t& outHash)
+	{
+		MappedFile source;
+		if (!source.open(sourcePath))
+		{
+			return false;
+		}
+
+		uint64_t hash = 14695981039346656037ull;
+		const uint8_t* data = source.data();
+
+		for (size_t i = 0; i < source.size(); i++)
+		{
+			hash ^= data[i];
+			hash *= 1099511628211ull;
+		}
+
+		outHash = hash;
+		return true;
+	}
+
+	size_t alignOffset(size_t offset, size_t alignment)
+	{
+		return (offset + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+std::string vkCache::getMeshCachePath(const char* sourcePath)
+{
+	return std::string(sourcePath) + ".meshcache";
+}
+
+bool vkCache::loadMesh(const char* cachePath, const char* sourcePath, Mesh& outMesh)
+{
+	auto cacheFile = std::make_shared<MappedFile>();
+	if (!cacheFile->open(cachePath))
+	{
+		return false;
+	}
+
+	if (cacheFile->size() < sizeof(MeshCacheHeader))
+	{
+		return false;
+	}
+
+	MeshCacheHeader header;
+	memcpy(&header, cacheFile->data(), sizeof(MeshCacheHeader));
+
+	if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION || header.vertexStride != sizeof(Vertex))
+	{
+		std::cout << cachePath << " has an incompatible format, rebuilding\n";
+		return false;
+	}
+
+	const uint64_t vertexEnd = header.vertexOffset + uint64_t(header.vertexCount) * sizeof(Vertex);
+	const uint64_t indexEnd = header.indexOffset + uint64_t(header.indexCount) * sizeof(uint32_t);
+
+	const uint64_t submeshEnd = header.submeshOffset + uint64_t(header.submeshCount) * sizeof(Submesh);
+	const uint64_t materialNameEnd = header.materialNameOffset + header.materialNameSize;
+
+	if (vertexEnd > cacheFile->size() || indexEnd > cacheFile->size() ||
+		submeshEnd > cacheFile->size() || materialNameEnd > cacheFile->size())
+	{
+		std::cout << cachePath << " is truncated, rebuilding\n";
+		return false;
+	}
+
+	// a missing source keeps the cache usable, otherwise size and mtime are checked first
+	// and the content hash decides only when they differ
+	SourceInfo sourceInfo;
+	if (getSourceInfo(sourcePath, sourceInfo) &&
+		(sourceInfo.size != header.sourceSize || sourceInfo.modifiedTime != header.sourceModifiedTime))
+	{
+		uint64_t sourceHash = 0;
+		if (sourceInfo.size != header.sourceSize || !hashSourceFile(sourcePath, sourceHash) || sourceHash != header.sourceHash)
+		{
+			std::cout << cachePath << " is stale, rebuilding\n";
+			return false;
+		}
+	}
+
+	// a cache that passed the checks above can still index past its vertices if it was damaged on disk,
+	// the draws would read outside the vertex buffer, so one pass over the indices decides it is rebuilt
+	const uint32_t* indices = reinterpret_cast<const uint32_t*>(cacheFile->data() + header.indexOffset);
+	const Submesh* submeshes = reinterpret_cast<const Submesh*>(cacheFile->data() + header.submeshOffset);
+
+	const bool indicesValid =
+		std::all_of(indices, indices + header.indexCount, [&](uint32_t index) { return index < header.vertexCount; }) &&
+		std::all_of(submeshes, submeshes + header.submeshCount, [&](const Submesh& submesh) {
+			return uint64_t(submesh.firstIndex) + submesh.indexCount <= header.indexCount;
+			});
+
+	if (!indicesValid)
+	{
+		std::cout << cachePath << " indexes outside its vertices, rebuilding\n";
+		return false;
+	}
+
+	outMesh._vertices.clear();
+	outMesh._indices.clear();
+
+	outMesh._submeshes.assign(submeshes, submeshes + header.submeshCount);
+
+	outMesh._materialNames.clear();
+	const char* names = reinterpret_cast<const char*>(cacheFile->data() + header.materialNameOffset);
+	for (uint64_t offset = 0; offset < header.materialNameSize; )
+	{
+		size_t length = strnlen(names + offset, static_cast<size_t>(header.materialNameSize - offset));
+		outMesh._materialNames.emplace_back(names + offset, length);
+		offset += length + 1;
+	}
+
+	outMesh._mappedVertices = reinterpret_cast<const Vertex*>(cacheFile->data() + header.vertexOffset);
+	outMesh._mappedIndices = indices;
+	outMesh._mappedVertexCount = header.vertexCount;
+	outMesh._mappedIndexCount = header.indexCount;
+	outMesh._mappedFile = std::move(cacheFile);
+
+	outMesh._boundsMin = { header.boundsMin[0], header.boundsMin[1], header.boundsMin[2] };
+	outMesh._boundsMax = { header.boundsMax[0], header.boundsMax[1], header.boundsMax[2] };
+
+	return true;
+}
+
+bool vkCache::saveMesh(const char* cachePath, const char* sourcePath, const Mesh& mesh)
+{
+	SourceInfo sourceInfo;
+	uint64_t sourceHash = 0;
+
+	if (!getSourceInfo(sourcePath, sourceInfo) || !hashSourceFile(sourcePath, sourceHash))
+	{
+		return false;
+	}
+
+	MeshCacheHeader header = {};
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.sourceSize = sourceInfo.size;
+	header.sourceModifiedTime = sourceInfo.modifiedTime;
+	header.sourceHash = sourceHash;
+	header.vertexStride = sizeof(Vertex);
+	header.vertexCount = static_cast<uint32_t>(mesh.getVertexCount());
+	header.indexCount = static_cast<uint32_t>(mesh.getIndexCount());
+	header.submeshCount = static_cast<uint32_t>(mesh._submeshes.size());
+
+	for (int i = 0; i < 3; i++)
+	{
+		header.boundsMin[i] = mesh._boundsMin[i];
+		header.boundsMax[i] = mesh._boundsMax[i];
+	}
+
+	const size_t vertexSize = mesh.getVertexCount() * sizeof(Vertex);
+	const size_t indexSize = mesh.getIndexCount() * sizeof(uint32_t);
+
+	std::string materialNames;
+	for (const std::string& name : mesh._materialNames)
+	{
+		materialNames.append(name.c_str(), name.size() + 1);
+	}
+
+	const size_t submeshSize = mesh._submeshes.size() * sizeof(Submesh);
+
+	header.vertexOffset = alignOffset(sizeof(MeshCacheHeader), 16);
+	header.indexOffset = alignOffset(header.vertexOffset + vertexSize, 16);
+	header.submeshOffset = alignOffset(header.indexOffset + indexSize, 16);
+	header.materialNameOffset = header.submeshOffset + submeshSize;
+	header.materialNameSize = materialNames.size();
+
+	// written next to the final path and renamed so a crash never leaves a half written cache
+	std::string tempPath = std::string(cachePath) + ".tmp";
+
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		const char padding[16] = {};
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(MeshCacheHeader));
+		file.write(padding, header.vertexOffset - sizeof(MeshCacheHeader));
+		file.write(reinterpret_cast<const char*>(mesh.getVertexData()), vertexSize);
+		file.write(padding, header.indexOffset - (header.vertexOffset + vertexSize));
+		file.write(reinterpret_cast<const char*>(mesh.getIndexData()), indexSize);
+		file.write(padding, header.submeshOffset - (header.indexOffset + indexSize));
+		file.write(reinterpret_cast<const char*>(mesh._submeshes.data()), submeshSize);
+		file.write(materialNames.data(), materialNames.size());
+
+		if (!file.good())
+		{
+			file.close();
+			std::remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, cachePath, error);
+	if (error)
+	{
+		std::remove(tempPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void vkCache::benchmarkMeshLoad(const char* sourcePath, int iterations)
+{
+	using Clock = std::chrono::high_resolution_clock;
+
+	// the parsed mesh is saved unoptimized, it goes to a file of its own so the cache the engine loads is never replaced
+	std::string cachePath = getMeshCachePath(sourcePath) + ".bench";
+
+	double objTime = 0.0;
+	double cacheTime = 0.0;
+
+	for (int i = 0; i < iterations; i++)
+	{
+		auto start = Clock::now();
+
+		Mesh objMesh;
+		if (!objMesh.loadFromObj(sourcePath))
+		{
+			std::cerr << "::ERROR:: Cannot load " << sourcePath << "\n";
+			std::remove(cachePath.c_str());
+			return;
+		}
+
+		objTime += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		if (i == 0 && !saveMesh(cachePath.c_str(), sourcePath, objMesh))
+		{
+			std::cerr << "::ERROR:: Cannot write " << cachePath << "\n";
+			std::remove(cachePath.c_str());
+			return;
+		}
+
+		start = Clock::now();
+
+		Mesh cachedMesh;
+		if (!loadMesh(cachePath.c_str(), sourcePath, cachedMesh))
+		{
+			std::cerr << "::ERROR:: Cannot load " << cachePath << "\n";
+			std::remove(cachePath.c_str());
+			return;
+		}
+
+		// touch every page so the mapping cost is part of the measurement, as in uploadMesh
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(cachedMesh.getVertexData());
+		volatile uint8_t sink = 0;
+		for (size_t offset = 0; offset < cachedMesh.getVertexCount() * sizeof(Vertex); offset += 4096)
+		{
+			sink = sink + bytes[offset];
+		}
+
+		cacheTime += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	std::remove(cachePath.c_str());
+
+	std::cout << sourcePath << " : obj " << objTime / iterations << " ms, cache " << cacheTime / iterations
+		<< " ms over " << iterations << " iterations\n";
+}
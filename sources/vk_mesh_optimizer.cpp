@@ -0,0 +1,535 @@
+#include "vk_mesh_optimizer.hpp"
+#include "vk-mesh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <glm/geometric.hpp>
+
+namespace
+{
+	// Forsyth's scoring parameters, tuned for a 32 entry LRU cache
+	constexpr int MAX_CACHE_SIZE = 32;
+	constexpr float CACHE_DECAY_POWER = 1.5f;
+	constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+	constexpr float VALENCE_BOOST_SCALE = 2.0f;
+	constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+	float vertexScore(int cachePosition, uint32_t remainingTriangles)
+	{
+		if (remainingTriangles == 0)
+		{
+			return -1.0f;
+		}
+
+		float score = 0.0f;
+
+		if (cachePosition >= 0)
+		{
+			// the vertices of the last emitted triangle get a fixed score so the next one does not just reuse them
+			if (cachePosition < 3)
+			{
+				score = LAST_TRIANGLE_SCORE;
+			}
+			else
+			{
+				const float scale = 1.0f / (MAX_CACHE_SIZE - 3);
+				score = std::pow(1.0f - (cachePosition - 3) * scale, CACHE_DECAY_POWER);
+			}
+		}
+
+		// vertices with few triangles left are finished first so they stop occupying the cache
+		score += VALENCE_BOOST_SCALE * std::pow(float(remainingTriangles), -VALENCE_BOOST_POWER);
+
+		return score;
+	}
+
+	struct Cluster
+	{
+		size_t firstIndex;
+		size_t indexCount;
+		float sortKey;
+	};
+}
+
+vkMeshOpt::VertexCacheStats vkMeshOpt::analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+	VertexCacheStats stats;
+
+	// the ACMR is per triangle, a stream without a whole triangle has none to divide by
+	if (indexCount < 3 || vertexCount == 0)
+	{
+		return stats;
+	}
+
+	// a vertex is in the FIFO while fewer than cacheSize misses happened after it was inserted
+	std::vector<size_t> insertedAt(vertexCount, 0);
+	size_t misses = 0;
+
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		uint32_t vertex = indices[i];
+
+		if (insertedAt[vertex] == 0 || misses - insertedAt[vertex] >= cacheSize)
+		{
+			misses++;
+			insertedAt[vertex] = misses;
+		}
+	}
+
+	stats.transformedVertices = misses;
+	stats.acmr = float(misses) / float(indexCount / 3);
+	stats.atvr = float(misses) / float(vertexCount);
+
+	return stats;
+}
+
+void vkMeshOpt::optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	const size_t triangleCount = indexCount / 3;
+
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// vertex -> triangle adjacency, the first remainingTriangles[v] entries of each range are not emitted yet
+	std::vector<uint32_t> remainingTriangles(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		remainingTriangles[indices[i]]++;
+	}
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + remainingTriangles[v];
+	}
+
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+	{
+		std::vector<uint32_t> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+		{
+			adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+	}
+
+	std::vector<int> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		vertexScores[v] = vertexScore(-1, remainingTriangles[v]);
+	}
+
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+
+	long bestTriangle = -1;
+	float bestScore = -1.0f;
+
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		triangleScores[t] = vertexScores[indices[t * 3 + 0]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+		if (triangleScores[t] > bestScore)
+		{
+			bestScore = triangleScores[t];
+			bestTriangle = static_cast<long>(t);
+		}
+	}
+
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+
+	uint32_t cache[MAX_CACHE_SIZE + 3];
+	size_t cacheCount = 0;
+	size_t scanCursor = 0;
+
+	while (output.size() < triangleCount * 3)
+	{
+		// nothing in the cache touches a remaining triangle, continue with the next unemitted one
+		if (bestTriangle < 0)
+		{
+			while (scanCursor < triangleCount && emitted[scanCursor])
+			{
+				scanCursor++;
+			}
+
+			bestTriangle = static_cast<long>(scanCursor);
+		}
+
+		const uint32_t* triangle = &indices[bestTriangle * 3];
+		emitted[bestTriangle] = true;
+
+		uint32_t newCache[MAX_CACHE_SIZE + 3];
+		size_t newCacheCount = 0;
+
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t vertex = triangle[k];
+			output.push_back(vertex);
+
+			uint32_t* begin = &adjacency[adjacencyOffsets[vertex]];
+			uint32_t* end = begin + remainingTriangles[vertex];
+			uint32_t* found = std::find(begin, end, static_cast<uint32_t>(bestTriangle));
+
+			// degenerate triangles list the same vertex twice
+			if (found != end)
+			{
+				std::swap(*found, *(end - 1));
+				remainingTriangles[vertex]--;
+				newCache[newCacheCount++] = vertex;
+			}
+		}
+
+		for (size_t i = 0; i < cacheCount; i++)
+		{
+			uint32_t vertex = cache[i];
+			if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2])
+			{
+				newCache[newCacheCount++] = vertex;
+			}
+		}
+
+		for (size_t i = 0; i < newCacheCount; i++)
+		{
+			uint32_t vertex = newCache[i];
+			cachePositions[vertex] = i < MAX_CACHE_SIZE ? static_cast<int>(i) : -1;
+			vertexScores[vertex] = vertexScore(cachePositions[vertex], remainingTriangles[vertex]);
+		}
+
+		bestTriangle = -1;
+		bestScore = -1.0f;
+
+		for (size_t i = 0; i < newCacheCount; i++)
+		{
+			uint32_t vertex = newCache[i];
+			const uint32_t* adjacent = &adjacency[adjacencyOffsets[vertex]];
+
+			for (uint32_t a = 0; a < remainingTriangles[vertex]; a++)
+			{
+				uint32_t t = adjacent[a];
+				triangleScores[t] = vertexScores[indices[t * 3 + 0]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+				if (triangleScores[t] > bestScore)
+				{
+					bestScore = triangleScores[t];
+					bestTriangle = static_cast<long>(t);
+				}
+			}
+		}
+
+		cacheCount = std::min<size_t>(newCacheCount, MAX_CACHE_SIZE);
+		std::copy(newCache, newCache + cacheCount, cache);
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void vkMeshOpt::optimizeOverdraw(uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount, float threshold)
+{
+	const size_t triangleCount = indexCount / 3;
+	const size_t minClusterTriangles = 32;
+
+	if (triangleCount < minClusterTriangles * 2)
+	{
+		return;
+	}
+
+	const VertexCacheStats before = analyzeVertexCache(indices, indexCount, vertexCount);
+
+	// a triangle whose three vertices all miss the cache starts a new strip of locality, which makes it a
+	// split point that barely changes the cache behaviour when the clusters are reordered
+	std::vector<Cluster> clusters;
+	{
+		std::vector<size_t> insertedAt(vertexCount, 0);
+		size_t misses = 0;
+		const uint32_t cacheSize = 16;
+
+		size_t clusterStart = 0;
+
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			int triangleMisses = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t vertex = indices[t * 3 + k];
+				if (insertedAt[vertex] == 0 || misses - insertedAt[vertex] >= cacheSize)
+				{
+					misses++;
+					insertedAt[vertex] = misses;
+					triangleMisses++;
+				}
+			}
+
+			if (triangleMisses == 3 && t - clusterStart >= minClusterTriangles)
+			{
+				clusters.push_back({ clusterStart * 3, (t - clusterStart) * 3, 0.0f });
+				clusterStart = t;
+			}
+		}
+
+		clusters.push_back({ clusterStart * 3, (triangleCount - clusterStart) * 3, 0.0f });
+	}
+
+	if (clusters.size() < 2)
+	{
+		return;
+	}
+
+	glm::vec3 meshCenter(0.0f);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		meshCenter += vertices[v].position;
+	}
+	meshCenter = meshCenter / float(vertexCount);
+
+	// clusters that face away from the mesh center are likely to occlude the rest, so they are drawn first
+	for (Cluster& cluster : clusters)
+	{
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+
+		for (size_t i = cluster.firstIndex; i < cluster.firstIndex + cluster.indexCount; i += 3)
+		{
+			const glm::vec3& p0 = vertices[indices[i + 0]].position;
+			const glm::vec3& p1 = vertices[indices[i + 1]].position;
+			const glm::vec3& p2 = vertices[indices[i + 2]].position;
+
+			glm::vec3 triangleNormal = glm::cross(p1 - p0, p2 - p0);
+			float triangleArea = glm::length(triangleNormal);
+
+			centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+			normal += triangleNormal;
+			area += triangleArea;
+		}
+
+		if (area > 0.0f)
+		{
+			centroid = centroid / area;
+		}
+
+		float normalLength = glm::length(normal);
+		cluster.sortKey = normalLength > 0.0f ? glm::dot(centroid - meshCenter, normal / normalLength) : 0.0f;
+	}
+
+	std::vector<size_t> order(clusters.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return clusters[a].sortKey > clusters[b].sortKey;
+		});
+
+	std::vector<uint32_t> reordered;
+	reordered.reserve(indexCount);
+
+	for (size_t c : order)
+	{
+		const Cluster& cluster = clusters[c];
+		reordered.insert(reordered.end(), indices + cluster.firstIndex, indices + cluster.firstIndex + cluster.indexCount);
+	}
+
+	const VertexCacheStats after = analyzeVertexCache(reordered.data(), reordered.size(), vertexCount);
+	if (after.acmr <= before.acmr * threshold)
+	{
+		std::copy(reordered.begin(), reordered.end(), indices);
+	}
+}
+
+void vkMeshOpt::optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	std::vector<Vertex> reordered;
+	reordered.reserve(vertices.size());
+
+	for (uint32_t& index : indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = static_cast<uint32_t>(reordered.size());
+			reordered.push_back(vertices[index]);
+		}
+
+		index = remap[index];
+	}
+
+	vertices.swap(reordered);
+}
+
+void vkMeshOpt::optimizeMesh(Mesh& mesh, bool optimizeOverdrawOrder, const char* name)
+{
+	if (mesh._mappedFile || mesh._indices.empty())
+	{
+		return;
+	}
+
+	VertexCacheStats before = analyzeVertexCache(mesh._indices.data(), mesh._indices.size(), mesh._vertices.size());
+
+	// triangles are only reordered inside their submesh so the ranges stay valid,
+	// a mesh without submeshes is treated as a single range
+	std::vector<std::pair<size_t, size_t>> ranges;
+	for (const Submesh& submesh : mesh._submeshes)
+	{
+		ranges.emplace_back(submesh.firstIndex, submesh.indexCount);
+	}
+
+	if (ranges.empty())
+	{
+		ranges.emplace_back(0, mesh._indices.size());
+	}
+
+	for (const auto& [firstIndex, indexCount] : ranges)
+	{
+		if (indexCount == 0)
+		{
+			continue;
+		}
+
+		uint32_t* indices = mesh._indices.data() + firstIndex;
+
+		// the passes keep per vertex scratch arrays, the indices are rebased to the vertex range the submesh
+		// uses so a mesh with many submeshes does not allocate and clear the whole vertex count for each
+		const auto [minVertex, maxVertex] = std::minmax_element(indices, indices + indexCount);
+		const uint32_t baseVertex = *minVertex;
+		const size_t rangeVertexCount = size_t(*maxVertex) - baseVertex + 1;
+
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			indices[i] -= baseVertex;
+		}
+
+		optimizeVertexCache(indices, indexCount, rangeVertexCount);
+
+		if (optimizeOverdrawOrder)
+		{
+			optimizeOverdraw(indices, indexCount, mesh._vertices.data() + baseVertex, rangeVertexCount);
+		}
+
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			indices[i] += baseVertex;
+		}
+	}
+
+	optimizeVertexFetch(mesh._vertices, mesh._indices);
+
+	VertexCacheStats after = analyzeVertexCache(mesh._indices.data(), mesh._indices.size(), mesh._vertices.size());
+
+	std::cout << name << " : ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << "\n";
+}
+
+namespace
+{
+	// rotates each triangle to start at its smallest index, keeping the winding, and sorts them
+	std::vector<std::array<uint32_t, 3>> sortedTriangles(const std::vector<uint32_t>& indices)
+	{
+		std::vector<std::array<uint32_t, 3>> triangles;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			std::array<uint32_t, 3> triangle = { indices[i], indices[i + 1], indices[i + 2] };
+			std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+			triangles.push_back(triangle);
+		}
+
+		std::sort(triangles.begin(), triangles.end());
+		return triangles;
+	}
+}
+
+bool vkMeshOpt::testOptimizer()
+{
+	// a grid of gridSize x gridSize quads with its triangles in a fixed random order, the vertex cache
+	// order has to get close to the 0.5 ACMR a regular grid allows, the Forsyth pass measured 0.67 to 0.68
+	// on it over several shuffles where the shuffled order is at 2.99
+	const uint32_t gridSize = 64;
+	const float maxOptimizedAcmr = 0.7f;
+
+	std::vector<Vertex> vertices;
+	for (uint32_t z = 0; z <= gridSize; z++)
+	{
+		for (uint32_t x = 0; x <= gridSize; x++)
+		{
+			Vertex vertex{};
+			vertex.position = glm::vec3(float(x), 0.0f, float(z));
+			vertex.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+			vertices.push_back(vertex);
+		}
+	}
+
+	std::vector<std::array<uint32_t, 3>> gridTriangles;
+	for (uint32_t z = 0; z < gridSize; z++)
+	{
+		for (uint32_t x = 0; x < gridSize; x++)
+		{
+			const uint32_t corner = z * (gridSize + 1) + x;
+			gridTriangles.push_back({ corner, corner + gridSize + 1, corner + 1 });
+			gridTriangles.push_back({ corner + 1, corner + gridSize + 1, corner + gridSize + 2 });
+		}
+	}
+
+	// std::shuffle is implementation defined, the raw mt19937 sequence is not
+	std::mt19937 random(1234);
+	for (size_t i = gridTriangles.size() - 1; i > 0; i--)
+	{
+		std::swap(gridTriangles[i], gridTriangles[random() % (i + 1)]);
+	}
+
+	std::vector<uint32_t> indices;
+	for (const auto& triangle : gridTriangles)
+	{
+		indices.insert(indices.end(), triangle.begin(), triangle.end());
+	}
+
+	const auto triangles = sortedTriangles(indices);
+	bool passed = true;
+
+	const VertexCacheStats shuffled = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+
+	optimizeVertexCache(indices.data(), indices.size(), vertices.size());
+	const VertexCacheStats cacheOrder = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+
+	const bool cacheTrianglesKept = sortedTriangles(indices) == triangles;
+	passed &= cacheTrianglesKept && cacheOrder.acmr <= maxOptimizedAcmr;
+
+	std::cout << "vertex cache : ACMR " << shuffled.acmr << " -> " << cacheOrder.acmr << " (max " << maxOptimizedAcmr << ")"
+		<< (cacheTrianglesKept ? "" : ", triangles changed") << "\n";
+
+	// the overdraw pass may give back at most its threshold of the cache order
+	const float threshold = 1.05f;
+	optimizeOverdraw(indices.data(), indices.size(), vertices.data(), vertices.size(), threshold);
+	const VertexCacheStats overdrawOrder = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+
+	const bool overdrawTrianglesKept = sortedTriangles(indices) == triangles;
+	passed &= overdrawTrianglesKept && overdrawOrder.acmr <= cacheOrder.acmr * threshold;
+
+	std::cout << "overdraw : ACMR " << cacheOrder.acmr << " -> " << overdrawOrder.acmr << " (max " << cacheOrder.acmr * threshold << ")"
+		<< (overdrawTrianglesKept ? "" : ", triangles changed") << "\n";
+
+	// the fetch pass renumbers vertices by first use, every corner has to keep its position
+	std::vector<uint32_t> previousIndices = indices;
+	std::vector<Vertex> fetchVertices = vertices;
+	optimizeVertexFetch(fetchVertices, indices);
+
+	bool fetchPassed = fetchVertices.size() == vertices.size() && indices.size() == previousIndices.size();
+	uint32_t nextVertex = 0;
+	for (size_t i = 0; fetchPassed && i < indices.size(); i++)
+	{
+		fetchPassed = indices[i] <= nextVertex && fetchVertices[indices[i]].position == vertices[previousIndices[i]].position;
+		nextVertex = std::max(nextVertex, indices[i] + 1);
+	}
+
+	const VertexCacheStats fetchOrder = analyzeVertexCache(indices.data(), indices.size(), fetchVertices.size());
+	fetchPassed &= fetchOrder.acmr == overdrawOrder.acmr;
+	passed &= fetchPassed;
+
+	std::cout << "vertex fetch : " << (fetchPassed ? "first use order" : "corners or cache order changed") << "\n";
+	std::cout << "mesh optimizer : " << (passed ? "passed" : "FAILED") << "\n";
+
+	return passed;
+}
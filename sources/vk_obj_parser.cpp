@@ -0,0 +1,591 @@
+#include "vk_obj_parser.hpp"
+#include "vk_mesh_cache.hpp"
+#include "vk-mesh.hpp"
+#include "vk_jobs.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+	constexpr uint8_t RELATIVE_POSITION = 1 << 0;
+	constexpr uint8_t RELATIVE_TEXCOORD = 1 << 1;
+	constexpr uint8_t RELATIVE_NORMAL = 1 << 2;
+
+	// relative indices are stored against the start of their chunk until the chunk offsets are known
+	struct RawCorner
+	{
+		vkObj::ObjCorner corner;
+		uint8_t relativeMask;
+	};
+
+	// an o/g or usemtl record, applied to the faces that follow it
+	struct GroupEvent
+	{
+		size_t corner;
+		bool isMaterial;
+		std::string value;
+	};
+
+	struct ObjChunk
+	{
+		const char* begin;
+		const char* end;
+
+		std::vector<float> positions;
+		std::vector<float> normals;
+		std::vector<float> texcoords;
+		std::vector<RawCorner> corners;
+		std::vector<GroupEvent> groupEvents;
+
+		size_t positionBase = 0;
+		size_t normalBase = 0;
+		size_t texcoordBase = 0;
+		size_t cornerBase = 0;
+
+		bool failed = false;
+	};
+
+	void runParallel(size_t taskCount, const std::function<void(size_t)>& task)
+	{
+		vkJobs::getGlobal().parallelFor(taskCount, 1, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+			{
+				task(i);
+			}
+		});
+	}
+
+	inline bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t';
+	}
+
+	inline const char* skipSpaces(const char* p, const char* end)
+	{
+		while (p < end && isSpace(*p))
+		{
+			p++;
+		}
+
+		return p;
+	}
+
+	inline const char* parseFloat(const char* p, const char* end, float& out)
+	{
+		p = skipSpaces(p, end);
+
+		if (p < end && *p == '+')
+		{
+			p++;
+		}
+
+		auto result = std::from_chars(p, end, out);
+		if (result.ec != std::errc())
+		{
+			out = 0.0f;
+			return nullptr;
+		}
+
+		return result.ptr;
+	}
+
+	inline const char* parseInt(const char* p, const char* end, int32_t& out)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			p++;
+		}
+
+		if (p >= end || *p < '0' || *p > '9')
+		{
+			return nullptr;
+		}
+
+		int64_t value = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			value = value * 10 + (*p - '0');
+			p++;
+		}
+
+		out = static_cast<int32_t>(negative ? -value : value);
+		return p;
+	}
+
+	// converts a 1-based or negative OBJ index, 0 means the attribute is absent
+	inline int32_t resolveIndex(int32_t raw, size_t localCount, uint8_t relativeBit, uint8_t& relativeMask)
+	{
+		if (raw > 0)
+		{
+			return raw - 1;
+		}
+
+		if (raw < 0)
+		{
+			relativeMask |= relativeBit;
+			return static_cast<int32_t>(localCount) + raw;
+		}
+
+		return -1;
+	}
+
+	bool parseFace(const char* p, const char* end, ObjChunk& chunk)
+	{
+		RawCorner faceCorners[64];
+		size_t cornerCount = 0;
+
+		while (true)
+		{
+			p = skipSpaces(p, end);
+			if (p >= end)
+			{
+				break;
+			}
+
+			int32_t position = 0;
+			int32_t texcoord = 0;
+			int32_t normal = 0;
+
+			p = parseInt(p, end, position);
+			if (p == nullptr)
+			{
+				return false;
+			}
+
+			if (p < end && *p == '/')
+			{
+				p++;
+				if (p < end && *p != '/')
+				{
+					p = parseInt(p, end, texcoord);
+					if (p == nullptr)
+					{
+						return false;
+					}
+				}
+
+				if (p < end && *p == '/')
+				{
+					p++;
+					p = parseInt(p, end, normal);
+					if (p == nullptr)
+					{
+						return false;
+					}
+				}
+			}
+
+			if (cornerCount == std::size(faceCorners))
+			{
+				return false;
+			}
+
+			RawCorner& corner = faceCorners[cornerCount++];
+			corner.relativeMask = 0;
+			corner.corner.position = resolveIndex(position, chunk.positions.size() / 3, RELATIVE_POSITION, corner.relativeMask);
+			corner.corner.texcoord = resolveIndex(texcoord, chunk.texcoords.size() / 2, RELATIVE_TEXCOORD, corner.relativeMask);
+			corner.corner.normal = resolveIndex(normal, chunk.normals.size() / 3, RELATIVE_NORMAL, corner.relativeMask);
+		}
+
+		if (cornerCount < 3)
+		{
+			return false;
+		}
+
+		for (size_t i = 1; i + 1 < cornerCount; i++)
+		{
+			chunk.corners.push_back(faceCorners[0]);
+			chunk.corners.push_back(faceCorners[i]);
+			chunk.corners.push_back(faceCorners[i + 1]);
+		}
+
+		return true;
+	}
+
+	std::string parseName(const char* p, const char* end)
+	{
+		p = skipSpaces(p, end);
+		while (end > p && isSpace(end[-1]))
+		{
+			end--;
+		}
+
+		return std::string(p, end);
+	}
+
+	void parseChunk(ObjChunk& chunk)
+	{
+		const char* p = chunk.begin;
+
+		while (p < chunk.end && !chunk.failed)
+		{
+			const char* lineEnd = p;
+			while (lineEnd < chunk.end && *lineEnd != '\n')
+			{
+				lineEnd++;
+			}
+
+			const char* next = lineEnd < chunk.end ? lineEnd + 1 : lineEnd;
+			if (lineEnd > p && lineEnd[-1] == '\r')
+			{
+				lineEnd--;
+			}
+
+			p = skipSpaces(p, lineEnd);
+
+			if (lineEnd - p >= 2 && p[0] == 'v' && isSpace(p[1]))
+			{
+				float x, y, z;
+				const char* q = parseFloat(p + 2, lineEnd, x);
+				q = q ? parseFloat(q, lineEnd, y) : nullptr;
+				q = q ? parseFloat(q, lineEnd, z) : nullptr;
+
+				chunk.failed = q == nullptr;
+				chunk.positions.insert(chunk.positions.end(), { x, y, z });
+			}
+			else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2]))
+			{
+				float x, y, z;
+				const char* q = parseFloat(p + 3, lineEnd, x);
+				q = q ? parseFloat(q, lineEnd, y) : nullptr;
+				q = q ? parseFloat(q, lineEnd, z) : nullptr;
+
+				chunk.failed = q == nullptr;
+				chunk.normals.insert(chunk.normals.end(), { x, y, z });
+			}
+			else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && isSpace(p[2]))
+			{
+				float u, v = 0.0f;
+				const char* q = parseFloat(p + 3, lineEnd, u);
+				if (q != nullptr && skipSpaces(q, lineEnd) < lineEnd)
+				{
+					q = parseFloat(q, lineEnd, v);
+				}
+
+				chunk.failed = q == nullptr;
+				chunk.texcoords.insert(chunk.texcoords.end(), { u, v });
+			}
+			else if (lineEnd - p >= 2 && p[0] == 'f' && isSpace(p[1]))
+			{
+				chunk.failed = !parseFace(p + 2, lineEnd, chunk);
+			}
+			else if (lineEnd - p >= 2 && (p[0] == 'o' || p[0] == 'g') && isSpace(p[1]))
+			{
+				chunk.groupEvents.push_back({ chunk.corners.size(), false, parseName(p + 2, lineEnd) });
+			}
+			else if (lineEnd - p >= 7 && std::equal(p, p + 6, "usemtl") && isSpace(p[6]))
+			{
+				chunk.groupEvents.push_back({ chunk.corners.size(), true, parseName(p + 7, lineEnd) });
+			}
+
+			p = next;
+		}
+	}
+
+	// -1 marks an absent attribute only when the face gave no index, a negative index reaching
+	// before the first element is out of range like any other
+	inline bool finalizeIndex(int32_t& index, bool relative, size_t base, size_t count)
+	{
+		if (relative)
+		{
+			index += static_cast<int32_t>(base);
+			return index >= 0 && index < static_cast<int64_t>(count);
+		}
+
+		return index >= -1 && index < static_cast<int64_t>(count);
+	}
+}
+
+bool vkObj::parseObj(const char* filename, uint32_t threadCount, ObjData& outData)
+{
+	MappedFile file;
+	if (!file.open(filename))
+	{
+		std::cerr << "::ERROR:: Cannot open " << filename << "\n";
+		return false;
+	}
+
+	// the chunks run on the shared job system, threadCount only decides how many there are
+	if (threadCount == 0)
+	{
+		threadCount = vkJobs::getGlobal().getThreadCount();
+	}
+
+	const char* data = reinterpret_cast<const char*>(file.data());
+	const char* dataEnd = data + file.size();
+
+	// several chunks per thread so uneven chunks still balance, every chunk ends after a newline
+	const size_t minChunkSize = 1 << 20;
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadCount * 4, file.size() / minChunkSize));
+	size_t chunkSize = file.size() / chunkCount;
+
+	std::vector<ObjChunk> chunks;
+	chunks.reserve(chunkCount);
+
+	const char* chunkBegin = data;
+	for (size_t i = 0; i < chunkCount && chunkBegin < dataEnd; i++)
+	{
+		const char* chunkEnd = (i + 1 == chunkCount) ? dataEnd : std::min(dataEnd, chunkBegin + chunkSize);
+		while (chunkEnd < dataEnd && chunkEnd[-1] != '\n')
+		{
+			chunkEnd++;
+		}
+
+		ObjChunk chunk;
+		chunk.begin = chunkBegin;
+		chunk.end = chunkEnd;
+		chunks.push_back(std::move(chunk));
+
+		chunkBegin = chunkEnd;
+	}
+
+	runParallel(chunks.size(), [&](size_t i) {
+		parseChunk(chunks[i]);
+		});
+
+	size_t positionCount = 0;
+	size_t normalCount = 0;
+	size_t texcoordCount = 0;
+	size_t cornerCount = 0;
+
+	for (ObjChunk& chunk : chunks)
+	{
+		if (chunk.failed)
+		{
+			std::cerr << "::ERROR:: Malformed record in " << filename << "\n";
+			return false;
+		}
+
+		chunk.positionBase = positionCount;
+		chunk.normalBase = normalCount;
+		chunk.texcoordBase = texcoordCount;
+		chunk.cornerBase = cornerCount;
+
+		positionCount += chunk.positions.size() / 3;
+		normalCount += chunk.normals.size() / 3;
+		texcoordCount += chunk.texcoords.size() / 2;
+		cornerCount += chunk.corners.size();
+	}
+
+	outData.positions.resize(positionCount * 3);
+	outData.normals.resize(normalCount * 3);
+	outData.texcoords.resize(texcoordCount * 2);
+	outData.corners.resize(cornerCount);
+
+	std::atomic<bool> invalidIndex{ false };
+
+	runParallel(chunks.size(), [&](size_t i) {
+		ObjChunk& chunk = chunks[i];
+
+		std::copy(chunk.positions.begin(), chunk.positions.end(), outData.positions.begin() + chunk.positionBase * 3);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), outData.normals.begin() + chunk.normalBase * 3);
+		std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), outData.texcoords.begin() + chunk.texcoordBase * 2);
+
+		ObjCorner* corners = outData.corners.data() + chunk.cornerBase;
+		for (size_t c = 0; c < chunk.corners.size(); c++)
+		{
+			RawCorner raw = chunk.corners[c];
+
+			bool valid = finalizeIndex(raw.corner.position, raw.relativeMask & RELATIVE_POSITION, chunk.positionBase, positionCount);
+			valid &= finalizeIndex(raw.corner.texcoord, raw.relativeMask & RELATIVE_TEXCOORD, chunk.texcoordBase, texcoordCount);
+			valid &= finalizeIndex(raw.corner.normal, raw.relativeMask & RELATIVE_NORMAL, chunk.normalBase, normalCount);
+			valid &= raw.corner.position >= 0;
+
+			if (!valid)
+			{
+				invalidIndex = true;
+			}
+
+			corners[c] = raw.corner;
+		}
+
+		std::vector<float>().swap(chunk.positions);
+		std::vector<float>().swap(chunk.normals);
+		std::vector<float>().swap(chunk.texcoords);
+		std::vector<RawCorner>().swap(chunk.corners);
+		});
+
+	if (invalidIndex)
+	{
+		std::cerr << "::ERROR:: Face index out of range in " << filename << "\n";
+		return false;
+	}
+
+	// the name and material carry over chunk boundaries, so the groups are built in file order
+	outData.groups.clear();
+	ObjGroup current = { "", "", 0, 0 };
+
+	auto closeGroup = [&](size_t corner) {
+		current.cornerCount = corner - current.firstCorner;
+		if (current.cornerCount > 0)
+		{
+			outData.groups.push_back(current);
+		}
+
+		current.firstCorner = corner;
+	};
+
+	for (const ObjChunk& chunk : chunks)
+	{
+		for (const GroupEvent& event : chunk.groupEvents)
+		{
+			closeGroup(chunk.cornerBase + event.corner);
+			(event.isMaterial ? current.material : current.name) = event.value;
+		}
+	}
+
+	closeGroup(cornerCount);
+
+	return true;
+}
+
+bool vkObj::generateSyntheticObj(const char* filename, size_t targetBytes)
+{
+	FILE* file = fopen(filename, "wb");
+	if (file == nullptr)
+	{
+		std::cerr << "::ERROR:: Cannot create " << filename << "\n";
+		return false;
+	}
+
+	const int gridSize = 256;
+
+	size_t writtenBytes = 0;
+	size_t vertexBase = 0;
+	char line[256];
+
+	auto writeLine = [&](int length) {
+		fwrite(line, 1, length, file);
+		writtenBytes += length;
+	};
+
+	writtenBytes += fprintf(file, "# synthetic grid mesh\no synthetic\n");
+
+	for (int patch = 0; writtenBytes < targetBytes; patch++)
+	{
+		for (int y = 0; y < gridSize; y++)
+		{
+			for (int x = 0; x < gridSize; x++)
+			{
+				float px = float(patch * (gridSize - 1) + x) * 0.1f;
+				float pz = float(y) * 0.1f;
+				float py = std::sin(px * 0.37f) * std::cos(pz * 0.21f);
+
+				writeLine(snprintf(line, sizeof(line), "v %.6f %.6f %.6f\n", px, py, pz));
+				writeLine(snprintf(line, sizeof(line), "vt %.6f %.6f\n", float(x) / (gridSize - 1), float(y) / (gridSize - 1)));
+				writeLine(snprintf(line, sizeof(line), "vn 0.000000 1.000000 0.000000\n"));
+			}
+		}
+
+		const size_t patchVertices = size_t(gridSize) * gridSize;
+		const bool relative = (patch % 2) == 1;
+
+		for (int y = 0; y + 1 < gridSize; y++)
+		{
+			for (int x = 0; x + 1 < gridSize; x++)
+			{
+				long long corners[4] = {
+					(long long)(y * gridSize + x),
+					(long long)(y * gridSize + x + 1),
+					(long long)((y + 1) * gridSize + x + 1),
+					(long long)((y + 1) * gridSize + x)
+				};
+
+				for (long long& corner : corners)
+				{
+					corner = relative ? corner - (long long)patchVertices : (long long)(vertexBase + corner + 1);
+				}
+
+				// quads and triangles alternate so both face paths are exercised
+				if ((x + y) % 2 == 0)
+				{
+					writeLine(snprintf(line, sizeof(line), "f %lld/%lld/%lld %lld/%lld/%lld %lld/%lld/%lld %lld/%lld/%lld\n",
+						corners[0], corners[0], corners[0], corners[1], corners[1], corners[1],
+						corners[2], corners[2], corners[2], corners[3], corners[3], corners[3]));
+				}
+				else
+				{
+					writeLine(snprintf(line, sizeof(line), "f %lld/%lld/%lld %lld/%lld/%lld %lld/%lld/%lld\nf %lld/%lld/%lld %lld/%lld/%lld %lld/%lld/%lld\n",
+						corners[0], corners[0], corners[0], corners[1], corners[1], corners[1], corners[2], corners[2], corners[2],
+						corners[0], corners[0], corners[0], corners[2], corners[2], corners[2], corners[3], corners[3], corners[3]));
+				}
+			}
+		}
+
+		vertexBase += patchVertices;
+	}
+
+	fclose(file);
+
+	std::cout << filename << " : " << writtenBytes << " bytes written\n";
+	return true;
+}
+
+void vkObj::benchmarkObjLoad(const char* filename, uint32_t maxThreadCount)
+{
+	using Clock = std::chrono::high_resolution_clock;
+
+	if (maxThreadCount == 0)
+	{
+		maxThreadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	auto start = Clock::now();
+
+	Mesh reference;
+	if (!reference.loadFromObjReference(filename))
+	{
+		return;
+	}
+
+	double referenceTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	std::cout << "tinyobj : " << referenceTime << " ms\n";
+
+	for (uint32_t threadCount = 1; ; threadCount = std::min(threadCount * 2, maxThreadCount))
+	{
+		vkJobs::initGlobal(threadCount);
+
+		start = Clock::now();
+
+		Mesh mesh;
+		if (!mesh.loadFromObj(filename, threadCount))
+		{
+			return;
+		}
+
+		double time = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		bool matches = mesh._vertices.size() == reference._vertices.size() && mesh._indices == reference._indices;
+		for (size_t i = 0; matches && i < mesh._vertices.size(); i++)
+		{
+			const Vertex& a = mesh._vertices[i];
+			const Vertex& b = reference._vertices[i];
+
+			for (int c = 0; c < 3; c++)
+			{
+				matches &= std::fabs(a.position[c] - b.position[c]) <= 1e-5f * std::max(1.0f, std::fabs(b.position[c]));
+				matches &= std::fabs(a.normal[c] - b.normal[c]) <= 1e-5f;
+			}
+
+			matches &= std::fabs(a.uv.x - b.uv.x) <= 1e-5f && std::fabs(a.uv.y - b.uv.y) <= 1e-5f;
+		}
+
+		std::cout << "parallel x" << threadCount << " : " << time << " ms (" << referenceTime / time << "x), "
+			<< (matches ? "matches tinyobj" : "DIFFERS FROM TINYOBJ") << "\n";
+
+		if (threadCount == maxThreadCount)
+		{
+			break;
+		}
+	}
+}
@@ -0,0 +1,132 @@
+#include "vk_pipeline_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+	// VkPipelineCacheHeaderVersionOne, read field by field since the data is only a byte stream
+	bool isCacheCompatible(const std::vector<char>& data, const VkPhysicalDeviceProperties& properties)
+	{
+		const size_t headerSize = 16 + VK_UUID_SIZE;
+		if (data.size() < headerSize)
+		{
+			return false;
+		}
+
+		uint32_t fields[4];
+		memcpy(fields, data.data(), sizeof(fields));
+
+		const uint32_t size = fields[0];
+		const uint32_t version = fields[1];
+		const uint32_t vendorID = fields[2];
+		const uint32_t deviceID = fields[3];
+
+		return size >= headerSize && size <= data.size() &&
+			version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+			vendorID == properties.vendorID &&
+			deviceID == properties.deviceID &&
+			memcmp(data.data() + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+}
+
+VkPipelineCache vkCache::loadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties, const char* path, size_t& outLoadedSize)
+{
+	std::vector<char> data;
+
+	if (path != nullptr)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (file.is_open())
+		{
+			data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		}
+	}
+
+	// a cache of another driver version or device is ignored, the driver would reject it anyway
+	if (!data.empty() && !isCacheCompatible(data, properties))
+	{
+		std::cout << "Pipeline cache " << path << " was written by another driver or device, starting empty\n";
+		data.clear();
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.pNext = nullptr;
+	cacheInfo.initialDataSize = data.size();
+	cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS)
+	{
+		// the seed data may still be rejected, an empty cache always works
+		cacheInfo.initialDataSize = 0;
+		cacheInfo.pInitialData = nullptr;
+		data.clear();
+
+		if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS)
+		{
+			std::cout << "Failed to create a pipeline cache\n";
+			cache = VK_NULL_HANDLE;
+		}
+	}
+
+	outLoadedSize = data.size();
+
+	return cache;
+}
+
+bool vkCache::savePipelineCache(VkDevice device, VkPipelineCache cache, const char* path)
+{
+	if (cache == VK_NULL_HANDLE)
+	{
+		return false;
+	}
+
+	size_t size = 0;
+	if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0)
+	{
+		return false;
+	}
+
+	std::vector<char> data(size);
+	if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+	{
+		return false;
+	}
+
+	std::string tempPath = std::string(path) + ".tmp";
+
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		file.write(data.data(), size);
+
+		if (!file.good())
+		{
+			file.close();
+			std::remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	if (error)
+	{
+		std::remove(tempPath.c_str());
+		return false;
+	}
+
+	return true;
+}
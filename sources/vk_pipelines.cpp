@@ -0,0 +1,502 @@
+#include "vk_pipelines.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include "vk_jobs.hpp"
+
+namespace
+{
+	// appends the fields that define a pipeline one by one, never whole structs, so padding,
+	// sType and pNext stay out of the key
+	class StateWriter
+	{
+	public:
+		template<typename T>
+		void add(const T& value)
+		{
+			_bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		void addString(const char* text)
+		{
+			_bytes.append(text != nullptr ? text : "");
+			_bytes.push_back('\0');
+		}
+
+		std::string& getBytes() { return _bytes; }
+
+	private:
+		std::string _bytes;
+	};
+
+	// a different state already owning the key moves the request on to the key hashed with the next salt
+	constexpr uint32_t MAX_KEY_PROBES = 16;
+
+	PipelineKey hashState(const std::string& state, uint32_t salt = 0)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (uint32_t i = 0; salt != 0 && i < sizeof(salt); i++)
+		{
+			hash ^= (salt >> (i * 8)) & 0xFF;
+			hash *= 1099511628211ull;
+		}
+
+		for (char c : state)
+		{
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+}
+
+/*
+Define PipelineBuilder functions
+*/
+
+VkPipeline PipelineBuilder::buildPipeline(VkDevice device, VkRenderPass pass, VkPipelineCache cache)
+{
+	VkPipelineViewportStateCreateInfo viewportState = {};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.pNext = nullptr;
+
+	viewportState.viewportCount = 1;
+	viewportState.pViewports = &_viewport;
+	viewportState.scissorCount = 1;
+	viewportState.pScissors = &_scissor;
+
+	VkPipelineColorBlendStateCreateInfo colorBlending = {};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.pNext = nullptr;
+
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.logicOp = VK_LOGIC_OP_COPY;
+	colorBlending.attachmentCount = 1;
+	colorBlending.pAttachments = &_colorBlendAttachment;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.pNext = nullptr;
+
+	pipelineInfo.stageCount = _shaderStages.size();
+	pipelineInfo.pStages = _shaderStages.data();
+	pipelineInfo.pVertexInputState = &_vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &_inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &_rasterizer;
+	pipelineInfo.pMultisampleState = &_multisampling;
+	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.layout = _pipelineLayout;
+	pipelineInfo.renderPass = pass;
+	pipelineInfo.subpass = 0;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.pDepthStencilState = &_depthStencil;
+
+	VkPipeline newPipeline;
+	if (vkCreateGraphicsPipelines(
+		device, cache, 1, &pipelineInfo, nullptr, &newPipeline
+	) != VK_SUCCESS)
+	{
+		std::cout << "Failed to create pipeline\n";
+		return VK_NULL_HANDLE;
+	}
+	else
+	{
+		return newPipeline;
+	}
+}
+
+/*
+Define PipelineRegistry functions
+*/
+
+std::string PipelineRegistry::serializeState(const PipelineBuilder& builder, VkRenderPass pass) const
+{
+	StateWriter writer;
+
+	writer.add(static_cast<uint32_t>(builder._shaderStages.size()));
+	for (const VkPipelineShaderStageCreateInfo& stage : builder._shaderStages)
+	{
+		writer.add(stage.flags);
+		writer.add(stage.stage);
+
+		// registered modules by their code, others by handle
+		auto moduleHash = _moduleHashes.find(stage.module);
+		writer.add(moduleHash != _moduleHashes.end());
+		writer.add(moduleHash != _moduleHashes.end() ? moduleHash->second : reinterpret_cast<uint64_t>(stage.module));
+		writer.addString(stage.pName);
+
+		const VkSpecializationInfo* specialization = stage.pSpecializationInfo;
+		writer.add(specialization != nullptr ? specialization->mapEntryCount : 0u);
+		if (specialization != nullptr)
+		{
+			for (uint32_t i = 0; i < specialization->mapEntryCount; i++)
+			{
+				writer.add(specialization->pMapEntries[i].constantID);
+				writer.add(specialization->pMapEntries[i].offset);
+				writer.add(static_cast<uint64_t>(specialization->pMapEntries[i].size));
+			}
+
+			writer.add(static_cast<uint64_t>(specialization->dataSize));
+			writer.getBytes().append(static_cast<const char*>(specialization->pData), specialization->dataSize);
+		}
+	}
+
+	const VkPipelineVertexInputStateCreateInfo& vertexInput = builder._vertexInputInfo;
+	writer.add(vertexInput.vertexBindingDescriptionCount);
+	for (uint32_t i = 0; i < vertexInput.vertexBindingDescriptionCount; i++)
+	{
+		writer.add(vertexInput.pVertexBindingDescriptions[i].binding);
+		writer.add(vertexInput.pVertexBindingDescriptions[i].stride);
+		writer.add(vertexInput.pVertexBindingDescriptions[i].inputRate);
+	}
+
+	writer.add(vertexInput.vertexAttributeDescriptionCount);
+	for (uint32_t i = 0; i < vertexInput.vertexAttributeDescriptionCount; i++)
+	{
+		writer.add(vertexInput.pVertexAttributeDescriptions[i].location);
+		writer.add(vertexInput.pVertexAttributeDescriptions[i].binding);
+		writer.add(vertexInput.pVertexAttributeDescriptions[i].format);
+		writer.add(vertexInput.pVertexAttributeDescriptions[i].offset);
+	}
+
+	writer.add(builder._inputAssembly.topology);
+	writer.add(builder._inputAssembly.primitiveRestartEnable);
+
+	writer.add(builder._viewport.x);
+	writer.add(builder._viewport.y);
+	writer.add(builder._viewport.width);
+	writer.add(builder._viewport.height);
+	writer.add(builder._viewport.minDepth);
+	writer.add(builder._viewport.maxDepth);
+	writer.add(builder._scissor.offset.x);
+	writer.add(builder._scissor.offset.y);
+	writer.add(builder._scissor.extent.width);
+	writer.add(builder._scissor.extent.height);
+
+	const VkPipelineRasterizationStateCreateInfo& rasterizer = builder._rasterizer;
+	writer.add(rasterizer.depthClampEnable);
+	writer.add(rasterizer.rasterizerDiscardEnable);
+	writer.add(rasterizer.polygonMode);
+	writer.add(rasterizer.cullMode);
+	writer.add(rasterizer.frontFace);
+	writer.add(rasterizer.depthBiasEnable);
+	writer.add(rasterizer.depthBiasConstantFactor);
+	writer.add(rasterizer.depthBiasClamp);
+	writer.add(rasterizer.depthBiasSlopeFactor);
+	writer.add(rasterizer.lineWidth);
+
+	const VkPipelineColorBlendAttachmentState& blend = builder._colorBlendAttachment;
+	writer.add(blend.blendEnable);
+	writer.add(blend.srcColorBlendFactor);
+	writer.add(blend.dstColorBlendFactor);
+	writer.add(blend.colorBlendOp);
+	writer.add(blend.srcAlphaBlendFactor);
+	writer.add(blend.dstAlphaBlendFactor);
+	writer.add(blend.alphaBlendOp);
+	writer.add(blend.colorWriteMask);
+
+	const VkPipelineMultisampleStateCreateInfo& multisampling = builder._multisampling;
+	writer.add(multisampling.rasterizationSamples);
+	writer.add(multisampling.sampleShadingEnable);
+	writer.add(multisampling.minSampleShading);
+	writer.add(multisampling.pSampleMask != nullptr ? multisampling.pSampleMask[0] : ~0u);
+	writer.add(multisampling.alphaToCoverageEnable);
+	writer.add(multisampling.alphaToOneEnable);
+
+	const VkPipelineDepthStencilStateCreateInfo& depthStencil = builder._depthStencil;
+	writer.add(depthStencil.depthTestEnable);
+	writer.add(depthStencil.depthWriteEnable);
+	writer.add(depthStencil.depthCompareOp);
+	writer.add(depthStencil.depthBoundsTestEnable);
+	writer.add(depthStencil.stencilTestEnable);
+	for (const VkStencilOpState* op : { &depthStencil.front, &depthStencil.back })
+	{
+		writer.add(op->failOp);
+		writer.add(op->passOp);
+		writer.add(op->depthFailOp);
+		writer.add(op->compareOp);
+		writer.add(op->compareMask);
+		writer.add(op->writeMask);
+		writer.add(op->reference);
+	}
+	writer.add(depthStencil.minDepthBounds);
+	writer.add(depthStencil.maxDepthBounds);
+
+	writer.add(builder._pipelineLayout);
+	writer.add(pass);
+
+	return std::move(writer.getBytes());
+}
+
+void PipelineRegistry::init(VkDevice device, VkPipelineCache cache)
+{
+	_device = device;
+	_cache = cache;
+}
+
+void PipelineRegistry::cleanup()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	for (auto& [key, entry] : _entries)
+	{
+		if (entry.pipeline != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(_device, entry.pipeline, nullptr);
+		}
+	}
+
+	_entries.clear();
+	_pending.clear();
+}
+
+void PipelineRegistry::registerShaderModule(VkShaderModule module, const uint32_t* code, size_t wordCount)
+{
+	const std::string bytes(reinterpret_cast<const char*>(code), wordCount * sizeof(uint32_t));
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_moduleHashes[module] = hashState(bytes);
+}
+
+void PipelineRegistry::unregisterShaderModule(VkShaderModule module)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_moduleHashes.erase(module);
+}
+
+PipelineKey PipelineRegistry::makeKey(const PipelineBuilder& builder, VkRenderPass pass) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return findKey(serializeState(builder, pass));
+}
+
+PipelineKey PipelineRegistry::findKey(const std::string& state) const
+{
+	// probing stops at the first free key, once remove freed a key earlier in the chain a state behind it is
+	// registered a second time, which costs a duplicate build but never hands out another state's pipeline
+	for (uint32_t salt = 0; salt < MAX_KEY_PROBES; salt++)
+	{
+		const PipelineKey key = hashState(state, salt);
+
+		// 0 is what requestVariant returns for unknown keys, a state hashing to it probes on like a collision
+		if (key == 0)
+		{
+			continue;
+		}
+
+		auto it = _entries.find(key);
+		if (it == _entries.end() || it->second.state == state)
+		{
+			return key;
+		}
+	}
+
+	return 0;
+}
+
+PipelineKey PipelineRegistry::request(const PipelineBuilder& builder, VkRenderPass pass)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return insert(builder, pass);
+}
+
+PipelineKey PipelineRegistry::requestVariant(PipelineKey base, const std::vector<VkShaderModule>& modules)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto it = _entries.find(base);
+	if (it == _entries.end() || modules.size() != it->second.builder._shaderStages.size())
+	{
+		return 0;
+	}
+
+	// still points into the base entry, which the lock keeps alive until insert copied it
+	PipelineBuilder builder = it->second.builder;
+	for (size_t i = 0; i < modules.size(); i++)
+	{
+		builder._shaderStages[i].module = modules[i];
+	}
+
+	return insert(builder, it->second.pass);
+}
+
+PipelineKey PipelineRegistry::insert(const PipelineBuilder& builder, VkRenderPass pass)
+{
+	std::string state = serializeState(builder, pass);
+	const PipelineKey key = findKey(state);
+
+	_stats.requests++;
+
+	if (key == 0)
+	{
+		std::cout << "Pipeline key collision on every probe, the pipeline is not registered\n";
+		_stats.failed++;
+		return 0;
+	}
+
+	if (_entries.count(key) != 0)
+	{
+		_stats.deduplicated++;
+		return key;
+	}
+
+	// map nodes never move, so the builder can point into its own entry
+	Entry& entry = _entries[key];
+	entry.state = std::move(state);
+	entry.builder = builder;
+	entry.pass = pass;
+
+	const VkPipelineVertexInputStateCreateInfo& vertexInput = builder._vertexInputInfo;
+	entry.bindings.assign(vertexInput.pVertexBindingDescriptions, vertexInput.pVertexBindingDescriptions + vertexInput.vertexBindingDescriptionCount);
+	entry.attributes.assign(vertexInput.pVertexAttributeDescriptions, vertexInput.pVertexAttributeDescriptions + vertexInput.vertexAttributeDescriptionCount);
+	entry.builder._vertexInputInfo.pVertexBindingDescriptions = entry.bindings.data();
+	entry.builder._vertexInputInfo.pVertexAttributeDescriptions = entry.attributes.data();
+
+	entry.entryPoints.reserve(builder._shaderStages.size());
+	for (VkPipelineShaderStageCreateInfo& stage : entry.builder._shaderStages)
+	{
+		entry.entryPoints.push_back(stage.pName != nullptr ? stage.pName : "main");
+		stage.pName = entry.entryPoints.back().c_str();
+	}
+
+	_pending.push_back(key);
+
+	return key;
+}
+
+uint32_t PipelineRegistry::buildPending(bool useJobs)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::vector<Entry*> entries;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (PipelineKey key : _pending)
+		{
+			entries.push_back(&_entries[key]);
+		}
+
+		_pending.clear();
+	}
+
+	std::vector<VkPipeline> pipelines(entries.size(), VK_NULL_HANDLE);
+
+	auto build = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			pipelines[i] = entries[i]->builder.buildPipeline(_device, entries[i]->pass, _cache);
+		}
+	};
+
+	if (useJobs)
+	{
+		vkJobs::parallelFor(entries.size(), 1, build);
+	}
+	else
+	{
+		build(0, entries.size());
+	}
+
+	uint32_t failed = 0;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		entries[i]->pipeline = pipelines[i];
+		entries[i]->pending = false;
+		failed += pipelines[i] == VK_NULL_HANDLE ? 1 : 0;
+	}
+
+	_stats.pipelines += static_cast<uint32_t>(entries.size()) - failed;
+	_stats.failed += failed;
+	_stats.buildTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	return failed;
+}
+
+std::vector<PipelineKey> PipelineRegistry::buildBatch(const std::vector<PipelineBuilder>& builders, VkRenderPass pass)
+{
+	std::vector<PipelineKey> keys;
+	keys.reserve(builders.size());
+
+	for (const PipelineBuilder& builder : builders)
+	{
+		keys.push_back(request(builder, pass));
+	}
+
+	buildPending();
+
+	return keys;
+}
+
+VkPipeline PipelineRegistry::get(PipelineKey key) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto it = _entries.find(key);
+	return it != _entries.end() ? it->second.pipeline : VK_NULL_HANDLE;
+}
+
+VkPipeline PipelineRegistry::remove(PipelineKey key)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto it = _entries.find(key);
+	if (it == _entries.end() || it->second.pending)
+	{
+		return VK_NULL_HANDLE;
+	}
+
+	VkPipeline pipeline = it->second.pipeline;
+	_entries.erase(it);
+
+	if (pipeline != VK_NULL_HANDLE)
+	{
+		_stats.pipelines--;
+	}
+
+	return pipeline;
+}
+
+PipelineRegistryStats PipelineRegistry::getStats() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _stats;
+}
+
+double PipelineRegistry::timeRebuild(VkPipelineCache cache, uint32_t& outBuilt)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	std::vector<VkPipeline> pipelines;
+	pipelines.reserve(_entries.size());
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (auto& [key, entry] : _entries)
+	{
+		if (!entry.pending)
+		{
+			pipelines.push_back(entry.builder.buildPipeline(_device, entry.pass, cache));
+		}
+	}
+
+	const double time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	outBuilt = 0;
+	for (VkPipeline pipeline : pipelines)
+	{
+		if (pipeline != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(_device, pipeline, nullptr);
+			outBuilt++;
+		}
+	}
+
+	return time;
+}
@@ -0,0 +1,427 @@
+#include "vk_profiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	struct ThreadBuffer
+	{
+		static constexpr uint64_t CAPACITY = 1 << 16;
+
+		// written by the owning thread only, relaxed atomics so readers can copy a slot while it is rewritten
+		struct Slot
+		{
+			std::atomic<const char*> name{ nullptr };
+			std::atomic<vkProf::Ticks> start{ 0 };
+			std::atomic<vkProf::Ticks> end{ 0 };
+			std::atomic<uint32_t> depth{ 0 };
+		};
+
+		// zones recorded so far, slot head % CAPACITY is the next one written
+		std::atomic<uint64_t> head{ 0 };
+		Slot slots[CAPACITY];
+
+		uint32_t id{ 0 };
+		std::string name; // guarded by registryMutex
+	};
+
+	// buffers outlive their threads, so zones of finished workers still show up in a trace until a new
+	// thread takes the buffer over, the registry only grows to the most threads alive at once
+	std::mutex registryMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> registry;
+	std::vector<ThreadBuffer*> retiredBuffers; // guarded by registryMutex
+
+	thread_local ThreadBuffer* tlsBuffer = nullptr;
+
+	// returns the buffer of an exiting thread, kept apart from tlsBuffer so recording stays a plain load
+	struct ThreadBufferRetirer
+	{
+		ThreadBuffer* buffer = nullptr;
+
+		~ThreadBufferRetirer()
+		{
+			if (buffer != nullptr)
+			{
+				std::lock_guard<std::mutex> lock(registryMutex);
+				retiredBuffers.push_back(buffer);
+			}
+		}
+	};
+
+	thread_local ThreadBufferRetirer tlsRetirer;
+
+	struct Calibration
+	{
+		vkProf::Ticks ticks;
+		std::chrono::steady_clock::time_point time;
+	};
+
+	const Calibration& getCalibration()
+	{
+		static const Calibration calibration = { vkProf::now(), std::chrono::steady_clock::now() };
+		return calibration;
+	}
+
+	ThreadBuffer* getThreadBuffer()
+	{
+		if (tlsBuffer == nullptr)
+		{
+			// the origin is taken before the first zone of any thread
+			getCalibration();
+
+			std::lock_guard<std::mutex> lock(registryMutex);
+
+			if (!retiredBuffers.empty())
+			{
+				// readers hold registryMutex, so none is copying the zones of the exited thread being dropped
+				tlsBuffer = retiredBuffers.back();
+				retiredBuffers.pop_back();
+				tlsBuffer->head.store(0, std::memory_order_relaxed);
+			}
+			else
+			{
+				auto buffer = std::make_unique<ThreadBuffer>();
+				buffer->id = static_cast<uint32_t>(registry.size());
+				tlsBuffer = buffer.get();
+				registry.push_back(std::move(buffer));
+			}
+
+			tlsBuffer->name = "thread " + std::to_string(tlsBuffer->id);
+			tlsRetirer.buffer = tlsBuffer;
+		}
+
+		return tlsBuffer;
+	}
+
+	// start ticks of the last frames, written by the thread calling markFrame
+	constexpr uint32_t FRAME_HISTORY = 2;
+	std::atomic<vkProf::Ticks> frameStarts[FRAME_HISTORY];
+	std::atomic<uint64_t> frameCount{ 0 };
+}
+
+std::atomic<bool> vkProf::detail::enabled{ true };
+
+void vkProf::detail::recordZone(const char* name, Ticks start, Ticks end, uint32_t depth)
+{
+	ThreadBuffer* buffer = getThreadBuffer();
+
+	const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+	// a reader that sees any store below also sees head, so it knows the slot's old zone is gone
+	std::atomic_thread_fence(std::memory_order_release);
+
+	ThreadBuffer::Slot& slot = buffer->slots[head & (ThreadBuffer::CAPACITY - 1)];
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.start.store(start, std::memory_order_relaxed);
+	slot.end.store(end, std::memory_order_relaxed);
+	slot.depth.store(depth, std::memory_order_relaxed);
+
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
+double vkProf::getNanosecondsPerTick()
+{
+#ifdef VK_PROFILER_RDTSC
+	const Calibration& calibration = getCalibration();
+
+	// a few milliseconds keep the ratio within a fraction of a percent, later calls only get more precise
+	std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now();
+	while (time - calibration.time < std::chrono::milliseconds(5))
+	{
+		std::this_thread::yield();
+		time = std::chrono::steady_clock::now();
+	}
+
+	const Ticks ticks = now();
+	const double nanoseconds = std::chrono::duration<double, std::nano>(time - calibration.time).count();
+
+	return nanoseconds / double(ticks - calibration.ticks);
+#else
+	return 1.0;
+#endif
+}
+
+vkProf::Ticks vkProf::getOrigin()
+{
+	return getCalibration().ticks;
+}
+
+void vkProf::setEnabled(bool enabled)
+{
+	detail::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void vkProf::setThreadName(const char* name)
+{
+	ThreadBuffer* buffer = getThreadBuffer();
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	buffer->name = name;
+}
+
+std::vector<vkProf::ZoneEvent> vkProf::collect(Ticks begin, Ticks end)
+{
+	std::vector<ZoneEvent> events;
+	std::vector<uint64_t> indices;
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+
+	for (const std::unique_ptr<ThreadBuffer>& buffer : registry)
+	{
+		const uint64_t head = buffer->head.load(std::memory_order_acquire);
+		const uint64_t first = head > ThreadBuffer::CAPACITY ? head - ThreadBuffer::CAPACITY : 0;
+		const size_t threadStart = events.size();
+		indices.clear();
+
+		// newest first, zones end in order so the walk stops at the first one before begin
+		uint64_t index = head;
+		while (index > first)
+		{
+			index--;
+
+			const ThreadBuffer::Slot& slot = buffer->slots[index & (ThreadBuffer::CAPACITY - 1)];
+
+			ZoneEvent event;
+			event.name = slot.name.load(std::memory_order_relaxed);
+			event.start = slot.start.load(std::memory_order_relaxed);
+			event.end = slot.end.load(std::memory_order_relaxed);
+			event.depth = slot.depth.load(std::memory_order_relaxed);
+			event.thread = buffer->id;
+
+			if (event.end < begin)
+			{
+				break;
+			}
+
+			if (event.end < end)
+			{
+				events.push_back(event);
+				indices.push_back(index);
+			}
+		}
+
+		// the owner kept writing during the copy, every slot it may have started rewriting is dropped,
+		// the copied events are newest first so those are at the back
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint64_t newHead = buffer->head.load(std::memory_order_relaxed);
+		const uint64_t firstIntact = newHead >= ThreadBuffer::CAPACITY ? newHead - ThreadBuffer::CAPACITY + 1 : 0;
+
+		while (!indices.empty() && indices.back() < firstIntact)
+		{
+			indices.pop_back();
+			events.pop_back();
+		}
+
+		std::reverse(events.begin() + threadStart, events.end());
+	}
+
+	return events;
+}
+
+std::vector<vkProf::ThreadInfo> vkProf::getThreads()
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+
+	std::vector<ThreadInfo> threads;
+	for (const std::unique_ptr<ThreadBuffer>& buffer : registry)
+	{
+		threads.push_back({ buffer->id, buffer->name });
+	}
+
+	return threads;
+}
+
+void vkProf::markFrame()
+{
+	const uint64_t frame = frameCount.load(std::memory_order_relaxed);
+	frameStarts[frame % FRAME_HISTORY].store(now(), std::memory_order_relaxed);
+	frameCount.store(frame + 1, std::memory_order_release);
+}
+
+bool vkProf::getLastFrame(Ticks& outBegin, Ticks& outEnd)
+{
+	const uint64_t frame = frameCount.load(std::memory_order_acquire);
+	if (frame < 2)
+	{
+		return false;
+	}
+
+	outBegin = frameStarts[(frame - 2) % FRAME_HISTORY].load(std::memory_order_relaxed);
+	outEnd = frameStarts[(frame - 1) % FRAME_HISTORY].load(std::memory_order_relaxed);
+
+	return true;
+}
+
+bool vkProf::writeChromeTrace(const char* filename)
+{
+	FILE* output = fopen(filename, "w");
+	if (output == nullptr)
+	{
+		printf("Failed to open %s for writing\n", filename);
+		return false;
+	}
+
+	const std::vector<ZoneEvent> events = collect();
+	const std::vector<ThreadInfo> threads = getThreads();
+	const double microsecondsPerTick = getNanosecondsPerTick() / 1000.0;
+	const Ticks origin = getOrigin();
+
+	fprintf(output, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	bool first = true;
+	for (const ThreadInfo& thread : threads)
+	{
+		fprintf(output, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+			first ? "" : ",\n", thread.id, thread.name.c_str());
+		first = false;
+	}
+
+	for (const ZoneEvent& event : events)
+	{
+		const double start = double(event.start - std::min(event.start, origin)) * microsecondsPerTick;
+		const double duration = double(event.end - event.start) * microsecondsPerTick;
+
+		fprintf(output, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+			first ? "" : ",\n", event.name, event.thread, start, duration);
+		first = false;
+	}
+
+	fprintf(output, "\n]}\n");
+	fclose(output);
+
+	printf("%zu zones of %zu threads written to %s\n", events.size(), threads.size(), filename);
+
+	return true;
+}
+
+void vkProf::benchmarkProfiler()
+{
+	using Clock = std::chrono::high_resolution_clock;
+
+	const int zoneCount = 1000000;
+	const bool wasEnabled = isEnabled();
+
+	auto measure = [&]() {
+		auto start = Clock::now();
+		for (int i = 0; i < zoneCount; i++)
+		{
+			VK_PROFILE_ZONE("benchmark");
+		}
+
+		return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / zoneCount;
+	};
+
+	// the first pass registers the thread and faults the ring in
+	measure();
+
+	setEnabled(true);
+	const double enabledCost = measure();
+
+	setEnabled(false);
+	const double disabledCost = measure();
+
+	setEnabled(wasEnabled);
+
+	auto start = Clock::now();
+	volatile Ticks timestamp = 0;
+	for (int i = 0; i < zoneCount; i++)
+	{
+		timestamp = now();
+	}
+	static_cast<void>(timestamp);
+	const double timestampCost = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / zoneCount;
+
+	printf("%d zones, %.1f ns per enabled zone, %.1f ns per disabled zone, %.1f ns per timestamp (%s)\n",
+		zoneCount, enabledCost, disabledCost, timestampCost,
+#ifdef VK_PROFILER_RDTSC
+		"rdtsc"
+#else
+		"steady_clock"
+#endif
+		);
+	printf("%.4f ns per tick\n", getNanosecondsPerTick());
+}
+
+bool vkProf::stressTestProfiler(uint32_t iterations)
+{
+	// every zone is synthetic, depth d is named ZONE_NAMES[d] and spans d + 1 ticks, so a torn copy shows up
+	static const char* const ZONE_NAMES[] = { "stress depth 0", "stress depth 1", "stress depth 2" };
+	const uint32_t writerCount = 3;
+	const uint64_t zonesPerWriter = ThreadBuffer::CAPACITY * 4;
+
+	const bool wasEnabled = isEnabled();
+	setEnabled(true);
+
+	bool passed = true;
+	const size_t threadsBefore = getThreads().size();
+
+	for (uint32_t iteration = 0; iteration < iterations && passed; iteration++)
+	{
+		std::atomic<uint32_t> writersDone{ 0 };
+
+		std::vector<std::thread> writers;
+		for (uint32_t t = 0; t < writerCount; t++)
+		{
+			writers.emplace_back([&]() {
+				setThreadName("stress writer");
+				for (uint64_t k = 0; k < zonesPerWriter; k++)
+				{
+					const uint32_t depth = static_cast<uint32_t>(k % 3);
+					detail::recordZone(ZONE_NAMES[depth], k * 4, k * 4 + depth + 1, depth);
+				}
+				writersDone.fetch_add(1, std::memory_order_release);
+			});
+		}
+
+		uint64_t collected = 0;
+		bool lastPass = false;
+		while (passed && !lastPass)
+		{
+			// one more pass after the writers finished covers the complete rings
+			lastPass = writersDone.load(std::memory_order_acquire) == writerCount;
+
+			const std::vector<ZoneEvent> events = collect();
+			for (size_t i = 0; i < events.size() && passed; i++)
+			{
+				const ZoneEvent& event = events[i];
+				const bool intact = event.depth < 3 && event.name == ZONE_NAMES[event.depth] && event.end == event.start + event.depth + 1;
+				const bool ordered = i == 0 || events[i - 1].thread != event.thread || events[i - 1].end < event.end;
+				if (!intact || !ordered)
+				{
+					printf("profiler : %s zone on thread %u, start %llu end %llu depth %u\n", intact ? "unordered" : "torn",
+						event.thread, static_cast<unsigned long long>(event.start), static_cast<unsigned long long>(event.end), event.depth);
+					passed = false;
+				}
+			}
+
+			collected += events.size();
+		}
+
+		for (std::thread& writer : writers)
+		{
+			writer.join();
+		}
+
+		// the writers of the previous iteration exited, their rings are reused instead of new ones
+		const size_t threadCount = getThreads().size();
+		if (threadCount > threadsBefore + writerCount)
+		{
+			printf("profiler : %zu rings after iteration %u, at most %zu expected\n", threadCount, iteration, threadsBefore + writerCount);
+			passed = false;
+		}
+
+		if (collected == 0)
+		{
+			printf("profiler : no zone was collected in iteration %u\n", iteration);
+			passed = false;
+		}
+	}
+
+	setEnabled(wasEnabled);
+
+	printf("profiler stress test %s after %u iterations\n", passed ? "passed" : "FAILED", iterations);
+	return passed;
+}
@@ -0,0 +1,840 @@
+#include "vk_reflection.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	// the parts of the SPIR-V specification the reflection needs
+	enum : uint32_t
+	{
+		OP_NAME = 5,
+		OP_ENTRY_POINT = 15,
+		OP_TYPE_INT = 21,
+		OP_TYPE_FLOAT = 22,
+		OP_TYPE_VECTOR = 23,
+		OP_TYPE_MATRIX = 24,
+		OP_TYPE_IMAGE = 25,
+		OP_TYPE_SAMPLER = 26,
+		OP_TYPE_SAMPLED_IMAGE = 27,
+		OP_TYPE_ARRAY = 28,
+		OP_TYPE_RUNTIME_ARRAY = 29,
+		OP_TYPE_STRUCT = 30,
+		OP_TYPE_POINTER = 32,
+		OP_CONSTANT = 43,
+		OP_VARIABLE = 59,
+		OP_DECORATE = 71,
+		OP_MEMBER_DECORATE = 72,
+	};
+
+	enum : uint32_t
+	{
+		DECORATION_BLOCK = 2,
+		DECORATION_BUFFER_BLOCK = 3,
+		DECORATION_ARRAY_STRIDE = 6,
+		DECORATION_MATRIX_STRIDE = 7,
+		DECORATION_BUILT_IN = 11,
+		DECORATION_LOCATION = 30,
+		DECORATION_BINDING = 33,
+		DECORATION_DESCRIPTOR_SET = 34,
+		DECORATION_OFFSET = 35,
+	};
+
+	enum : uint32_t
+	{
+		STORAGE_UNIFORM_CONSTANT = 0,
+		STORAGE_INPUT = 1,
+		STORAGE_UNIFORM = 2,
+		STORAGE_PUSH_CONSTANT = 9,
+		STORAGE_STORAGE_BUFFER = 12,
+	};
+
+	constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+	constexpr uint32_t DIM_BUFFER = 5;
+	constexpr uint32_t NOT_SET = UINT32_MAX;
+	constexpr uint32_t MAX_ID_BOUND = 0x3FFFFF;
+
+	struct Id
+	{
+		// the instruction defining the id, types, constants and variables only
+		const uint32_t* instruction = nullptr;
+		uint32_t wordCount = 0;
+
+		std::string name;
+		uint32_t set = NOT_SET;
+		uint32_t binding = NOT_SET;
+		uint32_t location = NOT_SET;
+		uint32_t arrayStride = 0;
+		bool builtIn = false;
+		bool block = false;
+		bool bufferBlock = false;
+
+		// struct members
+		std::vector<uint32_t> memberOffsets;
+		std::vector<uint32_t> memberMatrixStrides;
+	};
+
+	class Module
+	{
+	public:
+		std::vector<Id> ids;
+
+		uint32_t getOpcode(uint32_t id) const
+		{
+			return isDefined(id) ? ids[id].instruction[0] & 0xFFFF : 0;
+		}
+
+		// word index of the instruction defining id, 0 when it is out of range
+		uint32_t getWord(uint32_t id, uint32_t index) const
+		{
+			return isDefined(id) && index < ids[id].wordCount ? ids[id].instruction[index] : 0;
+		}
+
+		uint32_t getConstant(uint32_t id, uint32_t fallback) const
+		{
+			return getOpcode(id) == OP_CONSTANT ? getWord(id, 3) : fallback;
+		}
+
+		uint32_t getTypeSize(uint32_t type, uint32_t matrixStride, uint32_t depth = 0) const
+		{
+			// types only refer to types defined before them, the limit only guards malformed code
+			if (depth > 32)
+			{
+				return 0;
+			}
+
+			switch (getOpcode(type))
+			{
+			case OP_TYPE_INT:
+			case OP_TYPE_FLOAT:
+				return getWord(type, 2) / 8;
+			case OP_TYPE_VECTOR:
+				return getWord(type, 3) * getTypeSize(getWord(type, 2), 0, depth + 1);
+			case OP_TYPE_MATRIX:
+				return getWord(type, 3) * (matrixStride != 0 ? matrixStride : getTypeSize(getWord(type, 2), 0, depth + 1));
+			case OP_TYPE_ARRAY:
+			{
+				const uint32_t stride = ids[type].arrayStride;
+				return getConstant(getWord(type, 3), 1) * (stride != 0 ? stride : getTypeSize(getWord(type, 2), matrixStride, depth + 1));
+			}
+			case OP_TYPE_STRUCT:
+			{
+				const Id& info = ids[type];
+				uint32_t size = 0;
+				for (uint32_t member = 0; member + 2 < info.wordCount; member++)
+				{
+					const uint32_t offset = member < info.memberOffsets.size() ? info.memberOffsets[member] : 0;
+					const uint32_t stride = member < info.memberMatrixStrides.size() ? info.memberMatrixStrides[member] : 0;
+					size = std::max(size, offset + getTypeSize(info.instruction[member + 2], stride, depth + 1));
+				}
+				return size;
+			}
+			default:
+				return 0;
+			}
+		}
+
+		VkFormat getInputFormat(uint32_t type) const
+		{
+			uint32_t componentCount = 1;
+			if (getOpcode(type) == OP_TYPE_VECTOR)
+			{
+				componentCount = getWord(type, 3);
+				type = getWord(type, 2);
+			}
+
+			if (componentCount < 1 || componentCount > 4 || getWord(type, 2) != 32)
+			{
+				return VK_FORMAT_UNDEFINED;
+			}
+
+			static const VkFormat floatFormats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+			static const VkFormat intFormats[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+			static const VkFormat uintFormats[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+
+			switch (getOpcode(type))
+			{
+			case OP_TYPE_FLOAT:
+				return floatFormats[componentCount - 1];
+			case OP_TYPE_INT:
+				return getWord(type, 3) != 0 ? intFormats[componentCount - 1] : uintFormats[componentCount - 1];
+			default:
+				return VK_FORMAT_UNDEFINED;
+			}
+		}
+
+	private:
+		bool isDefined(uint32_t id) const
+		{
+			return id < ids.size() && ids[id].instruction != nullptr;
+		}
+	};
+
+	bool getDescriptorType(const Module& module, uint32_t storage, uint32_t type, VkDescriptorType& outType)
+	{
+		switch (storage)
+		{
+		case STORAGE_UNIFORM:
+			if (module.ids[type].block || module.ids[type].bufferBlock)
+			{
+				outType = module.ids[type].bufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				return true;
+			}
+			return false;
+		case STORAGE_STORAGE_BUFFER:
+			outType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			return true;
+		case STORAGE_UNIFORM_CONSTANT:
+			switch (module.getOpcode(type))
+			{
+			case OP_TYPE_SAMPLED_IMAGE:
+				outType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				return true;
+			case OP_TYPE_SAMPLER:
+				outType = VK_DESCRIPTOR_TYPE_SAMPLER;
+				return true;
+			case OP_TYPE_IMAGE:
+			{
+				// Sampled is 2 for images used without a sampler
+				const bool storageImage = module.getWord(type, 7) == 2;
+				if (module.getWord(type, 3) == DIM_BUFFER)
+				{
+					outType = storageImage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+				}
+				else
+				{
+					outType = storageImage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+				}
+				return true;
+			}
+			default:
+				return false;
+			}
+		default:
+			return false;
+		}
+	}
+
+	VkShaderStageFlags getStage(uint32_t executionModel)
+	{
+		switch (executionModel)
+		{
+		case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+		case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+		case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+		case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+		case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+		case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+		default: return 0;
+		}
+	}
+
+	VkDescriptorType getPlainType(VkDescriptorType type)
+	{
+		switch (type)
+		{
+		case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC: return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC: return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		default: return type;
+		}
+	}
+
+	vkReflect::DescriptorBinding* findBinding(std::vector<vkReflect::DescriptorBinding>& bindings, uint32_t set, uint32_t binding)
+	{
+		for (vkReflect::DescriptorBinding& existing : bindings)
+		{
+			if (existing.set == set && existing.binding == binding)
+			{
+				return &existing;
+			}
+		}
+
+		return nullptr;
+	}
+}
+
+bool vkReflect::reflectShader(const uint32_t* code, size_t wordCount, ShaderReflection& outReflection)
+{
+	if (wordCount < 5 || code[0] != SPIRV_MAGIC)
+	{
+		printf("Not a SPIR-V module\n");
+		return false;
+	}
+
+	// the id bound is read before anything is parsed, the universal limit of the specification keeps a
+	// corrupt header from allocating gigabytes
+	if (code[3] > MAX_ID_BOUND)
+	{
+		printf("SPIR-V id bound %u is above the limit of %u\n", code[3], MAX_ID_BOUND);
+		return false;
+	}
+
+	Module module;
+	module.ids.resize(code[3]);
+
+	std::vector<const uint32_t*> variables;
+	uint32_t executionModel = UINT32_MAX;
+
+	for (size_t offset = 5; offset < wordCount;)
+	{
+		const uint32_t* instruction = code + offset;
+		const uint32_t count = instruction[0] >> 16;
+		const uint32_t opcode = instruction[0] & 0xFFFF;
+
+		if (count == 0 || offset + count > wordCount)
+		{
+			printf("Malformed SPIR-V instruction at word %zu\n", offset);
+			return false;
+		}
+
+		offset += count;
+
+		// every id operand used below is checked against the bound, one outside of it makes the module invalid
+		uint32_t outOfBound = NOT_SET;
+		auto getId = [&](uint32_t index) -> Id* {
+			if (index >= count)
+			{
+				return nullptr;
+			}
+
+			if (instruction[index] >= module.ids.size())
+			{
+				outOfBound = instruction[index];
+				return nullptr;
+			}
+
+			return &module.ids[instruction[index]];
+		};
+
+		switch (opcode)
+		{
+		case OP_ENTRY_POINT:
+			if (executionModel == UINT32_MAX && count > 1)
+			{
+				executionModel = instruction[1];
+			}
+			break;
+		case OP_NAME:
+			if (Id* id = getId(1); id != nullptr && count > 2)
+			{
+				const char* name = reinterpret_cast<const char*>(instruction + 2);
+				id->name.assign(name, strnlen(name, (count - 2) * sizeof(uint32_t)));
+			}
+			break;
+		case OP_DECORATE:
+			if (Id* id = getId(1); id != nullptr && count > 2)
+			{
+				const uint32_t value = count > 3 ? instruction[3] : 0;
+				switch (instruction[2])
+				{
+				case DECORATION_BLOCK: id->block = true; break;
+				case DECORATION_BUFFER_BLOCK: id->bufferBlock = true; break;
+				case DECORATION_ARRAY_STRIDE: id->arrayStride = value; break;
+				case DECORATION_BUILT_IN: id->builtIn = true; break;
+				case DECORATION_LOCATION: id->location = value; break;
+				case DECORATION_BINDING: id->binding = value; break;
+				case DECORATION_DESCRIPTOR_SET: id->set = value; break;
+				}
+			}
+			break;
+		case OP_MEMBER_DECORATE:
+			if (Id* id = getId(1); id != nullptr && count > 4)
+			{
+				const uint32_t member = instruction[2];
+				std::vector<uint32_t>* values = instruction[3] == DECORATION_OFFSET ? &id->memberOffsets :
+					instruction[3] == DECORATION_MATRIX_STRIDE ? &id->memberMatrixStrides : nullptr;
+
+				// members are numbered densely, a bogus index would only grow the vector
+				if (values != nullptr && member < 4096)
+				{
+					values->resize(std::max<size_t>(values->size(), member + 1), 0);
+					(*values)[member] = instruction[4];
+				}
+			}
+			break;
+		case OP_TYPE_INT:
+		case OP_TYPE_FLOAT:
+		case OP_TYPE_VECTOR:
+		case OP_TYPE_MATRIX:
+		case OP_TYPE_IMAGE:
+		case OP_TYPE_SAMPLER:
+		case OP_TYPE_SAMPLED_IMAGE:
+		case OP_TYPE_ARRAY:
+		case OP_TYPE_RUNTIME_ARRAY:
+		case OP_TYPE_STRUCT:
+		case OP_TYPE_POINTER:
+			if (Id* id = getId(1); id != nullptr)
+			{
+				id->instruction = instruction;
+				id->wordCount = count;
+			}
+			break;
+		case OP_CONSTANT:
+		case OP_VARIABLE:
+			if (Id* id = getId(2); id != nullptr)
+			{
+				id->instruction = instruction;
+				id->wordCount = count;
+			}
+
+			if (opcode == OP_VARIABLE && count > 3 && getId(2) != nullptr)
+			{
+				variables.push_back(instruction);
+			}
+			break;
+		}
+
+		if (outOfBound != NOT_SET)
+		{
+			printf("SPIR-V id %u at word %zu is outside the bound %u\n", outOfBound, offset - count, code[3]);
+			return false;
+		}
+	}
+
+	outReflection = {};
+	outReflection.stages = getStage(executionModel);
+
+	if (outReflection.stages == 0)
+	{
+		printf("SPIR-V module without a graphics or compute entry point\n");
+		return false;
+	}
+
+	uint32_t pushConstantEnd = 0;
+
+	for (const uint32_t* variable : variables)
+	{
+		const Id& info = module.ids[variable[2]];
+		const uint32_t storage = variable[3];
+
+		// pointer to the variable's type
+		const uint32_t pointer = variable[1];
+		if (module.getOpcode(pointer) != OP_TYPE_POINTER)
+		{
+			continue;
+		}
+
+		uint32_t type = module.getWord(pointer, 3);
+
+		if (storage == STORAGE_INPUT)
+		{
+			if (outReflection.stages == VK_SHADER_STAGE_VERTEX_BIT && !info.builtIn && info.location != NOT_SET)
+			{
+				outReflection.inputs.push_back({ info.location, module.getInputFormat(type), info.name });
+			}
+			continue;
+		}
+
+		if (storage == STORAGE_PUSH_CONSTANT)
+		{
+			const std::vector<uint32_t>& offsets = module.ids[type < module.ids.size() ? type : 0].memberOffsets;
+			const uint32_t begin = offsets.empty() ? 0 : *std::min_element(offsets.begin(), offsets.end());
+			pushConstantEnd = std::max(pushConstantEnd, module.getTypeSize(type, 0));
+
+			outReflection.pushConstants.stageFlags = outReflection.stages;
+			outReflection.pushConstants.offset = begin;
+			outReflection.pushConstants.size = pushConstantEnd > begin ? pushConstantEnd - begin : 0;
+			continue;
+		}
+
+		if (info.set == NOT_SET || info.binding == NOT_SET)
+		{
+			continue;
+		}
+
+		uint32_t count = 1;
+		if (module.getOpcode(type) == OP_TYPE_ARRAY)
+		{
+			count = module.getConstant(module.getWord(type, 3), 1);
+			type = module.getWord(type, 2);
+		}
+		else if (module.getOpcode(type) == OP_TYPE_RUNTIME_ARRAY)
+		{
+			// would need descriptor indexing, the layout gets a single descriptor
+			printf("Set %u binding %u is a runtime array, reflected as one descriptor\n", info.set, info.binding);
+			type = module.getWord(type, 2);
+		}
+
+		VkDescriptorType descriptorType;
+		if (type >= module.ids.size() || !getDescriptorType(module, storage, type, descriptorType))
+		{
+			printf("Set %u binding %u has an unsupported descriptor type\n", info.set, info.binding);
+			continue;
+		}
+
+		const std::string& name = info.name.empty() ? module.ids[type].name : info.name;
+		outReflection.bindings.push_back({ info.set, info.binding, descriptorType, count, outReflection.stages, name });
+	}
+
+	std::sort(outReflection.bindings.begin(), outReflection.bindings.end(), [](const DescriptorBinding& a, const DescriptorBinding& b) {
+		return a.set < b.set || (a.set == b.set && a.binding < b.binding);
+		});
+
+	std::sort(outReflection.inputs.begin(), outReflection.inputs.end(), [](const VertexInput& a, const VertexInput& b) {
+		return a.location < b.location;
+		});
+
+	return true;
+}
+
+bool vkReflect::mergeReflection(ShaderReflection& pipeline, const ShaderReflection& stage)
+{
+	bool compatible = true;
+
+	for (const DescriptorBinding& binding : stage.bindings)
+	{
+		DescriptorBinding* existing = findBinding(pipeline.bindings, binding.set, binding.binding);
+		if (existing == nullptr)
+		{
+			pipeline.bindings.push_back(binding);
+			continue;
+		}
+
+		if (getPlainType(existing->type) != getPlainType(binding.type) || existing->count != binding.count)
+		{
+			printf("Set %u binding %u (%s) is declared differently by two stages\n", binding.set, binding.binding, binding.name.c_str());
+			compatible = false;
+		}
+
+		existing->stages |= binding.stages;
+	}
+
+	std::sort(pipeline.bindings.begin(), pipeline.bindings.end(), [](const DescriptorBinding& a, const DescriptorBinding& b) {
+		return a.set < b.set || (a.set == b.set && a.binding < b.binding);
+		});
+
+	// one range for every stage, ranges sharing a stage are not allowed in a pipeline layout
+	if (stage.pushConstants.size > 0)
+	{
+		VkPushConstantRange& range = pipeline.pushConstants;
+		if (range.size == 0)
+		{
+			range = stage.pushConstants;
+		}
+		else
+		{
+			const uint32_t end = std::max(range.offset + range.size, stage.pushConstants.offset + stage.pushConstants.size);
+			range.offset = std::min(range.offset, stage.pushConstants.offset);
+			range.size = end - range.offset;
+			range.stageFlags |= stage.pushConstants.stageFlags;
+		}
+	}
+
+	if (stage.stages == VK_SHADER_STAGE_VERTEX_BIT)
+	{
+		pipeline.inputs = stage.inputs;
+	}
+
+	pipeline.stages |= stage.stages;
+
+	return compatible;
+}
+
+void vkReflect::makeDynamic(ShaderReflection& reflection, uint32_t set, uint32_t binding)
+{
+	DescriptorBinding* existing = findBinding(reflection.bindings, set, binding);
+	if (existing == nullptr)
+	{
+		return;
+	}
+
+	if (existing->type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+	{
+		existing->type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	}
+	else if (existing->type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+	{
+		existing->type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	}
+}
+
+uint32_t vkReflect::getSetCount(const ShaderReflection& reflection)
+{
+	return reflection.bindings.empty() ? 0 : reflection.bindings.back().set + 1;
+}
+
+std::vector<VkDescriptorSetLayoutBinding> vkReflect::getSetBindings(const ShaderReflection& reflection, uint32_t set)
+{
+	std::vector<VkDescriptorSetLayoutBinding> bindings;
+
+	for (const DescriptorBinding& binding : reflection.bindings)
+	{
+		if (binding.set == set)
+		{
+			VkDescriptorSetLayoutBinding layoutBinding = {};
+			layoutBinding.binding = binding.binding;
+			layoutBinding.descriptorType = binding.type;
+			layoutBinding.descriptorCount = binding.count;
+			layoutBinding.stageFlags = binding.stages;
+			layoutBinding.pImmutableSamplers = nullptr;
+			bindings.push_back(layoutBinding);
+		}
+	}
+
+	return bindings;
+}
+
+bool vkReflect::isCompatible(const ShaderReflection& shader, const ShaderReflection& layout)
+{
+	bool compatible = true;
+
+	for (const DescriptorBinding& binding : shader.bindings)
+	{
+		const DescriptorBinding* existing = nullptr;
+		for (const DescriptorBinding& candidate : layout.bindings)
+		{
+			if (candidate.set == binding.set && candidate.binding == binding.binding)
+			{
+				existing = &candidate;
+			}
+		}
+
+		if (existing == nullptr)
+		{
+			printf("Set %u binding %u (%s) is not in the layout\n", binding.set, binding.binding, binding.name.c_str());
+			compatible = false;
+		}
+		else if (getPlainType(existing->type) != getPlainType(binding.type) || binding.count > existing->count)
+		{
+			printf("Set %u binding %u (%s) does not match the layout's type or count\n", binding.set, binding.binding, binding.name.c_str());
+			compatible = false;
+		}
+		else if ((binding.stages & ~existing->stages) != 0)
+		{
+			printf("Set %u binding %u (%s) is used by a stage the layout does not give it to\n", binding.set, binding.binding, binding.name.c_str());
+			compatible = false;
+		}
+	}
+
+	for (const VertexInput& input : shader.inputs)
+	{
+		const bool found = std::any_of(layout.inputs.begin(), layout.inputs.end(), [&](const VertexInput& candidate) {
+			return candidate.location == input.location;
+			});
+
+		if (!found)
+		{
+			printf("Vertex input %u (%s) has no attribute\n", input.location, input.name.c_str());
+			compatible = false;
+		}
+	}
+
+	const VkPushConstantRange& pushConstants = shader.pushConstants;
+	if (pushConstants.size > 0 && (pushConstants.offset < layout.pushConstants.offset ||
+		pushConstants.offset + pushConstants.size > layout.pushConstants.offset + layout.pushConstants.size ||
+		(pushConstants.stageFlags & ~layout.pushConstants.stageFlags) != 0))
+	{
+		printf("The push constant block (%u bytes at %u) does not fit the layout's range (%u bytes at %u)\n",
+			pushConstants.size, pushConstants.offset, layout.pushConstants.size, layout.pushConstants.offset);
+		compatible = false;
+	}
+
+	return compatible;
+}
+
+namespace
+{
+	struct ExpectedBinding
+	{
+		uint32_t set;
+		uint32_t binding;
+		VkDescriptorType type;
+	};
+
+	struct ExpectedShader
+	{
+		const char* path;
+		VkShaderStageFlags stages;
+		uint32_t pushConstantSize;
+		std::vector<ExpectedBinding> bindings;
+		std::vector<vkReflect::VertexInput> inputs;
+	};
+
+	bool readSpirv(const char* path, std::vector<uint32_t>& outCode)
+	{
+		std::ifstream file(path, std::ios::ate | std::ios::binary);
+		if (!file.is_open())
+		{
+			printf("Cannot open %s\n", path);
+			return false;
+		}
+
+		const size_t fileSize = static_cast<size_t>(file.tellg());
+		outCode.resize(fileSize / sizeof(uint32_t));
+		file.seekg(0);
+		file.read(reinterpret_cast<char*>(outCode.data()), outCode.size() * sizeof(uint32_t));
+
+		return true;
+	}
+
+	bool checkShader(const ExpectedShader& expected)
+	{
+		std::vector<uint32_t> code;
+		vkReflect::ShaderReflection reflection;
+		if (!readSpirv(expected.path, code) || !vkReflect::reflectShader(code.data(), code.size(), reflection))
+		{
+			printf("%s : FAILED, cannot be reflected\n", expected.path);
+			return false;
+		}
+
+		bool passed = true;
+
+		if (reflection.stages != expected.stages)
+		{
+			printf("%s : stages 0x%x, expected 0x%x\n", expected.path, reflection.stages, expected.stages);
+			passed = false;
+		}
+
+		if (reflection.pushConstants.size != expected.pushConstantSize
+			|| (expected.pushConstantSize > 0 && (reflection.pushConstants.offset != 0 || reflection.pushConstants.stageFlags != expected.stages)))
+		{
+			printf("%s : push constants at %u, %u bytes for stages 0x%x, expected %u bytes\n", expected.path, reflection.pushConstants.offset,
+				reflection.pushConstants.size, reflection.pushConstants.stageFlags, expected.pushConstantSize);
+			passed = false;
+		}
+
+		if (reflection.bindings.size() != expected.bindings.size())
+		{
+			printf("%s : %zu bindings, expected %zu\n", expected.path, reflection.bindings.size(), expected.bindings.size());
+			passed = false;
+		}
+
+		// both lists are sorted by set and binding
+		for (size_t i = 0; i < std::min(reflection.bindings.size(), expected.bindings.size()); i++)
+		{
+			const vkReflect::DescriptorBinding& binding = reflection.bindings[i];
+			const ExpectedBinding& expectedBinding = expected.bindings[i];
+
+			if (binding.set != expectedBinding.set || binding.binding != expectedBinding.binding || binding.type != expectedBinding.type
+				|| binding.count != 1 || binding.stages != expected.stages)
+			{
+				printf("%s : set %u binding %u is type %d, count %u, stages 0x%x, expected set %u binding %u of type %d\n", expected.path,
+					binding.set, binding.binding, binding.type, binding.count, binding.stages, expectedBinding.set, expectedBinding.binding, expectedBinding.type);
+				passed = false;
+			}
+		}
+
+		if (reflection.inputs.size() != expected.inputs.size())
+		{
+			printf("%s : %zu vertex inputs, expected %zu\n", expected.path, reflection.inputs.size(), expected.inputs.size());
+			passed = false;
+		}
+
+		for (size_t i = 0; i < std::min(reflection.inputs.size(), expected.inputs.size()); i++)
+		{
+			const vkReflect::VertexInput& input = reflection.inputs[i];
+			const vkReflect::VertexInput& expectedInput = expected.inputs[i];
+
+			if (input.location != expectedInput.location || input.format != expectedInput.format || input.name != expectedInput.name)
+			{
+				printf("%s : input %s at location %u has format %d, expected %s at %u with format %d\n", expected.path, input.name.c_str(),
+					input.location, input.format, expectedInput.name.c_str(), expectedInput.location, expectedInput.format);
+				passed = false;
+			}
+		}
+
+		printf("%s : %zu bindings, %u push constant bytes, %zu vertex inputs : %s\n", expected.path, reflection.bindings.size(),
+			reflection.pushConstants.size, reflection.inputs.size(), passed ? "passed" : "FAILED");
+
+		return passed;
+	}
+
+	bool checkRejected(const char* description, const std::vector<uint32_t>& code)
+	{
+		vkReflect::ShaderReflection reflection;
+		const bool rejected = !vkReflect::reflectShader(code.data(), code.size(), reflection);
+
+		printf("%s : %s\n", description, rejected ? "rejected, passed" : "accepted, FAILED");
+
+		return rejected;
+	}
+}
+
+bool vkReflect::testReflection()
+{
+	const VkShaderStageFlags vertex = VK_SHADER_STAGE_VERTEX_BIT;
+	const VkShaderStageFlags fragment = VK_SHADER_STAGE_FRAGMENT_BIT;
+	const VkShaderStageFlags compute = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	// the interfaces init_descriptors, init_pipelines and initIndirect build their layouts for
+	const ExpectedShader shaders[] = {
+		{ "shaders/triangle_mesh_vert.spv", vertex, 112,
+			{ { 0, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER }, { 1, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER } },
+			{ { 0, VK_FORMAT_R32G32B32_SFLOAT, "position" }, { 1, VK_FORMAT_R32G32B32_SFLOAT, "normal" },
+				{ 2, VK_FORMAT_R32G32B32_SFLOAT, "color" }, { 3, VK_FORMAT_R32G32_SFLOAT, "vTexCoords" } } },
+		{ "shaders/triangle_mesh_packed_vert.spv", vertex, 112,
+			{ { 0, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER }, { 1, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER } },
+			{ { 0, VK_FORMAT_R32G32B32A32_SFLOAT, "packedPosition" }, { 1, VK_FORMAT_R32G32_SFLOAT, "packedNormal" },
+				{ 3, VK_FORMAT_R32G32_SFLOAT, "vTexCoords" } } },
+		{ "shaders/triangle_mesh_frag.spv", fragment, 0,
+			{ { 0, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER }, { 2, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER } },
+			{} },
+		{ "shaders/indirect_cull_comp.spv", compute, 0,
+			{ { 0, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER }, { 0, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER },
+				{ 0, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER }, { 0, 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER } },
+			{} },
+	};
+
+	bool passed = true;
+	for (const ExpectedShader& shader : shaders)
+	{
+		passed &= checkShader(shader);
+	}
+
+	// malformed variants of a module that reflects, each one has to fail instead of reading out of bounds
+	std::vector<uint32_t> code;
+	if (!readSpirv(shaders[0].path, code) || code.size() < 5)
+	{
+		return false;
+	}
+
+	std::vector<uint32_t> badMagic = code;
+	badMagic[0] = 0x03022307;
+	passed &= checkRejected("byte swapped magic", badMagic);
+
+	passed &= checkRejected("header only", std::vector<uint32_t>(code.begin(), code.begin() + 4));
+
+	// cut through the first instruction of more than one word, the entry point or an earlier one
+	size_t offset = 5;
+	while (offset < code.size() && (code[offset] >> 16) < 2)
+	{
+		offset += std::max<uint32_t>(code[offset] >> 16, 1);
+	}
+	passed &= checkRejected("truncated instruction", std::vector<uint32_t>(code.begin(), code.begin() + std::min(offset + 1, code.size())));
+
+	std::vector<uint32_t> zeroLength = code;
+	zeroLength[5] &= 0xFFFF;
+	passed &= checkRejected("zero length instruction", zeroLength);
+
+	std::vector<uint32_t> hugeBound = code;
+	hugeBound[3] = UINT32_MAX;
+	passed &= checkRejected("id bound of 2^32 - 1", hugeBound);
+
+	// point the first decoration at an id past the bound
+	std::vector<uint32_t> outOfBound = code;
+	for (offset = 5; offset < outOfBound.size() && (outOfBound[offset] >> 16) != 0; offset += outOfBound[offset] >> 16)
+	{
+		if ((outOfBound[offset] & 0xFFFF) == OP_DECORATE)
+		{
+			outOfBound[offset + 1] = outOfBound[3] + 5;
+			break;
+		}
+	}
+	passed &= checkRejected("decoration of an id outside the bound", outOfBound);
+
+	std::vector<uint32_t> noEntryPoint(code.begin(), code.begin() + 5);
+	for (offset = 5; offset < code.size() && (code[offset] >> 16) != 0; offset += code[offset] >> 16)
+	{
+		if ((code[offset] & 0xFFFF) != OP_ENTRY_POINT)
+		{
+			noEntryPoint.insert(noEntryPoint.end(), code.begin() + offset, code.begin() + offset + (code[offset] >> 16));
+		}
+	}
+	passed &= checkRejected("no entry point", noEntryPoint);
+
+	printf("Reflection : %s\n", passed ? "passed" : "FAILED");
+
+	return passed;
+}
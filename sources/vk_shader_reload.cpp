@@ -0,0 +1,201 @@
+#include "vk_shader_reload.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// set by CMake to the glslc it found, the one on PATH otherwise
+#ifndef VK_SANDBOX_GLSLC
+#define VK_SANDBOX_GLSLC "glslc"
+#endif
+
+namespace
+{
+	// editors save in bursts (truncate and write, or write a temporary and rename it), changes are
+	// gathered until the directory stayed quiet this long
+	constexpr std::chrono::milliseconds SETTLE_TIME{ 50 };
+	// also how long stop may wait for the watcher thread
+	constexpr std::chrono::milliseconds POLL_INTERVAL{ 250 };
+
+	std::filesystem::file_time_type getWriteTime(const std::string& path)
+	{
+		std::error_code error;
+		return std::filesystem::last_write_time(path, error);
+	}
+}
+
+void ShaderReloader::addShader(const std::string& source, const std::string& spirv, const std::string& arguments)
+{
+	_shaders.push_back({ source, spirv, arguments, getWriteTime(source) });
+}
+
+void ShaderReloader::addDirectory(const std::string& directory)
+{
+	std::error_code error;
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error))
+	{
+		const std::filesystem::path& path = entry.path();
+		const std::string stage = path.extension().string();
+
+		if (stage == ".vert" || stage == ".frag" || stage == ".comp")
+		{
+			const std::filesystem::path spirv = path.parent_path() / (path.stem().string() + "_" + stage.substr(1) + ".spv");
+			addShader(path.generic_string(), spirv.generic_string());
+		}
+	}
+}
+
+bool ShaderReloader::start(const std::string& directory, std::function<void(const std::vector<std::string>& spirvPaths)>&& onCompiled)
+{
+	_directory = directory;
+	_onCompiled = std::move(onCompiled);
+	_stopping = false;
+
+#ifdef __linux__
+	_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (_inotify < 0 || inotify_add_watch(_inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		printf("Cannot watch %s, shader hot reload is disabled\n", directory.c_str());
+		if (_inotify >= 0)
+		{
+			close(_inotify);
+			_inotify = -1;
+		}
+		return false;
+	}
+#endif
+
+	_thread = std::thread([this]() { watchLoop(); });
+
+	return true;
+}
+
+void ShaderReloader::stop()
+{
+	if (!_thread.joinable())
+	{
+		return;
+	}
+
+	_stopping = true;
+	_thread.join();
+
+#ifdef __linux__
+	close(_inotify);
+	_inotify = -1;
+#endif
+}
+
+bool ShaderReloader::waitForChanges(std::vector<std::string>& changed, std::chrono::milliseconds timeout)
+{
+	const size_t changedBefore = changed.size();
+
+#ifdef __linux__
+	pollfd descriptor = { _inotify, POLLIN, 0 };
+	if (poll(&descriptor, 1, static_cast<int>(timeout.count())) <= 0)
+	{
+		return false;
+	}
+
+	alignas(inotify_event) char buffer[4096];
+	ssize_t length;
+	while ((length = read(_inotify, buffer, sizeof(buffer))) > 0)
+	{
+		for (char* event = buffer; event < buffer + length; event += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(event)->len)
+		{
+			const inotify_event* info = reinterpret_cast<inotify_event*>(event);
+			if (info->len > 0)
+			{
+				changed.push_back(info->name);
+			}
+		}
+	}
+#else
+	std::this_thread::sleep_for(timeout);
+
+	for (Shader& shader : _shaders)
+	{
+		const std::filesystem::file_time_type writeTime = getWriteTime(shader.source);
+		if (writeTime != shader.writeTime)
+		{
+			shader.writeTime = writeTime;
+			changed.push_back(std::filesystem::path(shader.source).filename().string());
+		}
+	}
+#endif
+
+	return changed.size() > changedBefore;
+}
+
+bool ShaderReloader::compile(const Shader& shader)
+{
+	const std::string temporary = shader.spirv + ".tmp";
+	std::string command = std::string("\"") + VK_SANDBOX_GLSLC + "\" " + shader.arguments + " \"" + shader.source + "\" -o \"" + temporary + "\"";
+#ifdef _WIN32
+	// cmd strips the outer pair of quotes of a command that starts with one
+	command = "\"" + command + "\"";
+#endif
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// glslc prints the errors itself
+	if (std::system(command.c_str()) != 0)
+	{
+		printf("Failed to compile %s, keeping the last %s\n", shader.source.c_str(), shader.spirv.c_str());
+		std::remove(temporary.c_str());
+		return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporary, shader.spirv, error);
+	if (error)
+	{
+		printf("Failed to replace %s: %s\n", shader.spirv.c_str(), error.message().c_str());
+		std::remove(temporary.c_str());
+		return false;
+	}
+
+	printf("Compiled %s to %s in %.1f ms\n", shader.source.c_str(), shader.spirv.c_str(),
+		std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+
+	return true;
+}
+
+void ShaderReloader::watchLoop()
+{
+	std::vector<std::string> changed;
+
+	while (!_stopping)
+	{
+		changed.clear();
+		if (!waitForChanges(changed, POLL_INTERVAL))
+		{
+			continue;
+		}
+
+		while (!_stopping && waitForChanges(changed, SETTLE_TIME))
+		{
+		}
+
+		std::vector<std::string> compiled;
+		for (const Shader& shader : _shaders)
+		{
+			const std::string name = std::filesystem::path(shader.source).filename().string();
+			if (std::find(changed.begin(), changed.end(), name) != changed.end() && compile(shader))
+			{
+				compiled.push_back(shader.spirv);
+			}
+		}
+
+		if (!compiled.empty())
+		{
+			_onCompiled(compiled);
+		}
+	}
+}
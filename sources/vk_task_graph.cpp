@@ -0,0 +1,176 @@
+#include "vk_task_graph.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+vkTask::TaskId vkTask::TaskGraph::addTask(const char* name, std::function<void()>&& function, std::initializer_list<TaskId> dependencies)
+{
+	TaskId id = static_cast<TaskId>(_tasks.size());
+
+	Task task;
+	task.name = name;
+	task.function = std::move(function);
+	task.dependencyCount = static_cast<uint32_t>(dependencies.size());
+
+	for (TaskId dependency : dependencies)
+	{
+		_tasks[dependency].dependents.push_back(id);
+	}
+
+	_tasks.push_back(std::move(task));
+
+	return id;
+}
+
+vkTask::TaskId vkTask::TaskGraph::addMainThreadTask(const char* name, std::function<void()>&& function, std::initializer_list<TaskId> dependencies)
+{
+	TaskId id = addTask(name, std::move(function), dependencies);
+	_tasks[id].mainThread = true;
+
+	return id;
+}
+
+void vkTask::TaskGraph::execute(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// more threads than tasks would only sleep
+	threadCount = std::min(threadCount, std::max(1u, static_cast<uint32_t>(_tasks.size())));
+
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	std::deque<TaskId> ready;
+	std::deque<TaskId> readyMain;
+	std::vector<uint32_t> waiting(_tasks.size());
+	size_t finished = 0;
+
+	for (TaskId i = 0; i < _tasks.size(); i++)
+	{
+		waiting[i] = _tasks[i].dependencyCount;
+		if (waiting[i] == 0)
+		{
+			(_tasks[i].mainThread ? readyMain : ready).push_back(i);
+		}
+	}
+
+	auto executeStart = std::chrono::high_resolution_clock::now();
+
+	auto worker = [&](uint32_t thread) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (finished < _tasks.size())
+		{
+			std::deque<TaskId>* queue = nullptr;
+			if (thread == 0 && !readyMain.empty())
+			{
+				queue = &readyMain;
+			}
+			else if (!ready.empty())
+			{
+				queue = &ready;
+			}
+
+			if (queue == nullptr)
+			{
+				wake.wait(lock);
+				continue;
+			}
+
+			TaskId id = queue->front();
+			queue->pop_front();
+
+			lock.unlock();
+
+			Task& task = _tasks[id];
+			auto start = std::chrono::high_resolution_clock::now();
+			task.function();
+			auto end = std::chrono::high_resolution_clock::now();
+
+			task.start = std::chrono::duration<double, std::milli>(start - executeStart).count();
+			task.end = std::chrono::duration<double, std::milli>(end - executeStart).count();
+			task.thread = thread;
+
+			lock.lock();
+
+			for (TaskId dependent : task.dependents)
+			{
+				if (--waiting[dependent] == 0)
+				{
+					(_tasks[dependent].mainThread ? readyMain : ready).push_back(dependent);
+				}
+			}
+
+			finished++;
+			wake.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < threadCount; i++)
+	{
+		threads.emplace_back(worker, i);
+	}
+
+	worker(0);
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	_wallTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - executeStart).count();
+}
+
+void vkTask::TaskGraph::printTimeline(const char* title) const
+{
+	constexpr int BAR_WIDTH = 48;
+
+	std::vector<TaskId> order(_tasks.size());
+	for (TaskId i = 0; i < _tasks.size(); i++)
+	{
+		order[i] = i;
+	}
+
+	std::sort(order.begin(), order.end(), [&](TaskId a, TaskId b) {
+		return _tasks[a].start < _tasks[b].start;
+	});
+
+	size_t nameWidth = 0;
+	double taskTime = 0.0;
+	for (const Task& task : _tasks)
+	{
+		nameWidth = std::max(nameWidth, task.name.size());
+		taskTime += task.end - task.start;
+	}
+
+	printf("%s timeline, %.2f ms wall, %.2f ms of tasks\n", title, _wallTime, taskTime);
+
+	for (TaskId id : order)
+	{
+		const Task& task = _tasks[id];
+
+		char bar[BAR_WIDTH + 1];
+		int first = _wallTime > 0.0 ? static_cast<int>(task.start / _wallTime * BAR_WIDTH) : 0;
+		int last = _wallTime > 0.0 ? static_cast<int>(task.end / _wallTime * BAR_WIDTH) : 0;
+		first = std::min(first, BAR_WIDTH - 1);
+		last = std::max(first, std::min(last, BAR_WIDTH - 1));
+
+		for (int i = 0; i < BAR_WIDTH; i++)
+		{
+			bar[i] = i >= first && i <= last ? '#' : '.';
+		}
+		bar[BAR_WIDTH] = '\0';
+
+		printf("  %-*s |%s| %8.2f -> %8.2f ms (%7.2f ms) thread %u\n", static_cast<int>(nameWidth), task.name.c_str(),
+			bar, task.start, task.end, task.end - task.start, task.thread);
+	}
+}
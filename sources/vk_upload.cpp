@@ -0,0 +1,523 @@
+#include "vk_upload.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include "vk_check.hpp"
+#include "vk_initializers.hpp"
+
+void StagingRing::init(VmaAllocator allocator, size_t capacity, VkDeviceSize alignment)
+{
+	_allocator = allocator;
+	_capacity = capacity;
+	_alignment = alignment;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+	bufferInfo.size = capacity;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+	allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+	VmaAllocationInfo info;
+	VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &allocInfo, &_buffer._buffer, &_buffer._allocation, &info));
+	_buffer._mapped = info.pMappedData;
+}
+
+void StagingRing::cleanup()
+{
+	vmaDestroyBuffer(_allocator, _buffer._buffer, _buffer._allocation);
+
+	_regions.clear();
+	_head = 0;
+	_used = 0;
+}
+
+bool StagingRing::allocate(size_t size, uint64_t value, VkDeviceSize& outOffset)
+{
+	if (_used == 0)
+	{
+		_head = 0;
+	}
+
+	const size_t tail = _regions.empty() ? _head : _regions.front().begin;
+	const size_t aligned = (_head + _alignment - 1) & ~(_alignment - 1);
+
+	size_t offset;
+	size_t end;
+
+	// the free space is [head, tail) once the live regions wrapped past the end, [head, capacity) and [0, tail) otherwise
+	if (_used > 0 && _head <= tail)
+	{
+		if (aligned + size > tail)
+		{
+			return false;
+		}
+
+		offset = aligned;
+		end = aligned + size;
+	}
+	else if (aligned + size <= _capacity)
+	{
+		offset = aligned;
+		end = aligned + size;
+	}
+	else if (size <= tail)
+	{
+		offset = 0;
+		end = size;
+	}
+	else
+	{
+		return false;
+	}
+
+	const size_t consumed = end > _head ? end - _head : _capacity - _head + end;
+
+	_regions.push_back(Region{ _head, consumed, value });
+	_used += consumed;
+	_head = end == _capacity ? 0 : end;
+
+	outOffset = offset;
+	return true;
+}
+
+void StagingRing::release(uint64_t completedValue)
+{
+	while (!_regions.empty() && _regions.front().value <= completedValue)
+	{
+		_used -= _regions.front().consumed;
+		_regions.pop_front();
+	}
+}
+
+void UploadManager::init(VkDevice device, VmaAllocator allocator, VkQueue transferQueue, uint32_t transferQueueFamily,
+	uint32_t graphicsQueueFamily, bool timelineSemaphoreSupported, size_t stagingRingSize, VkDeviceSize copyAlignment)
+{
+	_device = device;
+	_allocator = allocator;
+	_transferQueue = transferQueue;
+	_transferQueueFamily = transferQueueFamily;
+	_graphicsQueueFamily = graphicsQueueFamily;
+
+	// 16 keeps every offset a multiple of the texel size of the formats uploaded here
+	_ring.init(_allocator, stagingRingSize, copyAlignment > 16 ? copyAlignment : 16);
+	_maxChunkSize = (stagingRingSize / 4) & ~static_cast<size_t>(255);
+
+	VkCommandPoolCreateInfo poolInfo = vkInit::commandPoolCreateInfo(_transferQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	VK_CHECK(vkCreateCommandPool(_device, &poolInfo, nullptr, &_commandPool));
+
+	if (timelineSemaphoreSupported)
+	{
+		_vkGetSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(_device, "vkGetSemaphoreCounterValueKHR");
+		_vkWaitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(_device, "vkWaitSemaphoresKHR");
+		_timelineSupported = _vkGetSemaphoreCounterValue != nullptr && _vkWaitSemaphores != nullptr;
+	}
+
+	if (_timelineSupported)
+	{
+		VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		typeInfo.pNext = nullptr;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		typeInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphoreInfo = vkInit::semaphoreCreateInfo();
+		semaphoreInfo.pNext = &typeInfo;
+		VK_CHECK(vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_timeline));
+	}
+	else
+	{
+		VkFenceCreateInfo fenceInfo = vkInit::fenceCreateInfo();
+		VK_CHECK(vkCreateFence(_device, &fenceInfo, nullptr, &_fence));
+	}
+
+	printf("Uploads use %s transfer queue family %u, %s, %zu MB staging ring\n", hasDedicatedQueue() ? "the dedicated" : "the graphics",
+		_transferQueueFamily, _timelineSupported ? "timeline semaphore" : "blocking fence", stagingRingSize / (1024 * 1024));
+}
+
+void UploadManager::cleanup()
+{
+	flush();
+
+	if (!_inFlight.empty())
+	{
+		wait(UploadTicket{ _inFlight.back().value });
+	}
+
+	collect();
+
+	printf("Uploads : %llu bytes in %llu chunks, %zu batches, ring peak %zu / %zu bytes, %llu stalls\n",
+		(unsigned long long)_bytesUploaded, (unsigned long long)_chunks, _submittedBatches, _ringPeakUsed, _ring.getCapacity(), (unsigned long long)_stalls);
+
+	_ring.cleanup();
+
+	if (_timeline != VK_NULL_HANDLE)
+	{
+		vkDestroySemaphore(_device, _timeline, nullptr);
+	}
+
+	if (_fence != VK_NULL_HANDLE)
+	{
+		vkDestroyFence(_device, _fence, nullptr);
+	}
+
+	vkDestroyCommandPool(_device, _commandPool, nullptr);
+}
+
+VkCommandBuffer UploadManager::beginRecording()
+{
+	if (_recording.cmd != VK_NULL_HANDLE)
+	{
+		return _recording.cmd;
+	}
+
+	collect();
+
+	if (_freeCommandBuffers.empty())
+	{
+		VkCommandBufferAllocateInfo allocInfo = vkInit::commandBufferAllocateInfo(_commandPool, 1);
+		VkCommandBuffer cmd;
+		VK_CHECK(vkAllocateCommandBuffers(_device, &allocInfo, &cmd));
+		_freeCommandBuffers.push_back(cmd);
+	}
+
+	_recording.cmd = _freeCommandBuffers.back();
+	_recording.value = _nextValue;
+	_freeCommandBuffers.pop_back();
+
+	VkCommandBufferBeginInfo beginInfo = vkInit::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_CHECK(vkBeginCommandBuffer(_recording.cmd, &beginInfo));
+
+	return _recording.cmd;
+}
+
+VkDeviceSize UploadManager::allocateStaging(size_t size)
+{
+	VkDeviceSize offset;
+
+	collect();
+
+	while (!_ring.allocate(size, _nextValue, offset))
+	{
+		_stalls++;
+
+		// regions of the recording batch only retire after it is submitted
+		if (_recording.stagingBytes > 0)
+		{
+			flush();
+		}
+
+		if (_inFlight.empty())
+		{
+			printf("Staging ring of %zu bytes cannot hold an allocation of %zu bytes\n", _ring.getCapacity(), size);
+			exit(1);
+		}
+
+		wait(UploadTicket{ _inFlight.front().value });
+		collect();
+	}
+
+	_recording.stagingBytes += size;
+	_chunks++;
+	_bytesUploaded += size;
+
+	if (_ring.getUsed() > _ringPeakUsed)
+	{
+		_ringPeakUsed = _ring.getUsed();
+	}
+
+	return offset;
+}
+
+UploadTicket UploadManager::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, size_t size, const std::function<void(void* staging, size_t offset, size_t size)>& fill,
+	VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+	for (size_t copied = 0; copied < size;)
+	{
+		const size_t chunkSize = size - copied < _maxChunkSize ? size - copied : _maxChunkSize;
+		const VkDeviceSize stagingOffset = allocateStaging(chunkSize);
+
+		fill(_ring.getMapped() + stagingOffset, copied, chunkSize);
+		vmaFlushAllocation(_allocator, _ring.getAllocation(), stagingOffset, chunkSize);
+
+		VkCommandBuffer cmd = beginRecording();
+
+		VkBufferCopy copy;
+		copy.srcOffset = stagingOffset;
+		copy.dstOffset = dstOffset + copied;
+		copy.size = chunkSize;
+		vkCmdCopyBuffer(cmd, _ring.getBuffer(), dst, 1, &copy);
+
+		copied += chunkSize;
+	}
+
+	VkCommandBuffer cmd = beginRecording();
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccess;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = dst;
+	barrier.offset = dstOffset;
+	barrier.size = size;
+
+	if (!hasDedicatedQueue())
+	{
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		return UploadTicket{ _recording.value };
+	}
+
+	// the transfer family may not support dstStage, it only releases and the graphics queue acquires
+	barrier.srcQueueFamilyIndex = _transferQueueFamily;
+	barrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dstAccess;
+	_recording.bufferAcquires.push_back(barrier);
+	_recording.acquireStages |= dstStage;
+
+	return UploadTicket{ _recording.value };
+}
+
+UploadTicket UploadManager::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, size_t size,
+	VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+	return uploadBuffer(dst, dstOffset, size, [&](void* staging, size_t offset, size_t chunkSize) {
+		memcpy(staging, static_cast<const uint8_t*>(data) + offset, chunkSize);
+		}, dstStage, dstAccess);
+}
+
+UploadTicket UploadManager::uploadImage(VkImage dst, VkExtent3D extent, const void* pixels, size_t size, VkImageLayout finalLayout,
+	VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+	VkCommandBuffer cmd = beginRecording();
+
+	VkImageSubresourceRange range;
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = 1;
+	range.baseArrayLayer = 0;
+	range.layerCount = 1;
+
+	VkImageMemoryBarrier toTransfer = {};
+	toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	toTransfer.pNext = nullptr;
+	toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.image = dst;
+	toTransfer.subresourceRange = range;
+	toTransfer.srcAccessMask = 0;
+	toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+	// large images are streamed a band of whole rows at a time
+	const size_t rowSize = size / (static_cast<size_t>(extent.height) * extent.depth);
+	const uint32_t rowsPerChunk = rowSize < _maxChunkSize ? static_cast<uint32_t>(_maxChunkSize / rowSize) : 1;
+
+	for (uint32_t z = 0; z < extent.depth; z++)
+	{
+		for (uint32_t y = 0; y < extent.height; y += rowsPerChunk)
+		{
+			const uint32_t rows = extent.height - y < rowsPerChunk ? extent.height - y : rowsPerChunk;
+			const size_t chunkSize = rows * rowSize;
+			const VkDeviceSize stagingOffset = allocateStaging(chunkSize);
+
+			memcpy(_ring.getMapped() + stagingOffset, static_cast<const uint8_t*>(pixels) + (static_cast<size_t>(z) * extent.height + y) * rowSize, chunkSize);
+			vmaFlushAllocation(_allocator, _ring.getAllocation(), stagingOffset, chunkSize);
+
+			VkBufferImageCopy copyRegion = {};
+			copyRegion.bufferOffset = stagingOffset;
+			copyRegion.bufferRowLength = 0;
+			copyRegion.bufferImageHeight = 0;
+			copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copyRegion.imageSubresource.mipLevel = 0;
+			copyRegion.imageSubresource.baseArrayLayer = 0;
+			copyRegion.imageSubresource.layerCount = 1;
+			copyRegion.imageOffset = { 0, static_cast<int32_t>(y), static_cast<int32_t>(z) };
+			copyRegion.imageExtent = { extent.width, rows, 1 };
+
+			// allocateStaging may have submitted the previous batch, the layout carries over on the same queue
+			cmd = beginRecording();
+			vkCmdCopyBufferToImage(cmd, _ring.getBuffer(), dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+		}
+	}
+
+	VkImageMemoryBarrier toReadable = toTransfer;
+	toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	toReadable.newLayout = finalLayout;
+	toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	toReadable.dstAccessMask = dstAccess;
+
+	if (!hasDedicatedQueue())
+	{
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &toReadable);
+		return UploadTicket{ _recording.value };
+	}
+
+	// the release and the acquire both carry the layout transition, it is executed once
+	toReadable.srcQueueFamilyIndex = _transferQueueFamily;
+	toReadable.dstQueueFamilyIndex = _graphicsQueueFamily;
+	toReadable.dstAccessMask = 0;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &toReadable);
+
+	toReadable.srcAccessMask = 0;
+	toReadable.dstAccessMask = dstAccess;
+	_recording.imageAcquires.push_back(toReadable);
+	_recording.acquireStages |= dstStage;
+
+	return UploadTicket{ _recording.value };
+}
+
+UploadStats UploadManager::getStats() const
+{
+	UploadStats stats;
+	stats.ringCapacity = _ring.getCapacity();
+	stats.ringUsed = _ring.getUsed();
+	stats.ringPeakUsed = _ringPeakUsed;
+	stats.stalls = _stalls;
+	stats.chunks = _chunks;
+	stats.bytesUploaded = _bytesUploaded;
+
+	return stats;
+}
+
+UploadTicket UploadManager::flush()
+{
+	if (_recording.cmd == VK_NULL_HANDLE)
+	{
+		return UploadTicket{ _nextValue - 1 };
+	}
+
+	VK_CHECK(vkEndCommandBuffer(_recording.cmd));
+
+	VkSubmitInfo submit = vkInit::submitInfo(&_recording.cmd);
+
+	VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+	if (_timelineSupported)
+	{
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timelineInfo.pNext = nullptr;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &_recording.value;
+
+		submit.pNext = &timelineInfo;
+		submit.signalSemaphoreCount = 1;
+		submit.pSignalSemaphores = &_timeline;
+	}
+
+	VK_CHECK(vkQueueSubmit(_transferQueue, 1, &submit, _fence));
+
+	if (!_timelineSupported)
+	{
+		VK_CHECK(vkWaitForFences(_device, 1, &_fence, true, UINT64_MAX));
+		VK_CHECK(vkResetFences(_device, 1, &_fence));
+		_completedValue = _recording.value;
+	}
+	else
+	{
+		_pendingAcquireValue = _recording.value;
+	}
+
+	_pendingBufferAcquires.insert(_pendingBufferAcquires.end(), _recording.bufferAcquires.begin(), _recording.bufferAcquires.end());
+	_pendingImageAcquires.insert(_pendingImageAcquires.end(), _recording.imageAcquires.begin(), _recording.imageAcquires.end());
+	_pendingAcquireStages |= _recording.acquireStages;
+
+	UploadTicket ticket{ _recording.value };
+
+	_inFlight.push_back(std::move(_recording));
+	_recording = Batch{};
+	_nextValue++;
+	_submittedBatches++;
+
+	return ticket;
+}
+
+uint64_t UploadManager::getCompletedValue()
+{
+	if (_timelineSupported)
+	{
+		VK_CHECK(_vkGetSemaphoreCounterValue(_device, _timeline, &_completedValue));
+	}
+
+	return _completedValue;
+}
+
+bool UploadManager::isComplete(UploadTicket ticket)
+{
+	return ticket.value <= getCompletedValue();
+}
+
+void UploadManager::wait(UploadTicket ticket)
+{
+	// a ticket of the batch that is still recording has to be submitted first
+	if (ticket.value >= _nextValue)
+	{
+		flush();
+	}
+
+	if (!_timelineSupported || isComplete(ticket))
+	{
+		return;
+	}
+
+	VkSemaphoreWaitInfoKHR waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+	waitInfo.pNext = nullptr;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &_timeline;
+	waitInfo.pValues = &ticket.value;
+
+	VK_CHECK(_vkWaitSemaphores(_device, &waitInfo, UINT64_MAX));
+}
+
+uint64_t UploadManager::acquireSubmitted(VkCommandBuffer cmd)
+{
+	if (!_pendingBufferAcquires.empty() || !_pendingImageAcquires.empty())
+	{
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _pendingAcquireStages, 0, 0, nullptr,
+			static_cast<uint32_t>(_pendingBufferAcquires.size()), _pendingBufferAcquires.data(),
+			static_cast<uint32_t>(_pendingImageAcquires.size()), _pendingImageAcquires.data());
+
+		_pendingBufferAcquires.clear();
+		_pendingImageAcquires.clear();
+		_pendingAcquireStages = 0;
+	}
+
+	uint64_t waitValue = _pendingAcquireValue;
+	_pendingAcquireValue = 0;
+
+	collect();
+
+	return waitValue;
+}
+
+void UploadManager::collect()
+{
+	uint64_t completed = getCompletedValue();
+
+	while (!_inFlight.empty() && _inFlight.front().value <= completed)
+	{
+		Batch& batch = _inFlight.front();
+
+		VK_CHECK(vkResetCommandBuffer(batch.cmd, 0));
+		_freeCommandBuffers.push_back(batch.cmd);
+
+		_inFlight.pop_front();
+	}
+
+	_ring.release(completed);
+}